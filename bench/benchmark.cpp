@@ -0,0 +1,221 @@
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <iomanip>
+
+#include "../scripts/tac.cpp"
+#include "../scripts/utils.cpp"
+#include "../scripts/sourceFile.cpp"
+#include "../scripts/tokenStream.cpp"
+#include "../scripts/lexer.cpp"
+#include "../scripts/arena.cpp"
+#include "../scripts/constValue.cpp"
+#include "../scripts/symbolTable.cpp"
+#include "../scripts/ast.cpp"
+#include "../scripts/stringPool.cpp"
+#include "../scripts/loopVectorizer.cpp"
+#include "../scripts/intermediateCodeGenerator.cpp"
+#include "../scripts/controlFlowGraph.cpp"
+#include "../scripts/ssaOptimizer.cpp"
+#include "../scripts/parser.cpp"
+#include "../scripts/assembly.cpp"
+#include "../scripts/registerAllocator.cpp"
+#include "../scripts/peepholeOptimizer.cpp"
+#include "../scripts/assemblyGenerator.cpp"
+#include "../scripts/toolchain.cpp"
+#include "../scripts/virtualMachine.cpp"
+#include "../scripts/jitCompiler.cpp"
+#include "../scripts/sha256.cpp"
+#include "../scripts/compilationCache.cpp"
+#include "../scripts/timeReport.cpp"
+#include "../scripts/threadPool.cpp"
+#include "../scripts/compiler.cpp"
+
+using namespace std;
+
+/*
+Times the compiler's phases on its own, one at a time, and end to end.
+Every phase runs `repeat` times on the output of the phase before it, which
+is computed once outside the timed region, and the median run is reported
+together with its throughput in source megabytes and tokens per second.
+The end-to-end row is Compiler::translate() producing the TAC and assembly
+text, as a compile without output files would, on -j threads. The other rows
+run on one thread and cover every function of the program.
+*/
+struct PhaseResult
+{
+    string name;
+    double medianSeconds;
+};
+
+// Median wall time of `repeat` runs of `phase`, after one untimed warm-up run
+double medianSeconds(int repeat, const function<void()> &phase)
+{
+    phase();
+    vector<double> times;
+    for (int i = 0; i < repeat; i++)
+    {
+        auto start = chrono::steady_clock::now();
+        phase();
+        times.push_back(chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    }
+    sort(times.begin(), times.end());
+    return times[times.size() / 2];
+}
+
+vector<PhaseResult> benchmark(string_view source, int optimizationLevel, size_t threadCount, int repeat, size_t &tokenCount)
+{
+    vector<PhaseResult> results;
+
+    results.push_back({"lexer", medianSeconds(repeat, [&]
+                                              { Lexer(source).tokenize(); })});
+    TokenStream tokens = Lexer(source).tokenize();
+    tokenCount = tokens.size();
+
+    results.push_back({"parser", medianSeconds(repeat, [&]
+                                               {
+        SymbolTable symbolTable;
+        Arena arena;
+        Parser(tokens, symbolTable, arena).parseProgram(); })});
+    SymbolTable symbolTable;
+    Arena arena;
+    Parser parser(tokens, symbolTable, arena);
+    Stmt *program = parser.parseProgram();
+
+    // Loops are vectorized with SSE2 at -O1, as by the compiler without -mavx2
+    int vectorWidth = optimizationLevel >= 1 ? 2 : 0;
+    results.push_back({"intermediate code", medianSeconds(repeat, [&]
+                                                          { IntermediateCodeGenerator::generateProgram(program, parser.functions(), symbolTable, vectorWidth); })});
+    vector<IntermediateCodeGenerator> generated = IntermediateCodeGenerator::generateProgram(program, parser.functions(), symbolTable, vectorWidth);
+
+    // The optimizer rewrites the TAC in place, so each run starts from a copy
+    auto optimize = [&](vector<IntermediateCodeGenerator> &units)
+    {
+        for (IntermediateCodeGenerator &icg : units)
+        {
+            ControlFlowGraph cfg(icg.instructions);
+            cfg.threadJumps();
+            cfg.removeUnreachableBlocks();
+            if (optimizationLevel >= 1)
+            {
+                SsaOptimizer optimizer(cfg, icg);
+                optimizer.run();
+                cfg.threadJumps();
+                cfg.removeUnreachableBlocks();
+            }
+            icg.instructions = cfg.linearize();
+            icg.labelCount = cfg.labelCount();
+        }
+    };
+    results.push_back({optimizationLevel >= 1 ? "cfg and optimizer" : "control flow graph", medianSeconds(repeat, [&]
+                                                                                                      {
+        vector<IntermediateCodeGenerator> units = generated;
+        optimize(units); })});
+    vector<IntermediateCodeGenerator> optimized = generated;
+    optimize(optimized);
+
+    results.push_back({"assembly generator", medianSeconds(repeat, [&]
+                                                           {
+        vector<vector<size_t>> stringOffsets;
+        string strings = AssemblyGenerator::layoutStrings(optimized, stringOffsets);
+        vector<AssemblyGenerator> generators(optimized.size());
+        for (size_t unit = 0; unit < optimized.size(); unit++)
+        {
+            generators[unit].optimizationLevel = optimizationLevel;
+            generators[unit].generate(optimized[unit], stringOffsets[unit]);
+        }
+        ostringstream assembly;
+        AssemblyGenerator::printProgram(generators, strings, assembly); })});
+
+    CompileOptions options;
+    options.optimizationLevel = optimizationLevel;
+    options.threadCount = threadCount;
+    results.push_back({"end to end", medianSeconds(repeat, [&]
+                                                   {
+        ostringstream log;
+        Compiler(options, log).translate(source); })});
+    return results;
+}
+
+void printTable(const string &fileName, size_t bytes, size_t tokenCount, const vector<PhaseResult> &results)
+{
+    cout << fileName << ": " << bytes << " bytes, " << tokenCount << " tokens" << endl
+         << left << setw(22) << "  Phase" << right << setw(12) << "Median ms" << setw(10) << "MB/s" << setw(14) << "Tokens/s" << endl;
+    for (const PhaseResult &result : results)
+    {
+        cout << left << setw(22) << "  " + result.name << right << fixed << setprecision(3)
+             << setw(12) << result.medianSeconds * 1e3 << setprecision(1) << setw(10) << bytes / result.medianSeconds / 1e6
+             << setprecision(0) << setw(14) << tokenCount / result.medianSeconds << defaultfloat << endl;
+    }
+}
+
+void printJson(const string &fileName, size_t bytes, size_t tokenCount, int optimizationLevel, const vector<PhaseResult> &results)
+{
+    cout << "{\"input\": \"" << fileName << "\", \"bytes\": " << bytes << ", \"tokens\": " << tokenCount
+         << ", \"optimizationLevel\": " << optimizationLevel << ", \"phases\": [";
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        cout << (i == 0 ? "" : ", ") << fixed << setprecision(6) << "{\"name\": \"" << results[i].name
+             << "\", \"medianMs\": " << results[i].medianSeconds * 1e3 << ", \"mbPerSecond\": " << bytes / results[i].medianSeconds / 1e6
+             << ", \"tokensPerSecond\": " << tokenCount / results[i].medianSeconds << "}" << defaultfloat;
+    }
+    cout << "]}" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int optimizationLevel = 0;
+    int repeat = 5;
+    size_t threadCount = 1;
+    bool json = false;
+    vector<string> inputs;
+    bool validArguments = true;
+    for (int i = 1; i < argc && validArguments; i++)
+    {
+        string argument = argv[i];
+        if (argument == "-O0" || argument == "-O1")
+            optimizationLevel = argument[2] - '0';
+        else if (argument == "--repeat" && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            repeat = atoi(argv[++i]);
+        else if (argument == "-j" && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            threadCount = atoi(argv[++i]);
+        else if (argument == "--json")
+            json = true;
+        else if (argument[0] != '-')
+            inputs.push_back(argument);
+        else
+            validArguments = false;
+    }
+    if (!validArguments || inputs.empty())
+    {
+        cerr << "Usage: " << argv[0] << " [-O0|-O1] [-j <threads>] [--repeat <n>] [--json] <input-file>..." << endl;
+        return 1;
+    }
+
+    for (const string &input : inputs)
+    {
+        try
+        {
+            SourceFile source(input);
+            size_t tokenCount = 0;
+            vector<PhaseResult> results = benchmark(source.view(), optimizationLevel, threadCount, repeat, tokenCount);
+            if (json)
+                printJson(input, source.view().size(), tokenCount, optimizationLevel, results);
+            else
+                printTable(input, source.view().size(), tokenCount, results);
+        }
+        catch (const exception &error)
+        {
+            cerr << input << ":\n"
+                 << error.what() << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,379 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdlib>
+
+using namespace std;
+
+/*
+Generates large valid programs for the benchmarks. The same options and seed
+always give the same program, on any platform: the random numbers come from
+a fixed xorshift generator rather than the standard distributions.
+Programs stay inside what the parser accepts: every variable is initialized
+when declared, strings are only concatenated with strings, and division is
+only by non-zero literals. Loops count up to small constants and strings
+only grow outside them, so the programs also run to completion. With
+functions, the statements are shared out between them and the top level,
+and only top-level code outside loops calls them, so no call is run more
+than once.
+*/
+struct GeneratorOptions
+{
+    size_t statements = 1000; // Statements to emit, counting those inside blocks
+    int depth = 3;            // Deepest nesting of if/for/while bodies
+    int width = 4;            // Most operands in one expression
+    int loopPercent = 10;     // Chance of a statement being a for or while loop
+    int ifPercent = 10;       // Chance of a statement being an if, with an else half the time
+    int stringPercent = 10;   // Chance of a declaration being a string
+    int functions = 0;        // Functions defined before the top-level statements
+    uint64_t seed = 1;
+};
+
+class ProgramGenerator
+{
+public:
+    explicit ProgramGenerator(const GeneratorOptions &options) : options(options), state(options.seed * 0x9E3779B97F4A7C15ull + 1) {}
+
+    string generate()
+    {
+        size_t share = options.statements / (options.functions + 1);
+        for (int i = 0; i < options.functions; i++)
+            function(share);
+        scopes.emplace_back();
+        while (emitted < options.statements)
+            statement(0);
+        line("return " + intExpression(options.width) + ";");
+        return program;
+    }
+
+private:
+    struct Variable
+    {
+        string name;
+        bool isString;
+        bool assignable; // Loop counters are left alone so loops end
+    };
+
+    GeneratorOptions options;
+    uint64_t state;
+    vector<vector<Variable>> scopes;
+    string program;
+    int indent = 0;
+    size_t emitted = 0;
+    int nextName = 0;
+    int loopDepth = 0; // Loops around the statement being generated
+    int definedFunctions = 0;
+    bool inFunction = false;
+
+    uint64_t next()
+    {
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        return state * 0x2545F4914F6CDD1Dull;
+    }
+
+    // Uniform in [0, bound)
+    int below(int bound)
+    {
+        return (int)(next() % (uint64_t)bound);
+    }
+
+    void line(const string &text)
+    {
+        program.append(4 * indent, ' ');
+        program += text;
+        program += '\n';
+    }
+
+    // int f<n>(int a, int b) { ... return ...; }, with `statements` statements in its body
+    void function(size_t statements)
+    {
+        line("int f" + to_string(definedFunctions) + "(int a, int b) {");
+        indent++;
+        inFunction = true;
+        scopes.emplace_back();
+        scopes.back().push_back({"a", false, true});
+        scopes.back().push_back({"b", false, true});
+        size_t end = emitted + statements;
+        while (emitted < end)
+            statement(0);
+        line("return " + intExpression(options.width) + ";");
+        scopes.pop_back();
+        inFunction = false;
+        indent--;
+        line("}");
+        definedFunctions++;
+    }
+
+    void statement(int depth)
+    {
+        emitted++;
+        int roll = below(100);
+        bool nest = depth < options.depth;
+        if (nest && roll < options.loopPercent)
+            loop(depth);
+        else if (nest && roll < options.loopPercent + options.ifPercent)
+            ifStatement(depth);
+        else if (below(3) == 0 || !hasAssignable())
+            declaration();
+        else
+            assignment();
+    }
+
+    void declaration()
+    {
+        string name = "v" + to_string(nextName++);
+        if (below(100) < options.stringPercent)
+        {
+            line("string " + name + " = " + stringLiteral() + ";");
+            scopes.back().push_back({name, true, true});
+        }
+        else
+        {
+            // A declaration's value has to start with a name or a number
+            string value = intExpression(options.width);
+            while (value[0] == '(')
+                value = intExpression(options.width);
+            if (definedFunctions > 0 && !inFunction && loopDepth == 0 && below(4) == 0)
+                value = "f" + to_string(below(definedFunctions)) + "(" + intExpression(2) + ", " + intExpression(2) + ") + " + value;
+            line("int " + name + " = " + value + ";");
+            scopes.back().push_back({name, false, true});
+        }
+    }
+
+    void assignment()
+    {
+        const Variable &target = pickAssignable();
+        if (target.isString && loopDepth > 0)
+        {
+            // Every concatenation a program runs stays allocated, so strings only grow outside loops
+            line(target.name + " = " + stringLiteral() + " + " + stringLiteral() + ";");
+        }
+        else if (target.isString)
+        {
+            const Variable *other = pick(true);
+            line(target.name + " = " + (other != nullptr && below(2) == 0 ? other->name : target.name) + " + " + stringLiteral() + ";");
+        }
+        else
+            line(target.name + " = " + intExpression(options.width) + ";");
+    }
+
+    void ifStatement(int depth)
+    {
+        line("if (" + condition() + ") {");
+        body(depth);
+        if (below(2) == 0)
+        {
+            line("} else {");
+            body(depth);
+        }
+        line("}");
+    }
+
+    void loop(int depth)
+    {
+        string counter = "i" + to_string(nextName++);
+        string limit = to_string(1 + below(8));
+        if (below(2) == 0)
+        {
+            line("for (int " + counter + " = 0; " + counter + " < " + limit + "; " + counter + "++) {");
+            scopes.emplace_back();
+            scopes.back().push_back({counter, false, false});
+            loopDepth++;
+            body(depth);
+            loopDepth--;
+            scopes.pop_back();
+            line("}");
+            return;
+        }
+        line("int " + counter + " = 0;");
+        scopes.back().push_back({counter, false, false});
+        line("while (" + counter + " < " + limit + ") {");
+        loopDepth++;
+        body(depth, counter + " = " + counter + " + 1;");
+        loopDepth--;
+        line("}");
+    }
+
+    // Braces are written by the caller, `last` ends the body
+    void body(int depth, const string &last = "")
+    {
+        scopes.emplace_back();
+        indent++;
+        int count = 1 + below(4);
+        for (int i = 0; i < count; i++)
+            statement(depth + 1);
+        if (!last.empty())
+            line(last);
+        indent--;
+        scopes.pop_back();
+    }
+
+    string condition()
+    {
+        static const char *const relations[] = {"<", ">", "<=", ">=", "==", "!="};
+        return intExpression(2) + " " + relations[below(6)] + " " + intExpression(2);
+    }
+
+    // Terms joined by + and -, each a product of factors
+    string intExpression(int operands)
+    {
+        int count = 1 + below(operands);
+        string text = term(count);
+        while (count > 0)
+        {
+            text += below(2) == 0 ? " + " : " - ";
+            text += term(count);
+        }
+        return text;
+    }
+
+    string term(int &operands)
+    {
+        string text = factor(operands);
+        while (operands > 0 && below(3) == 0)
+        {
+            if (below(2) == 0)
+                text += " * " + factor(operands);
+            else
+            {
+                text += " / " + to_string(1 + below(9));
+                operands--;
+            }
+        }
+        return text;
+    }
+
+    string factor(int &operands)
+    {
+        operands--;
+        if (operands >= 2 && below(8) == 0)
+        {
+            int inner = 1 + below(operands);
+            operands -= inner;
+            return "(" + intExpression(inner) + ")";
+        }
+        const Variable *variable = pick(false);
+        if (variable != nullptr && below(3) != 0)
+            return variable->name;
+        return to_string(below(100));
+    }
+
+    string stringLiteral()
+    {
+        string text = "\"";
+        int length = 3 + below(10);
+        for (int i = 0; i < length; i++)
+            text += (char)('a' + below(26));
+        return text + "\"";
+    }
+
+    // A visible variable of the given kind, recent scopes first, nullptr when there is none
+    const Variable *pick(bool isString)
+    {
+        for (int attempt = 0; attempt < 4; attempt++)
+        {
+            const vector<Variable> &scope = scopes[scopes.size() - 1 - below(min<int>(scopes.size(), 2 + attempt))];
+            if (scope.empty())
+                continue;
+            const Variable &variable = scope[below(scope.size())];
+            if (variable.isString == isString)
+                return &variable;
+        }
+        for (auto scope = scopes.rbegin(); scope != scopes.rend(); ++scope)
+        {
+            for (auto variable = scope->rbegin(); variable != scope->rend(); ++variable)
+            {
+                if (variable->isString == isString)
+                    return &*variable;
+            }
+        }
+        return nullptr;
+    }
+
+    bool hasAssignable() const
+    {
+        for (const vector<Variable> &scope : scopes)
+        {
+            for (const Variable &variable : scope)
+            {
+                if (variable.assignable)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    const Variable &pickAssignable()
+    {
+        vector<const Variable *> candidates;
+        for (const vector<Variable> &scope : scopes)
+        {
+            for (const Variable &variable : scope)
+            {
+                if (variable.assignable)
+                    candidates.push_back(&variable);
+            }
+        }
+        // Favor the innermost variables, as real code mostly does
+        size_t window = min<size_t>(candidates.size(), 16);
+        return *candidates[candidates.size() - 1 - below(window)];
+    }
+};
+
+int main(int argc, char *argv[])
+{
+    GeneratorOptions options;
+    string outputFile;
+    bool validArguments = true;
+    for (int i = 1; i < argc && validArguments; i++)
+    {
+        string argument = argv[i];
+        if (i + 1 >= argc)
+            validArguments = false;
+        else if (argument == "--statements")
+            options.statements = strtoull(argv[++i], nullptr, 10);
+        else if (argument == "--depth")
+            options.depth = atoi(argv[++i]);
+        else if (argument == "--width")
+            options.width = atoi(argv[++i]);
+        else if (argument == "--loops")
+            options.loopPercent = atoi(argv[++i]);
+        else if (argument == "--ifs")
+            options.ifPercent = atoi(argv[++i]);
+        else if (argument == "--strings")
+            options.stringPercent = atoi(argv[++i]);
+        else if (argument == "--functions")
+            options.functions = atoi(argv[++i]);
+        else if (argument == "--seed")
+            options.seed = strtoull(argv[++i], nullptr, 10);
+        else if (argument == "-o")
+            outputFile = argv[++i];
+        else
+            validArguments = false;
+    }
+    if (!validArguments || options.width < 1 || options.depth < 0 || options.loopPercent + options.ifPercent > 100 || options.functions < 0)
+    {
+        cerr << "Usage: " << argv[0] << " [--statements <n>] [--depth <n>] [--width <n>] [--loops <percent>] [--ifs <percent>]" << endl
+             << "       " << string(string(argv[0]).size(), ' ') << " [--strings <percent>] [--functions <n>] [--seed <n>] [-o <output-file>]" << endl;
+        return 1;
+    }
+
+    string program = ProgramGenerator(options).generate();
+    if (outputFile.empty())
+    {
+        cout << program;
+        return 0;
+    }
+    ofstream file(outputFile);
+    if (!file.is_open())
+    {
+        cerr << "Error: Could not write to file " << outputFile << endl;
+        return 1;
+    }
+    file << program;
+    return 0;
+}
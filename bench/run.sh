@@ -0,0 +1,25 @@
+#!/bin/sh
+# Builds the generator and the harness, generates the standard workloads and benchmarks them.
+# Extra arguments go to the harness, e.g. ./bench/run.sh -O1 -j 8 --repeat 10 --json
+set -e
+cd "$(dirname "$0")"
+
+g++ -std=c++17 -O2 generate.cpp -o generate
+g++ -std=c++17 -O2 -pthread benchmark.cpp -o benchmark
+
+# Fixed seeds, so every run measures the same programs
+mkdir -p workloads
+./generate --statements 2000 --seed 1 -o workloads/small.jwd
+./generate --statements 50000 --seed 2 -o workloads/large.jwd
+./generate --statements 20000 --depth 8 --loops 25 --ifs 25 --seed 3 -o workloads/nested.jwd
+./generate --statements 20000 --width 16 --seed 4 -o workloads/wide.jwd
+./generate --statements 20000 --strings 60 --seed 5 -o workloads/strings.jwd
+./generate --statements 50000 --functions 50 --seed 6 -o workloads/functions.jwd
+
+# The same program shape at doubling sizes; a phase whose time more than doubles per step is superlinear
+for statements in 2000 4000 8000 16000 32000; do
+    ./generate --statements $statements --seed 7 -o workloads/scale-$statements.jwd
+done
+
+./benchmark "$@" workloads/small.jwd workloads/large.jwd workloads/nested.jwd workloads/wide.jwd workloads/strings.jwd workloads/functions.jwd \
+    workloads/scale-2000.jwd workloads/scale-4000.jwd workloads/scale-8000.jwd workloads/scale-16000.jwd workloads/scale-32000.jwd
@@ -0,0 +1,151 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "scripts/toolchain.cpp"
+#include "scripts/compileProtocol.cpp"
+
+using namespace std;
+
+/*
+Thin client for a compiler started with `./main --server`. Takes the same
+arguments as main for a single file and writes the same outputs, but sends the
+source to the resident server instead of compiling it, so nothing is set up
+per invocation. Assembling and linking still run here, next to the files.
+Programs are not run by the server; use `./main --run` for that.
+*/
+
+string readFile(const string &fileName, bool &opened)
+{
+    ifstream file(fileName, ios::binary);
+    opened = file.is_open();
+    stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+void writeTextFile(const string &fileName, const string &text)
+{
+    ofstream file(fileName);
+    if (!file.is_open())
+        throw runtime_error("Error: Could not write to file " + fileName);
+    file << text;
+}
+
+// One request over a fresh connection, false if the server cannot be reached or hangs up
+bool exchange(const string &socketPath, const CompileRequest &request, CompileResponse &response)
+{
+    sockaddr_un address;
+    if (!socketAddress(socketPath, address))
+        return false;
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0)
+        return false;
+    string payload;
+    bool exchanged = connect(connection, (sockaddr *)&address, sizeof(address)) == 0 &&
+                     sendFrame(connection, encodeRequest(request)) && receiveFrame(connection, payload) &&
+                     decodeResponse(payload, response);
+    close(connection);
+    return exchanged;
+}
+
+int main(int argc, char *argv[])
+{
+    string inputFileName, outputFile;
+    string socketPath = defaultServerSocket();
+    CompileRequest request;
+    bool objectOnly = false;
+    bool validArguments = true;
+    auto endsWith = [](const string &text, const string &suffix)
+    { return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0; };
+    for (int i = 1; i < argc && validArguments; i++)
+    {
+        string argument = argv[i];
+        if (argument == "-O0" || argument == "-O1")
+            request.optimizationLevel = argument[2] - '0';
+        else if (argument == "-c")
+            objectOnly = true;
+        else if (argument == "--socket" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (argument == "-o" && i + 1 < argc && endsWith(argv[i + 1], ".jwd") && inputFileName.empty())
+            inputFileName = argv[++i];
+        else if (argument == "-o" && i + 1 < argc && outputFile.empty())
+            outputFile = argv[++i];
+        else if (argument[0] != '-' && inputFileName.empty())
+            inputFileName = argument;
+        else
+            validArguments = false;
+    }
+
+    if (!validArguments || inputFileName.empty())
+    {
+        cerr << "Usage: " << argv[0] << " [--socket <path>] [-O0|-O1] [-c] [-o <output-file>] <input-file>" << endl;
+        return 1;
+    }
+
+    bool opened;
+    request.source = readFile(inputFileName, opened);
+    if (!opened)
+    {
+        cerr << "Error: Could not open file " << inputFileName << endl;
+        return 1;
+    }
+
+    CompileResponse response;
+    if (!exchange(socketPath, request, response))
+    {
+        cerr << "Error: No compile server answering on " << socketPath << " (start one with ./main --server)" << endl;
+        return 1;
+    }
+    cout << response.log;
+    if (!response.succeeded)
+    {
+        cerr << response.error << endl;
+        return 1;
+    }
+
+    string tacFile = "output/TAC-Output.txt", assemblyFile = "output/Assembly-Output.txt";
+    try
+    {
+        writeTextFile(tacFile, response.tac);
+        cout << "Intermediate code written to " << tacFile << endl;
+        writeTextFile(assemblyFile, response.assembly);
+        cout << "Assembly code generated in " << assemblyFile << endl;
+
+        if (objectOnly)
+        {
+            if (outputFile.empty())
+            {
+                size_t slash = inputFileName.rfind('/'), dot = inputFileName.rfind('.');
+                bool hasExtension = dot != string::npos && (slash == string::npos || dot > slash);
+                outputFile = (hasExtension ? inputFileName.substr(0, dot) : inputFileName) + ".o";
+            }
+            Toolchain::assemble(assemblyFile, outputFile);
+            cout << "Object file written to " << outputFile << endl;
+        }
+        else if (!outputFile.empty())
+        {
+            string objectFile = outputFile + ".o";
+            Toolchain::assemble(assemblyFile, objectFile);
+            try
+            {
+                Toolchain::link(objectFile, outputFile);
+            }
+            catch (const runtime_error &)
+            {
+                remove(objectFile.c_str());
+                throw;
+            }
+            remove(objectFile.c_str());
+            cout << "Executable written to " << outputFile << endl;
+        }
+        cout << endl;
+    }
+    catch (const exception &error)
+    {
+        cerr << error.what() << endl;
+        return 1;
+    }
+    return 0;
+}
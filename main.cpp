@@ -2,56 +2,231 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <memory>
+#include <thread>
 
+#include "scripts/tac.cpp"
 #include "scripts/utils.cpp"
+#include "scripts/sourceFile.cpp"
+#include "scripts/tokenStream.cpp"
 #include "scripts/lexer.cpp"
+#include "scripts/arena.cpp"
+#include "scripts/constValue.cpp"
 #include "scripts/symbolTable.cpp"
+#include "scripts/ast.cpp"
+#include "scripts/stringPool.cpp"
+#include "scripts/loopVectorizer.cpp"
 #include "scripts/intermediateCodeGenerator.cpp"
+#include "scripts/controlFlowGraph.cpp"
+#include "scripts/ssaOptimizer.cpp"
 #include "scripts/parser.cpp"
+#include "scripts/assembly.cpp"
+#include "scripts/registerAllocator.cpp"
+#include "scripts/peepholeOptimizer.cpp"
 #include "scripts/assemblyGenerator.cpp"
+#include "scripts/toolchain.cpp"
+#include "scripts/virtualMachine.cpp"
+#include "scripts/jitCompiler.cpp"
+#include "scripts/sha256.cpp"
+#include "scripts/compilationCache.cpp"
+#include "scripts/timeReport.cpp"
+#include "scripts/threadPool.cpp"
+#include "scripts/compiler.cpp"
+#include "scripts/compileProtocol.cpp"
+#include "scripts/compileServer.cpp"
 
 using namespace std;
 
-int main(int argc, char *argv[])
+// prog.jwd -> prog + extension
+string replaceExtension(const string &fileName, const string &extension)
+{
+    size_t slash = fileName.rfind('/'), dot = fileName.rfind('.');
+    bool hasExtension = dot != string::npos && (slash == string::npos || dot > slash);
+    return (hasExtension ? fileName.substr(0, dot) : fileName) + extension;
+}
+
+/*
+Compiles every input on a work-stealing pool, each next to its source as
+prog.tac and prog.s (and prog.o with -c). Errors are reported per file in input
+order once all are done; returns 1 if any file failed.
+*/
+int compileBatch(const vector<string> &inputs, const CompileOptions &options, size_t threadCount)
 {
-    if (argc != 3)
+    vector<string> errors(inputs.size());
     {
-        cerr << "Usage: " << argv[0] << " -o <input-file>" << endl;
-        return 1;
+        ThreadPool pool(threadCount);
+        for (size_t i = 0; i < inputs.size(); i++)
+        {
+            pool.submit([&, i]
+                        {
+                CompileOptions fileOptions = options;
+                fileOptions.tacFile = replaceExtension(inputs[i], ".tac");
+                fileOptions.assemblyFile = replaceExtension(inputs[i], ".s");
+                fileOptions.outputFile = replaceExtension(inputs[i], ".o");
+                ostringstream log; // Progress messages of a batch are dropped
+                try
+                {
+                    Compiler(fileOptions, log).compile(inputs[i]);
+                }
+                catch (const exception &error)
+                {
+                    errors[i] = error.what();
+                } });
+        }
+        pool.wait();
     }
 
-    string inputFileName = argv[2];
-
-    ifstream inputFile(inputFileName);
-    if (!inputFile.is_open())
+    size_t failed = 0;
+    for (size_t i = 0; i < inputs.size(); i++)
     {
-        cerr << "Error: Could not open file " << inputFileName << endl;
-        return 1;
+        if (errors[i].empty())
+            continue;
+        cerr << inputs[i] << ":\n"
+             << errors[i] << endl;
+        failed++;
     }
+    cout << "Compiled " << inputs.size() - failed << " of " << inputs.size() << " files" << endl;
+    return failed == 0 ? 0 : 1;
+}
 
-    stringstream buffer;
-    buffer << inputFile.rdbuf();
-    string input = buffer.str();
-    inputFile.close();
+int main(int argc, char *argv[])
+{
+    // -O0 (default) or -O1 picks the optimization level
+    // -mavx2 lets -O1 vectorize loops with AVX2 instead of SSE2
+    // -o <file> names the executable (or the object file with -c); a .jwd file after -o is the input, as before
+    // --run interprets the program instead and --jit compiles it to memory and calls it, its return value becomes the exit status
+    // Several inputs, or --manifest <file> listing one per line, are compiled in parallel on -j <threads>; a single input has its functions compiled in parallel
+    // --cache-dir <dir> reuses the outputs of earlier compilations of the same source
+    // --time-report prints per-phase times, allocations and sizes to stderr, --time-report-json <file> writes them as JSON ("-" for stdout)
+    // --server stays resident and compiles for the jwdc client on -j <threads>, listening on --socket <path>
+    CompileOptions options;
+    vector<string> inputs;
+    string manifestFileName;
+    string socketPath = defaultServerSocket();
+    bool server = false;
+    bool timeReport = false;
+    string timeReportJsonFile;
+    size_t threadCount = thread::hardware_concurrency();
+    bool objectOnly = false;
+    bool interpret = false;
+    bool jit = false;
+    bool validArguments = true;
+    auto endsWith = [](const string &text, const string &suffix)
+    { return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0; };
+    for (int i = 1; i < argc && validArguments; i++)
+    {
+        string argument = argv[i];
+        if (argument == "-O0" || argument == "-O1")
+            options.optimizationLevel = argument[2] - '0';
+        else if (argument == "-mavx2")
+            options.avx2 = true;
+        else if (argument == "-c")
+            objectOnly = true;
+        else if (argument == "--run")
+            interpret = true;
+        else if (argument == "--jit")
+            jit = true;
+        else if (argument == "--time-report")
+            timeReport = true;
+        else if (argument == "--time-report-json" && i + 1 < argc)
+            timeReportJsonFile = argv[++i];
+        else if (argument == "--server")
+            server = true;
+        else if (argument == "--socket" && i + 1 < argc)
+            socketPath = argv[++i];
+        else if (argument == "-j" && i + 1 < argc && atoi(argv[i + 1]) > 0)
+            threadCount = atoi(argv[++i]);
+        else if (argument == "--cache-dir" && i + 1 < argc)
+            options.cacheDirectory = argv[++i];
+        else if (argument == "--manifest" && i + 1 < argc && manifestFileName.empty())
+            manifestFileName = argv[++i];
+        else if (argument == "-o" && i + 1 < argc && endsWith(argv[i + 1], ".jwd") && inputs.empty())
+            inputs.push_back(argv[++i]);
+        else if (argument == "-o" && i + 1 < argc && options.outputFile.empty())
+            options.outputFile = argv[++i];
+        else if (argument[0] != '-')
+            inputs.push_back(argument);
+        else
+            validArguments = false;
+    }
 
-    // Lexical Analysis
-    Lexer lexer(input);
-    vector<Token> tokens = lexer.tokenize();
+    if (!manifestFileName.empty())
+    {
+        ifstream manifest(manifestFileName);
+        if (!manifest.is_open())
+        {
+            cerr << "Error: Could not open file " << manifestFileName << endl;
+            return 1;
+        }
+        for (string line; getline(manifest, line);)
+        {
+            if (!line.empty())
+                inputs.push_back(line);
+        }
+    }
 
-    // Symbol Table, ICG, and Parser
-    SymbolTable symbolTable;
-    IntermediateCodeGenerator icg;
-    Parser parser(tokens, symbolTable, icg);
+    if (server)
+    {
+        if (!validArguments || !inputs.empty() || !manifestFileName.empty() || interpret || jit || objectOnly ||
+            !options.outputFile.empty() || timeReport || !timeReportJsonFile.empty())
+        {
+            cerr << "Usage: " << argv[0] << " --server [--socket <path>] [--cache-dir <dir>] [-mavx2] [-j <threads>]" << endl;
+            return 1;
+        }
+        try
+        {
+            CompileServer(socketPath, options, threadCount).run();
+        }
+        catch (const exception &error)
+        {
+            cerr << error.what() << endl;
+        }
+        return 1;
+    }
 
-    parser.parseProgram();
-    cout << "\nCompilation completed successfully." << endl;
+    bool batch = inputs.size() > 1 || !manifestFileName.empty();
+    bool inProcess = interpret || jit;
+    if (!validArguments || inputs.empty() || (interpret && jit) || (inProcess && (objectOnly || !options.outputFile.empty())) ||
+        (batch && (inProcess || !options.outputFile.empty() || timeReport || !timeReportJsonFile.empty())))
+    {
+        cerr << "Usage: " << argv[0] << " [-O0|-O1] [-mavx2] [--cache-dir <dir>] [--time-report] [--time-report-json <file>] [-c] [-o <output-file>] <input-file>" << endl
+             << "       " << argv[0] << " [-O0|-O1] [-mavx2] [--time-report] [--time-report-json <file>] --run|--jit <input-file>" << endl
+             << "       " << argv[0] << " [-O0|-O1] [-mavx2] [--cache-dir <dir>] [-c] [-j <threads>] <input-file>... | --manifest <file>" << endl
+             << "       " << argv[0] << " --server [--socket <path>] [--cache-dir <dir>] [-mavx2] [-j <threads>]" << endl;
+        return 1;
+    }
 
-    icg.writeToOutputFile("output/TAC-Output.txt");
+    options.mode = interpret ? MODE_RUN : jit ? MODE_JIT : objectOnly ? MODE_OBJECT : options.outputFile.empty() ? MODE_ASSEMBLY : MODE_EXECUTABLE;
+    if (batch)
+        return compileBatch(inputs, options, threadCount);
 
-    // Generate Assembly
-    AssemblyGenerator asmGen;
-    asmGen.generateAssembly(icg.instructions, "output/Assembly-Output.txt");
-    // asmGen.writeToFile("output/Assembly-Output.txt");
-    cout << endl;
-    return 0;
-}
\ No newline at end of file
+    if (objectOnly && options.outputFile.empty())
+        options.outputFile = replaceExtension(inputs[0], ".o");
+    // A single file spreads its functions over the threads instead
+    options.threadCount = threadCount;
+    countAllocations = timeReport || !timeReportJsonFile.empty();
+    try
+    {
+        Compiler compiler(options, cout);
+        int status = compiler.compile(inputs[0]);
+        if (!inProcess)
+            cout << endl;
+        if (timeReport)
+            compiler.timeReport().print(cerr);
+        if (timeReportJsonFile == "-")
+            compiler.timeReport().printJson(cout, inputs[0], options.optimizationLevel);
+        else if (!timeReportJsonFile.empty())
+        {
+            ofstream json(timeReportJsonFile);
+            if (!json.is_open())
+                throw runtime_error("Error: Could not write to file " + timeReportJsonFile);
+            compiler.timeReport().printJson(json, inputs[0], options.optimizationLevel);
+        }
+        return status;
+    }
+    catch (const exception &error)
+    {
+        cerr << error.what() << endl;
+        return 1;
+    }
+}
@@ -0,0 +1,76 @@
+#include <vector>
+#include <memory>
+#include <cstring>
+#include <string_view>
+#include <type_traits>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+/*
+Bump allocator for objects that live as long as one compilation.
+Memory is carved out of large blocks and released all at once when the arena
+is destroyed, so only trivially destructible types may be allocated from it.
+*/
+class Arena
+{
+public:
+    explicit Arena(size_t blockSize = 64 * 1024) : blockSize(blockSize) {}
+
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+
+    template <typename T, typename... Args>
+    T *make(Args &&...args)
+    {
+        static_assert(is_trivially_destructible<T>::value, "Arena objects are never destroyed");
+        void *memory = allocate(sizeof(T), alignof(T));
+        return new (memory) T{forward<Args>(args)...};
+    }
+
+    // Copy of `text` owned by the arena
+    string_view copyString(string_view text)
+    {
+        char *memory = static_cast<char *>(allocate(text.size(), 1));
+        memcpy(memory, text.data(), text.size());
+        return string_view(memory, text.size());
+    }
+
+    void *allocate(size_t size, size_t alignment)
+    {
+        size_t padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        if (cursor == nullptr || padding + size > static_cast<size_t>(limit - cursor))
+        {
+            // Oversized requests get a block of their own
+            size_t newBlockSize = max(blockSize, size + alignment);
+            blocks.emplace_back(new char[newBlockSize]);
+            cursor = blocks.back().get();
+            limit = cursor + newBlockSize;
+            reserved += newBlockSize;
+            padding = (alignment - reinterpret_cast<uintptr_t>(cursor) % alignment) % alignment;
+        }
+        void *memory = cursor + padding;
+        cursor += padding + size;
+        used += size;
+        return memory;
+    }
+
+    size_t bytesUsed() const
+    {
+        return used;
+    }
+
+    size_t bytesReserved() const
+    {
+        return reserved;
+    }
+
+private:
+    size_t blockSize;
+    vector<unique_ptr<char[]>> blocks;
+    char *cursor = nullptr;
+    char *limit = nullptr;
+    size_t used = 0;
+    size_t reserved = 0;
+};
@@ -0,0 +1,195 @@
+#include <cstdint>
+#include <string>
+
+using namespace std;
+
+/*
+Structured x86-64 assembly, kept as a list of instructions until it is printed
+as GNU as source in Intel syntax. Registers are numbered by their hardware
+encoding, and memory operands are stack slots addressed from RBP. Arrays are
+runs of stack slots, element e of an array sitting 8 * e bytes above its
+element 0, so an element is addressed from RBP plus the index register. String
+constants live in .rodata and are addressed relative to RIP. Vector registers
+are XMM registers, or YMM ones in code using AVX2.
+*/
+enum Register : uint8_t
+{
+    RAX,
+    RCX,
+    RDX,
+    RBX,
+    RSP,
+    RBP,
+    RSI,
+    RDI,
+    R8,
+    R9,
+    R10,
+    R11,
+    R12,
+    R13,
+    R14,
+    R15,
+};
+
+inline string registerName(int reg)
+{
+    static const char *names[] = {"RAX", "RCX", "RDX", "RBX", "RSP", "RBP", "RSI", "RDI",
+                                  "R8", "R9", "R10", "R11", "R12", "R13", "R14", "R15"};
+    return names[reg];
+}
+
+// Name of the low byte of a register, as written by SETcc
+inline string byteRegisterName(int reg)
+{
+    static const char *names[] = {"AL", "CL", "DL", "BL", "SPL", "BPL", "SIL", "DIL",
+                                  "R8B", "R9B", "R10B", "R11B", "R12B", "R13B", "R14B", "R15B"};
+    return names[reg];
+}
+
+enum AsmOperandKind : uint8_t
+{
+    ASM_NONE,
+    ASM_REGISTER,      // value is a Register
+    ASM_BYTE_REGISTER, // Low byte of the Register in value
+    ASM_IMMEDIATE,
+    ASM_STACK,     // Stack slot number, QWORD PTR [RBP - 8 * (value + 1)]
+    ASM_LABEL,     // Label number
+    ASM_STRING,    // Offset in the string constant blob, [RIP + .Lstrings + value]
+    ASM_RUNTIME,   // RuntimeRoutine called by the generated code
+    ASM_FUNCTION,  // Index of a function of the program, called at its label fn_<name>
+    ASM_ELEMENT,   // Element at the Register in index of the array whose element 0 is stack slot value,
+                   // QWORD PTR [RBP + 8 * index - 8 * (value + 1)]
+    ASM_VECTOR,    // XMM or YMM register number
+};
+
+// Helpers the generated code calls into, emitted after the program when used
+enum RuntimeRoutine : uint8_t
+{
+    RUNTIME_CONCAT, // Left then right pushed by the caller, result in RAX, other registers preserved
+};
+
+inline string runtimeName(int routine)
+{
+    static const char *names[] = {"jwd_concat"};
+    return names[routine];
+}
+
+struct AsmOperand
+{
+    AsmOperandKind kind = ASM_NONE;
+    int64_t value = 0;
+    uint8_t index = 0; // Index register of an ASM_ELEMENT
+
+    bool operator==(const AsmOperand &other) const
+    {
+        return kind == other.kind && value == other.value && index == other.index;
+    }
+
+    bool operator!=(const AsmOperand &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+inline AsmOperand registerOperand(Register reg)
+{
+    return AsmOperand{ASM_REGISTER, reg};
+}
+
+inline AsmOperand immediate(int64_t value)
+{
+    return AsmOperand{ASM_IMMEDIATE, value};
+}
+
+inline AsmOperand vectorOperand(int64_t number)
+{
+    return AsmOperand{ASM_VECTOR, number};
+}
+
+// Whether an immediate can be encoded in an instruction other than MOV
+inline bool fitsInt32(int64_t value)
+{
+    return value >= INT32_MIN && value <= INT32_MAX;
+}
+
+enum Condition : uint8_t
+{
+    COND_NONE,
+    COND_L,
+    COND_G,
+    COND_E,
+    COND_NE,
+    COND_LE,
+    COND_GE,
+    COND_B,  // Unsigned below, for bounds checks
+    COND_AE, // Unsigned above or equal
+};
+
+inline string conditionSuffix(Condition condition)
+{
+    static const char *suffixes[] = {"", "L", "G", "E", "NE", "LE", "GE", "B", "AE"};
+    return suffixes[condition];
+}
+
+// Condition under which a TAC comparison holds
+inline Condition conditionOf(TacOpcode op)
+{
+    switch (op)
+    {
+    case TAC_LT:
+        return COND_L;
+    case TAC_GT:
+        return COND_G;
+    case TAC_EQ:
+        return COND_E;
+    case TAC_NEQ:
+        return COND_NE;
+    case TAC_LE:
+        return COND_LE;
+    default:
+        return COND_GE;
+    }
+}
+
+enum AsmOpcode : uint8_t
+{
+    ASM_MOV,
+    ASM_MOVZX,
+    ASM_LEA,
+    ASM_ADD,
+    ASM_SUB,
+    ASM_IMUL,
+    ASM_IDIV,
+    ASM_CQO,
+    ASM_XOR,
+    ASM_CMP,
+    ASM_TEST,
+    ASM_SETCC,
+    ASM_JMP,
+    ASM_JCC,
+    ASM_PUSH,
+    ASM_POP,
+    ASM_CALL,
+    ASM_RET,
+    ASM_SYSCALL,
+    ASM_DEFINE_LABEL, // dest:
+    ASM_MOVDQU,       // Vector load or store, as VMOVDQU with AVX2
+    ASM_MOVDQA,       // Vector register copy
+    ASM_PADDQ,        // dest += src, lane by lane, as VPADDQ dest, extra, src with AVX2
+    ASM_PSUBQ,        // dest -= src, lane by lane, as VPSUBQ dest, extra, src with AVX2
+    ASM_MOVQ,         // Low lane of a vector register = a general purpose register
+    ASM_BROADCAST,    // Every lane = the low lane, PUNPCKLQDQ dest, dest or VPBROADCASTQ
+    ASM_VZEROUPPER,   // Clears the upper halves of the YMM registers before code that may use SSE
+    ASM_REP_STOSQ,    // RCX quadwords at RDI = RAX
+    ASM_UD2,          // Traps with SIGILL
+};
+
+struct AsmInstruction
+{
+    AsmOpcode op;
+    AsmOperand dest;
+    AsmOperand src;
+    Condition condition = COND_NONE; // For SETcc and Jcc
+    AsmOperand extra;                // First source of a three-operand AVX2 instruction
+};
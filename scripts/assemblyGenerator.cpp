@@ -1,216 +1,734 @@
 #include <iostream>
 #include <vector>
 #include <string>
-#include <map>
-#include <set>
 #include <fstream>
 
 using namespace std;
 
+/*
+Translates the TAC of one unit, the top-level statements or a function, into
+x86-64 instructions, and puts the units together into a complete GNU as
+program for Linux: string constants in .rodata, the top-level code in .text
+starting at _start, every function at its label fn_<name>, and the runtime
+helpers they call. The program ends with the exit syscall, its status being the
+returned value (0 when it runs off the end). Functions follow the System V
+convention for integer arguments: the first six in RDI, RSI, RDX, RCX, R8 and
+R9, the result in RAX, and RBX, RBP and R12 to R15 preserved.
+Arrays live in the stack frame, below the spill slots. An element whose index
+is not known while compiling is bounds-checked, and an index out of range
+jumps to a UD2 at the end of the unit, so the program dies with SIGILL.
+Vector code uses XMM registers with SSE2 when the TAC's vectorWidth is 2 and
+YMM registers with AVX2 when it is 4; XMM15 is kept as scratch.
+*/
 class AssemblyGenerator
 {
 private:
-    vector<string> assemblyCode;            // Holds the generated assembly code
-    map<string, string> variableToRegister; // Maps variables to registers
-    map<string, string> registerToVariable; // Maps registers to variables
-    vector<string> availableRegisters;      // Pool of available x86 registers
-    set<string> tempVariables;              // Tracks temporary variables
+    vector<AsmInstruction> assemblyCode;             // Holds the generated assembly code
+    RegisterAllocator allocator;                     // Register or stack slot of every temp and variable
+    const IntermediateCodeGenerator *code = nullptr; // TAC being translated, owns operand names
+    bool usesConcat = false;                         // Whether the concatenation helper is linked in
+    const vector<size_t> *stringOffsets = nullptr;   // String constant id -> offset in the program's blob, see layoutStrings()
+    vector<Register> savedRegisters;                 // Callee-saved registers the prologue pushes
+    size_t callCount = 0;                            // Calls translated so far
+    size_t argumentCount = 0;                        // Arguments pushed for the call being translated
+    int64_t frameSlots = 0;                          // Spill slots and then every array's elements
+    vector<int64_t> arrayBases;                      // Array id -> stack slot of its element 0
+    bool usesTrap = false;                           // Whether an index check jumps to the UD2 at the end
+    bool usesYmm = false;                            // Whether the code has AVX2 vector instructions
+
+    // Copies both NUL-terminated strings into a bump-allocated .bss heap, which is never freed
+    static constexpr const char *concatRuntime = R"(
+    .data
+jwd_heap_top:
+    .quad jwd_heap
+    .bss
+jwd_heap:
+    .zero 16777216
+    .text
+jwd_concat:
+    PUSH RCX
+    PUSH RSI
+    PUSH RDI
+    MOV RDI, QWORD PTR [RIP + jwd_heap_top]
+    MOV RAX, RDI
+    MOV RSI, QWORD PTR [RSP + 40]
+1:
+    MOV CL, BYTE PTR [RSI]
+    TEST CL, CL
+    JE 2f
+    MOV BYTE PTR [RDI], CL
+    INC RSI
+    INC RDI
+    JMP 1b
+2:
+    MOV RSI, QWORD PTR [RSP + 32]
+3:
+    MOV CL, BYTE PTR [RSI]
+    MOV BYTE PTR [RDI], CL
+    INC RSI
+    INC RDI
+    TEST CL, CL
+    JNE 3b
+    MOV QWORD PTR [RIP + jwd_heap_top], RDI
+    POP RDI
+    POP RSI
+    POP RCX
+    RET
+)";
+
+    // Registers the arguments of a call travel in, in order
+    static constexpr Register argumentRegisters[] = {RDI, RSI, RDX, RCX, R8, R9};
 
 public:
-    AssemblyGenerator()
+    int optimizationLevel = 0; // The peephole pass runs from -O1
+    bool callable = false;     // Return the program's value to a caller (the JIT) instead of exiting
+
+    /*
+    Lays out the string constants that the final code of the units uses as one
+    blob. Each unit interned its constants on its own, so they are merged into
+    one pool first; `offsets[unit][id]` is where constant `id` of a unit starts.
+    Constants the optimizer folded away are left out.
+    */
+    static string layoutStrings(const vector<IntermediateCodeGenerator> &units, vector<vector<size_t>> &offsets)
     {
-        // Initialize available x86 registers
-        availableRegisters = {"EAX", "EBX", "ECX", "EDX"};
+        StringPool merged;
+        vector<vector<int64_t>> mergedIds(units.size());
+        for (size_t unit = 0; unit < units.size(); unit++)
+        {
+            mergedIds[unit].assign(units[unit].strings.size(), -1);
+            for (const TacInstruction &instr : units[unit].instructions)
+            {
+                for (const TacOperand *operand : {&instr.left, &instr.right})
+                {
+                    if (operand->kind == OPERAND_STR && mergedIds[unit][operand->value] == -1)
+                        mergedIds[unit][operand->value] = merged.intern(units[unit].strings[operand->value]);
+                }
+            }
+        }
+        vector<size_t> mergedOffsets;
+        string blob = merged.layout(vector<bool>(merged.size(), true), mergedOffsets);
+        offsets.resize(units.size());
+        for (size_t unit = 0; unit < units.size(); unit++)
+        {
+            offsets[unit].assign(mergedIds[unit].size(), 0);
+            for (size_t id = 0; id < mergedIds[unit].size(); id++)
+            {
+                if (mergedIds[unit][id] != -1)
+                    offsets[unit][id] = mergedOffsets[mergedIds[unit][id]];
+            }
+        }
+        return blob;
     }
 
-    // Generate x86 assembly code from TAC
-    // Generate x86 assembly code from TAC
-    void generateAssembly(const vector<string> &tacLines, const string &outputFile)
+    // Instruction selection only, the result is left in instructions(); `offsets` must outlive the generator
+    void generate(const IntermediateCodeGenerator &icg, const vector<size_t> &offsets)
     {
-        for (const string &line : tacLines)
+        code = &icg;
+        stringOffsets = &offsets;
+        assemblyCode.clear();
+        usesConcat = false;
+        callCount = 0;
+        argumentCount = 0;
+        usesTrap = false;
+        usesYmm = icg.vectorWidth == 4 && any_of(icg.instructions.begin(), icg.instructions.end(), [](const TacInstruction &instr)
+                                                 { return isVectorOpcode(instr.op); });
+        allocator.allocate(icg.instructions);
+        frameSlots = allocator.stackSlots;
+        arrayBases.clear();
+        for (int64_t length : icg.arrayLengths)
         {
-            string trimmedLine = trim(line);
-            vector<string> tokens = split(trimmedLine, ' ');
-
-            // cout << "------------------ Start-----------------------" << endl;
-            // for (size_t i = 0; i < tokens.size(); i++)
-            // {
-            //     cout << "tokens[i]: " << tokens[i] << endl;
-            // }
-            // cout << "------------------ End-----------------------" << endl;
-            
-
-            if (tokens.empty()) continue; // Skip empty lines
+            frameSlots += length;
+            arrayBases.push_back(frameSlots - 1);
+        }
+        if (returns())
+        {
+            // Saved registers sit above RBP, so the spill slots below it are unchanged
+            savedRegisters = allocator.calleeSavedUsed();
+            for (Register reg : savedRegisters)
+                emit(ASM_PUSH, registerOperand(reg));
+            emit(ASM_PUSH, registerOperand(RBP));
+            emit(ASM_MOV, registerOperand(RBP), registerOperand(RSP));
+            if (frameSlots > 0)
+                emit(ASM_SUB, registerOperand(RSP), immediate(8 * ((frameSlots + 1) & ~1)));
+            receiveArguments();
+        }
+        else if (frameSlots > 0)
+        {
+            // Frame for spilled values and arrays, kept 16-byte aligned
+            emit(ASM_PUSH, registerOperand(RBP));
+            emit(ASM_MOV, registerOperand(RBP), registerOperand(RSP));
+            emit(ASM_SUB, registerOperand(RSP), immediate(8 * ((frameSlots + 1) & ~1)));
+        }
 
+        for (const TacInstruction &instr : allocator.instructions())
+        {
             // Handle different TAC instructions
-            if (tokens.size() == 3 && tokens[1] == "=") {
-                handleAssignment(tokens);
-            }
-            else if (tokens.size() == 5 && (tokens[3] == "+" || tokens[3] == "-" || tokens[3] == "*" || tokens[3] == "/")) {
-                handleArithmetic(tokens);
-            }
-            else if (tokens.size() == 4 && tokens[0] == "if") {
-                handleConditionalJump(tokens);
-            }
-            else if (tokens.size() == 2 && tokens[0] == "goto") {
-                handleUnconditionalJump(tokens);
-            }
-            else if (tokens.size() == 1 && tokens[0].back() == ':') {
-                handleLabel(tokens);
-            }
-            else if (tokens.size() == 2 && tokens[0] == "return") {
-                handleReturn(tokens);
-            }
-            else if (tokens.size() == 5 && (tokens[3] == ">" || tokens[3] == "<")) {
-                handleComparison(tokens);
-            }
-            else {
-                cerr << "Error: Unrecognized TAC instruction: " << line << endl;
+            switch (instr.op)
+            {
+            case TAC_COPY:
+                handleAssignment(instr);
+                break;
+            case TAC_ADD:
+            case TAC_SUB:
+            case TAC_MUL:
+                handleArithmetic(instr);
+                break;
+            case TAC_CONCAT:
+                handleConcatenation(instr);
+                break;
+            case TAC_DIV:
+                handleDivision(instr);
+                break;
+            case TAC_IF_LT:
+            case TAC_IF_GT:
+            case TAC_IF_EQ:
+            case TAC_IF_NEQ:
+            case TAC_IF_LE:
+            case TAC_IF_GE:
+                handleConditionalJump(instr);
+                break;
+            case TAC_GOTO:
+                handleUnconditionalJump(instr);
+                break;
+            case TAC_LABEL:
+                handleLabel(instr);
+                break;
+            case TAC_RETURN:
+                handleReturn(instr);
+                break;
+            case TAC_ARG:
+                handleArgument(instr);
+                break;
+            case TAC_CALL:
+                handleCall(instr);
+                break;
+            case TAC_LOAD_ELEMENT:
+                move(location(instr.dest), checkedElement(instr.left, instr.right));
+                break;
+            case TAC_STORE_ELEMENT:
+                move(checkedElement(instr.dest, instr.left), location(instr.right));
+                break;
+            case TAC_CLEAR:
+                handleClear(instr);
+                break;
+            case TAC_VECTOR_LOAD:
+                emit(ASM_MOVDQU, vectorOperand(instr.dest.value), element(instr.left, instr.right));
+                break;
+            case TAC_VECTOR_STORE:
+                emit(ASM_MOVDQU, element(instr.dest, instr.left), vectorOperand(instr.right.value));
+                break;
+            case TAC_VECTOR_SPLAT:
+                handleSplat(instr);
+                break;
+            case TAC_VECTOR_ADD:
+            case TAC_VECTOR_SUB:
+                handleVectorArithmetic(instr);
+                break;
+            default:
+                handleComparison(instr);
             }
         }
-        // Write all assembly instructions to the file
-        writeToFile(outputFile);
+        if (icg.instructions.empty() || icg.instructions.back().op != TAC_RETURN)
+            exitWith(immediate(0));
+        if (usesTrap)
+        {
+            emit(ASM_DEFINE_LABEL, trapLabel());
+            emit(ASM_UD2);
+        }
+        if (optimizationLevel >= 1)
+        {
+            PeepholeOptimizer peephole;
+            peephole.run(assemblyCode);
+        }
+    }
+
+    const vector<AsmInstruction> &instructions() const
+    {
+        return assemblyCode;
+    }
+
+    // Whether the code has YMM registers, whose instructions the JIT encodes with VEX prefixes
+    bool usesAvx2() const
+    {
+        return usesYmm;
+    }
+
+    // Functions return to their caller, and so does the program in callable mode
+    bool returns() const
+    {
+        return callable || code->isFunction();
     }
 
     // Handle simple assignments: a = b
-    void handleAssignment(const vector<string> &tokens)
+    void handleAssignment(const TacInstruction &instr)
     {
-        string dest = tokens[0];
-        string src = tokens[2];
-        assemblyCode.push_back("    MOV " + getRegister(dest) + ", " + src);
+        move(location(instr.dest), location(instr.left));
     }
 
-    // Handle arithmetic operations: temp = a + b, a - b, etc.
-    void handleArithmetic(const vector<string> &tokens)
+    // Handle arithmetic operations: temp = a + b, a - b, a * b
+    void handleArithmetic(const TacInstruction &instr)
     {
-        string dest = tokens[0];
-        string left = tokens[2];
-        string right = tokens[4];
-        string op = tokens[3];
+        AsmOperand dest = location(instr.dest);
+        AsmOperand left = location(instr.left);
+        AsmOperand right = location(instr.right);
+        if (dest == right && dest != left && instr.op != TAC_SUB)
+            swap(left, right);
 
-        string leftReg = getRegister(left);
+        // Work in the destination's register, unless it is in memory or loading the left operand would overwrite the right one
+        bool clobbersRight = dest == right && dest != left;
+        AsmOperand target = dest.kind == ASM_REGISTER && !clobbersRight ? dest : registerOperand(RAX);
+        move(target, left);
+        AsmOpcode op = instr.op == TAC_SUB ? ASM_SUB : (instr.op == TAC_MUL ? ASM_IMUL : ASM_ADD);
+        emit(op, target, sourceOperand(right));
+        move(dest, target);
+    }
 
-        // Load left operand into the register
-        assemblyCode.push_back("    MOV " + leftReg + ", " + left);
+    // Handle string concatenation: temp = a + b, through the runtime helper
+    void handleConcatenation(const TacInstruction &instr)
+    {
+        usesConcat = true;
+        emit(ASM_PUSH, sourceOperand(location(instr.left)));
+        emit(ASM_PUSH, sourceOperand(location(instr.right)));
+        emit(ASM_CALL, AsmOperand{ASM_RUNTIME, RUNTIME_CONCAT});
+        emit(ASM_ADD, registerOperand(RSP), immediate(16));
+        move(location(instr.dest), registerOperand(RAX));
+    }
 
-        if (op == "+") {
-            assemblyCode.push_back("    ADD " + leftReg + ", " + right);
-        } else if (op == "-") {
-            assemblyCode.push_back("    SUB " + leftReg + ", " + right);
-        } else if (op == "*") {
-            assemblyCode.push_back("    IMUL " + leftReg + ", " + right);
-        } else if (op == "/") {
-            assemblyCode.push_back("    IDIV " + right);
-        }
+    // Handle arguments: each is pushed, and the call pops them into their registers
+    void handleArgument(const TacInstruction &instr)
+    {
+        if (argumentCount++ == 0)
+            saveAcrossCall();
+        emit(ASM_PUSH, sourceOperand(location(instr.left)));
+    }
+
+    // Handle calls: temp = call f, the registers saved before the arguments are restored after it
+    void handleCall(const TacInstruction &instr)
+    {
+        if (argumentCount == 0)
+            saveAcrossCall();
+        for (size_t i = argumentCount; i-- > 0;)
+            emit(ASM_POP, registerOperand(argumentRegisters[i]));
+        emit(ASM_CALL, AsmOperand{ASM_FUNCTION, instr.left.value});
+        const vector<Register> &saved = allocator.savedAcross(callCount);
+        for (size_t i = saved.size(); i-- > 0;)
+            emit(ASM_POP, registerOperand(saved[i]));
+        move(location(instr.dest), registerOperand(RAX));
+        callCount++;
+        argumentCount = 0;
+    }
 
-        // Store the result back to the destination
-        assemblyCode.push_back("    MOV " + dest + ", " + leftReg);
+    // Handle division: temp = a / b, the dividend goes in RDX:RAX
+    void handleDivision(const TacInstruction &instr)
+    {
+        move(registerOperand(RAX), location(instr.left));
+        emit(ASM_CQO);
+        AsmOperand divisor = location(instr.right);
+        if (divisor.kind != ASM_REGISTER && divisor.kind != ASM_STACK)
+        {
+            move(registerOperand(R11), divisor);
+            divisor = registerOperand(R11);
+        }
+        emit(ASM_IDIV, divisor);
+        move(location(instr.dest), registerOperand(RAX));
     }
 
-    // Handle conditional jumps: if temp goto L1
-    void handleConditionalJump(const vector<string> &tokens)
+    // Handle conditional jumps: if a < b goto L1, a single CMP and Jcc
+    void handleConditionalJump(const TacInstruction &instr)
     {
-        string condition = tokens[1];
-        string label = tokens[3];
-        assemblyCode.push_back("    CMP " + condition + ", 0");
-        assemblyCode.push_back("    JNE " + label);
+        compare(instr.left, instr.right);
+        emit(ASM_JCC, AsmOperand{ASM_LABEL, instr.dest.value}, {}, conditionOf(comparisonOfBranch(instr.op)));
     }
 
     // Handle unconditional jumps: goto L1
-    void handleUnconditionalJump(const vector<string> &tokens)
+    void handleUnconditionalJump(const TacInstruction &instr)
     {
-        string label = tokens[1];
-        assemblyCode.push_back("    JMP " + label);
+        emit(ASM_JMP, AsmOperand{ASM_LABEL, instr.dest.value});
     }
 
     // Handle labels: L1:
-    void handleLabel(const vector<string> &tokens)
+    void handleLabel(const TacInstruction &instr)
     {
-        assemblyCode.push_back(tokens[0]);
+        emit(ASM_DEFINE_LABEL, AsmOperand{ASM_LABEL, instr.dest.value});
     }
 
-    // Handle return statements: return value
-    void handleReturn(const vector<string> &tokens)
+    // Handle return statements: the value goes back to the caller, or becomes the exit status of the program
+    void handleReturn(const TacInstruction &instr)
     {
-        string value = tokens[1];
-        assemblyCode.push_back("    MOV eax, " + value);
-        assemblyCode.push_back("    int 0x80"); // Exit syscall
+        exitWith(location(instr.left));
     }
 
-    // Handle comparisons: temp = a > b or temp = a < b
-    void handleComparison(const vector<string> &tokens)
+    // Handle array declarations: every element = 0, with REP STOSQ unless the array is short
+    void handleClear(const TacInstruction &instr)
     {
-        string dest = tokens[0];
-        string left = tokens[2];
-        string right = tokens[4];
-        string op = tokens[3];
+        int64_t base = arrayBases[instr.dest.value], length = code->arrayLengths[instr.dest.value];
+        if (length <= 8)
+        {
+            for (int64_t e = 0; e < length; e++)
+                emit(ASM_MOV, AsmOperand{ASM_STACK, base - e}, immediate(0));
+            return;
+        }
+        // RDI and RCX may hold values, the scratch RDX and R11 keep them meanwhile
+        emit(ASM_MOV, registerOperand(RDX), registerOperand(RDI));
+        emit(ASM_MOV, registerOperand(R11), registerOperand(RCX));
+        emit(ASM_LEA, registerOperand(RDI), AsmOperand{ASM_STACK, base});
+        emit(ASM_MOV, registerOperand(RCX), immediate(length));
+        emit(ASM_XOR, registerOperand(RAX), registerOperand(RAX));
+        emit(ASM_REP_STOSQ);
+        emit(ASM_MOV, registerOperand(RDI), registerOperand(RDX));
+        emit(ASM_MOV, registerOperand(RCX), registerOperand(R11));
+    }
 
-        string leftReg = getRegister(left);
+    // Handle splats: v = x in every lane, moved over from a general purpose register
+    void handleSplat(const TacInstruction &instr)
+    {
+        AsmOperand value = location(instr.left);
+        if (value.kind != ASM_REGISTER)
+        {
+            move(registerOperand(RAX), value);
+            value = registerOperand(RAX);
+        }
+        AsmOperand dest = vectorOperand(instr.dest.value);
+        emit(ASM_MOVQ, dest, value);
+        emit(ASM_BROADCAST, dest, dest);
+    }
 
-        assemblyCode.push_back("    MOV " + leftReg + ", " + left);
-        assemblyCode.push_back("    CMP " + leftReg + ", " + right);
+    /*
+    Handle vector arithmetic: v = a + b, a - b. AVX2 has a three-operand form;
+    SSE2 works in place, so the left operand is copied into the destination
+    first, and a destination that is the right operand of a subtraction goes
+    through the scratch XMM15.
+    */
+    void handleVectorArithmetic(const TacInstruction &instr)
+    {
+        AsmOpcode op = instr.op == TAC_VECTOR_ADD ? ASM_PADDQ : ASM_PSUBQ;
+        AsmOperand dest = vectorOperand(instr.dest.value);
+        AsmOperand left = vectorOperand(instr.left.value);
+        AsmOperand right = vectorOperand(instr.right.value);
+        if (usesYmm)
+        {
+            emit(op, dest, right, COND_NONE, left);
+            return;
+        }
+        if (dest == right && dest != left)
+        {
+            if (op == ASM_PADDQ)
+                swap(left, right);
+            else
+            {
+                emit(ASM_MOVDQA, vectorOperand(scratchVector), right);
+                right = vectorOperand(scratchVector);
+            }
+        }
+        if (dest != left)
+            emit(ASM_MOVDQA, dest, left);
+        emit(op, dest, right);
+    }
 
-        if (op == ">") {
-            assemblyCode.push_back("    SETg AL");
-        } else if (op == "<") {
-            assemblyCode.push_back("    SETl AL");
+    // Handle comparisons: temp = a > b, a < b, a == b, a != b, a <= b, a >= b
+    void handleComparison(const TacInstruction &instr)
+    {
+        AsmOperand dest = location(instr.dest);
+        compare(instr.left, instr.right);
+        emit(ASM_SETCC, AsmOperand{ASM_BYTE_REGISTER, RAX}, {}, conditionOf(instr.op));
+        AsmOperand target = dest.kind == ASM_REGISTER ? dest : registerOperand(RAX);
+        emit(ASM_MOVZX, target, AsmOperand{ASM_BYTE_REGISTER, RAX});
+        move(dest, target);
+    }
+
+    // The whole program as GNU as source, `units` being unit 0 (the top-level code) and the functions
+    static void printProgram(const vector<AssemblyGenerator> &units, const string &strings, ostream &out = cout)
+    {
+        out << "    .intel_syntax noprefix" << endl;
+        if (!strings.empty())
+        {
+            out << "    .section .rodata" << endl
+                << ".Lstrings:" << endl;
+            for (size_t start = 0; start < strings.size();)
+            {
+                size_t end = strings.find('\0', start);
+                out << "    .asciz " << quoted(string_view(strings).substr(start, end - start)) << endl;
+                start = end + 1;
+            }
+        }
+        out << "    .text" << endl
+            << "    .globl _start" << endl;
+        bool usesConcat = false;
+        for (const AssemblyGenerator &unit : units)
+        {
+            unit.printFunction(out);
+            usesConcat = usesConcat || unit.usesConcat;
+        }
+        if (usesConcat)
+            out << concatRuntime;
+    }
+
+    // The unit's instructions under the label it is entered at
+    void printFunction(ostream &out) const
+    {
+        out << (code->isFunction() ? "fn_" + code->name : string("_start")) << ":" << endl;
+        for (const auto &instr : assemblyCode)
+        {
+            out << instructionText(instr) << endl;
+        }
+    }
+
+    // String literal with the escapes GNU as expects
+    static string quoted(string_view text)
+    {
+        string result = "\"";
+        for (char c : text)
+        {
+            if (c == '"' || c == '\\')
+                result += '\\';
+            if (c == '\n')
+                result += "\\n";
+            else
+                result += c;
+        }
+        return result + "\"";
+    }
+
+    // Intel syntax spelling of an instruction, labels are flush left and everything else is indented
+    string instructionText(const AsmInstruction &instr) const
+    {
+        static const char *mnemonics[] = {"MOV", "MOVZX", "LEA", "ADD", "SUB", "IMUL", "IDIV", "CQO", "XOR", "CMP",
+                                          "TEST", "SET", "JMP", "J", "PUSH", "POP", "CALL", "RET", "SYSCALL", "",
+                                          "MOVDQU", "MOVDQA", "PADDQ", "PSUBQ", "MOVQ", "PUNPCKLQDQ", "VZEROUPPER", "REP STOSQ", "UD2"};
+        if (instr.op == ASM_DEFINE_LABEL)
+            return operandText(instr.dest) + ":";
+        if (instr.op >= ASM_MOVDQU && instr.op <= ASM_BROADCAST)
+            return vectorInstructionText(instr, mnemonics[instr.op]);
+        string text = "    " + string(mnemonics[instr.op]) + conditionSuffix(instr.condition);
+        if (instr.dest.kind != ASM_NONE)
+            text += " " + operandText(instr.dest);
+        if (instr.src.kind != ASM_NONE)
+            text += ", " + operandText(instr.src);
+        return text;
+    }
+
+    /*
+    SSE2 spelling, or the VEX-encoded AVX2 one on YMM registers: the
+    arithmetic takes three operands, and MOVQ and VPBROADCASTQ read the
+    low lane through the XMM register.
+    */
+    string vectorInstructionText(const AsmInstruction &instr, const string &mnemonic) const
+    {
+        string size = usesYmm ? "YMMWORD" : "XMMWORD";
+        auto text = [&](const AsmOperand &operand, bool narrow = false)
+        {
+            if (operand.kind == ASM_VECTOR)
+                return (usesYmm && !narrow ? "YMM" : "XMM") + to_string(operand.value);
+            return operandText(operand, size);
+        };
+        if (!usesYmm)
+            return "    " + mnemonic + " " + text(instr.dest) + ", " + text(instr.src);
+        switch (instr.op)
+        {
+        case ASM_PADDQ:
+        case ASM_PSUBQ:
+            return "    V" + mnemonic + " " + text(instr.dest) + ", " + text(instr.extra.kind == ASM_NONE ? instr.dest : instr.extra) +
+                   ", " + text(instr.src);
+        case ASM_MOVQ:
+            return "    VMOVQ " + text(instr.dest, true) + ", " + text(instr.src);
+        case ASM_BROADCAST:
+            return "    VPBROADCASTQ " + text(instr.dest) + ", " + text(instr.src, true);
+        default:
+            return "    V" + mnemonic + " " + text(instr.dest) + ", " + text(instr.src);
+        }
+    }
+
+    // `size` names the width of a memory operand
+    string operandText(const AsmOperand &operand, const string &size = "QWORD") const
+    {
+        switch (operand.kind)
+        {
+        case ASM_REGISTER:
+            return registerName(operand.value);
+        case ASM_BYTE_REGISTER:
+            return byteRegisterName(operand.value);
+        case ASM_IMMEDIATE:
+            return to_string(operand.value);
+        case ASM_STACK:
+            return size + " PTR [RBP - " + to_string(8 * (operand.value + 1)) + "]";
+        case ASM_ELEMENT:
+            return size + " PTR [RBP + " + registerName(operand.index) + "*8 - " + to_string(8 * (operand.value + 1)) + "]";
+        case ASM_LABEL:
+            // Every unit numbers its labels from 1, a function's carry its name
+            return ".L" + (code->isFunction() ? code->name + "_" : string()) + to_string(operand.value);
+        case ASM_STRING:
+            return operand.value == 0 ? "[RIP + .Lstrings]" : "[RIP + .Lstrings + " + to_string(operand.value) + "]";
+        case ASM_RUNTIME:
+            return runtimeName(operand.value);
+        case ASM_FUNCTION:
+            return "fn_" + string(code->functionName(operand.value));
+        default:
+            return "";
+        }
+    }
+
+private:
+    // CMP needs the left operand in a register or memory, and at most one memory operand
+    void compare(const TacOperand &leftOperand, const TacOperand &rightOperand)
+    {
+        AsmOperand left = location(leftOperand);
+        AsmOperand right = sourceOperand(location(rightOperand));
+        if ((left.kind != ASM_REGISTER && left.kind != ASM_STACK) || (left.kind == ASM_STACK && right.kind == ASM_STACK))
+        {
+            move(registerOperand(RAX), left);
+            left = registerOperand(RAX);
+        }
+        emit(ASM_CMP, left, right);
+    }
+
+    void emit(AsmOpcode op, AsmOperand dest = {}, AsmOperand src = {}, Condition condition = COND_NONE, AsmOperand extra = {})
+    {
+        assemblyCode.push_back(AsmInstruction{op, dest, src, condition, extra});
+    }
+
+    static constexpr int scratchVector = 15;
+
+    // A label past every label of the TAC, in front of the unit's UD2
+    AsmOperand trapLabel() const
+    {
+        return AsmOperand{ASM_LABEL, code->labelCount};
+    }
+
+    /*
+    Memory operand of element `index` of `array`: a stack slot when the index
+    is a constant, else addressed through the index's register, or R11 when
+    the index is in memory.
+    */
+    AsmOperand element(const TacOperand &array, const TacOperand &index)
+    {
+        int64_t base = arrayBases[array.value];
+        AsmOperand position = location(index);
+        if (position.kind == ASM_IMMEDIATE)
+            return AsmOperand{ASM_STACK, base - position.value};
+        if (position.kind != ASM_REGISTER)
+        {
+            move(registerOperand(R11), position);
+            position = registerOperand(R11);
         }
+        return AsmOperand{ASM_ELEMENT, base, (uint8_t)position.value};
+    }
+
+    // element() after making sure the index is in range, a single unsigned compare covering negative indexes too
+    AsmOperand checkedElement(const TacOperand &array, const TacOperand &index)
+    {
+        int64_t length = code->arrayLengths[array.value];
+        if (index.kind == OPERAND_IMM)
+        {
+            // The optimizer found the index, it is only wrong when the program gets here
+            if (index.value < 0 || index.value >= length)
+            {
+                usesTrap = true;
+                emit(ASM_JMP, trapLabel());
+                return AsmOperand{ASM_STACK, arrayBases[array.value]};
+            }
+            return element(array, index);
+        }
+        AsmOperand operand = element(array, index);
+        usesTrap = true;
+        emit(ASM_CMP, registerOperand((Register)operand.index), immediate(length));
+        emit(ASM_JCC, trapLabel(), {}, COND_AE);
+        return operand;
+    }
 
-        assemblyCode.push_back("    MOVzx " + dest + ", AL");
+    // Where a TAC operand's value is found
+    AsmOperand location(const TacOperand &operand) const
+    {
+        switch (operand.kind)
+        {
+        case OPERAND_IMM:
+            return immediate(operand.value);
+        case OPERAND_STR:
+            return AsmOperand{ASM_STRING, (int64_t)(*stringOffsets)[operand.value]};
+        default:
+            return allocator.locationOf(operand);
+        }
     }
 
-    // Helper function to get a register for a variable
-    string getRegister(const string &var)
+    // Second operand of an ALU instruction, which cannot take a 64-bit immediate
+    AsmOperand sourceOperand(AsmOperand operand)
     {
-        if (variableToRegister.find(var) == variableToRegister.end()) {
-            string reg = availableRegisters.back();
-            availableRegisters.pop_back();
-            variableToRegister[var] = reg;
+        if ((operand.kind == ASM_IMMEDIATE && !fitsInt32(operand.value)) || operand.kind == ASM_STRING)
+        {
+            move(registerOperand(R11), operand);
+            return registerOperand(R11);
         }
-        return variableToRegister[var];
+        return operand;
     }
 
-    // Write the generated assembly code to a file
-    void writeToFile(const string &outputFile)
+    // MOV that goes through RAX when both sides would be memory, a string's address is taken with LEA
+    void move(AsmOperand dest, AsmOperand src)
     {
-        ofstream asmFile(outputFile);
-        for (const auto &line : assemblyCode) {
-            asmFile << line << endl;
+        if (dest == src)
+            return;
+        bool wideSource = src.kind == ASM_STACK || src.kind == ASM_ELEMENT || src.kind == ASM_STRING ||
+                          (src.kind == ASM_IMMEDIATE && !fitsInt32(src.value));
+        if ((dest.kind == ASM_STACK || dest.kind == ASM_ELEMENT) && wideSource)
+        {
+            move(registerOperand(RAX), src);
+            src = registerOperand(RAX);
         }
-        asmFile.close();
-        cout << "Assembly code generated in " << outputFile << endl;
+        emit(src.kind == ASM_STRING ? ASM_LEA : ASM_MOV, dest, src);
     }
 
-    // Helper function: Split a string by a delimiter
-    vector<string> split(const string &line, char delimiter)
+    /*
+    Moves the arguments from their registers to where the allocator put the
+    parameters. A parameter may live in another argument's register, so they
+    all go through the stack. Parameters the code never reads are skipped.
+    */
+    void receiveArguments()
     {
-        vector<string> tokens;
-        string token;
-        istringstream tokenStream(line);
-        cout << "line.find('\"'): " << line.find('\"') << endl;
-        if (line.find('\"') != string::npos) {
-            
+        vector<size_t> received;
+        for (size_t i = 0; i < code->parameters.size(); i++)
+        {
+            if (allocator.isLiveOnEntry(code->parameters[i]))
+            {
+                emit(ASM_PUSH, registerOperand(argumentRegisters[i]));
+                received.push_back(i);
+            }
         }
-        while (getline(tokenStream, token, delimiter)) {
-            cout << "token: " << token << endl;
-            if (!token.empty()) tokens.push_back(token);
+        for (size_t i = received.size(); i-- > 0;)
+        {
+            AsmOperand parameter = location(code->parameters[received[i]]);
+            if (parameter.kind == ASM_REGISTER)
+                emit(ASM_POP, parameter);
+            else
+            {
+                emit(ASM_POP, registerOperand(RAX));
+                move(parameter, registerOperand(RAX));
+            }
         }
-        return tokens;
     }
 
-    // Helper function: Trim whitespace from a string
-    string trim(const string &str)
+    // Caller-saved registers whose values are needed after the next call, pushed before its arguments
+    void saveAcrossCall()
     {
-        size_t start = str.find_first_not_of(" \t");
-        size_t end = str.find_last_not_of(" \t");
-        return (start == string::npos || end == string::npos) ? "" : str.substr(start, end - start + 1);
+        for (Register reg : allocator.savedAcross(callCount))
+            emit(ASM_PUSH, registerOperand(reg));
     }
 
-    void printAssembly()
+    // exit(status) through the Linux syscall, or a return to the caller
+    void exitWith(AsmOperand status)
     {
-        for (const auto &line : assemblyCode)
+        if (returns())
         {
-            cout << line << endl;
+            move(registerOperand(RAX), status);
+            // The caller may run SSE code, which is slow while the upper halves of the YMM registers are dirty
+            if (usesYmm)
+                emit(ASM_VZEROUPPER);
+            emit(ASM_MOV, registerOperand(RSP), registerOperand(RBP));
+            emit(ASM_POP, registerOperand(RBP));
+            for (size_t i = savedRegisters.size(); i-- > 0;)
+                emit(ASM_POP, registerOperand(savedRegisters[i]));
+            emit(ASM_RET);
+            return;
         }
+        move(registerOperand(RDI), status);
+        emit(ASM_MOV, registerOperand(RAX), immediate(60));
+        emit(ASM_SYSCALL);
     }
 };
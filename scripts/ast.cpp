@@ -0,0 +1,74 @@
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/*
+Abstract syntax tree built by the parser.
+Nodes are allocated from the compilation's Arena and are plain structs linked
+by pointers; statement lists and call arguments are chained through `next`.
+Identifiers are already resolved, a node refers to its variable (or array) by
+symbol table index and a call to its function by index in the parser's
+function list.
+*/
+enum ExprKind : uint8_t
+{
+    EXPR_NUMBER,   // number
+    EXPR_STRING,   // text
+    EXPR_VARIABLE, // symbol
+    EXPR_BINARY,   // left op right
+    EXPR_CALL,     // symbol(left, left->next, ...), symbol is the function's index
+    EXPR_ELEMENT,  // symbol[left], an element of an array
+};
+
+struct Expr
+{
+    ExprKind kind;
+    TokenType dataType = T_INT; // Type of the value the expression produces
+    TokenType op = T_UNDEFINED; // Operator of a binary expression
+    int64_t number = 0;
+    string_view text;
+    uint32_t symbol = 0;
+    Expr *left = nullptr;
+    Expr *right = nullptr;
+    Expr *next = nullptr; // Next argument of a call
+};
+
+enum StmtKind : uint8_t
+{
+    STMT_DECLARATION, // symbol = value, value may be null; every element of an array starts at 0
+    STMT_ASSIGNMENT,  // symbol = value
+    STMT_INCREMENT,   // symbol = symbol op 1
+    STMT_IF,          // if (value) body else elseBody
+    STMT_WHILE,       // while (value) body
+    STMT_FOR,         // for (init; value; step) body
+    STMT_RETURN,      // return value
+    STMT_BLOCK,       // { body }
+    STMT_CALL,        // value; a call whose result is dropped
+    STMT_ELEMENT,     // symbol[index] = value
+};
+
+struct Stmt
+{
+    StmtKind kind;
+    size_t lineNumber = 0;
+    uint32_t symbol = 0;
+    TokenType op = T_UNDEFINED;
+    Expr *value = nullptr;
+    Expr *index = nullptr; // Element written by STMT_ELEMENT
+    Stmt *init = nullptr;
+    Stmt *step = nullptr;
+    Stmt *body = nullptr;
+    Stmt *elseBody = nullptr;
+    Stmt *next = nullptr; // Next statement in the enclosing list
+};
+
+// A function definition, `returnType name(parameters) { body }`
+struct Function
+{
+    string_view name;
+    TokenType returnType = T_INT;
+    vector<uint32_t> parameters; // Symbol table index of each parameter, in order
+    Stmt *body = nullptr;
+};
@@ -0,0 +1,99 @@
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <functional>
+#include <cerrno>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+On-disk cache of compiler outputs, addressed by content.
+The key is the SHA-256 of the source together with everything else that
+changes the output: the optimization level, whether AVX2 is used and the
+build of the compiler itself. An entry holds the TAC and assembly text of one compilation and lives
+at <directory>/<first two hex digits>/<key>. Entries are written to a temp
+file in the same directory and renamed into place, so a reader sees either no
+entry or a complete one, and compilers sharing the directory never clash.
+A cache that cannot be read or written only costs a recompilation.
+*/
+class CompilationCache
+{
+public:
+    explicit CompilationCache(const string &directory) : directory(directory) {}
+
+    static string keyOf(string_view source, int optimizationLevel, bool avx2)
+    {
+        Sha256 hash;
+        // A rebuilt compiler may produce different code, so its entries are never shared with an older one
+        hash.update("jwd-cache-v1 " __DATE__ " " __TIME__ "\n");
+        hash.update("-O" + to_string(optimizationLevel) + (avx2 ? " -mavx2" : "") + "\n");
+        hash.update(source);
+        return hash.hexDigest();
+    }
+
+    // Fills `tac` and `assembly` from the entry for `key`, false when there is none
+    bool load(const string &key, string &tac, string &assembly) const
+    {
+        ifstream file(entryPath(key), ios::binary);
+        if (!file.is_open())
+            return false;
+        stringstream buffer;
+        buffer << file.rdbuf();
+        string contents = buffer.str();
+
+        // "jwd-cache-v1 <TAC length> <assembly length>\n" followed by both texts
+        size_t headerLength = contents.find('\n') + 1;
+        string magic;
+        size_t tacLength = 0, assemblyLength = 0;
+        istringstream header(contents.substr(0, headerLength));
+        if (headerLength == 0 || !(header >> magic >> tacLength >> assemblyLength) || magic != "jwd-cache-v1" ||
+            contents.size() != headerLength + tacLength + assemblyLength)
+            return false;
+        tac = contents.substr(headerLength, tacLength);
+        assembly = contents.substr(headerLength + tacLength);
+        return true;
+    }
+
+    void store(const string &key, const string &tac, const string &assembly) const
+    {
+        string bucket = directory + "/" + key.substr(0, 2);
+        if (!makeDirectory(directory) || !makeDirectory(bucket))
+            return;
+
+        // Unique per process and thread, so concurrent writers of the same entry each rename a whole file
+        string temporary = entryPath(key) + ".tmp." + to_string(getpid()) + "." +
+                           to_string(hash<thread::id>()(this_thread::get_id()));
+        {
+            ofstream file(temporary, ios::binary);
+            if (!file.is_open())
+                return;
+            file << "jwd-cache-v1 " << tac.size() << " " << assembly.size() << "\n"
+                 << tac << assembly;
+            if (!file.flush())
+            {
+                file.close();
+                remove(temporary.c_str());
+                return;
+            }
+        }
+        if (rename(temporary.c_str(), entryPath(key).c_str()) != 0)
+            remove(temporary.c_str());
+    }
+
+private:
+    string directory;
+
+    string entryPath(const string &key) const
+    {
+        return directory + "/" + key.substr(0, 2) + "/" + key;
+    }
+
+    static bool makeDirectory(const string &path)
+    {
+        return mkdir(path.c_str(), 0755) == 0 || errno == EEXIST;
+    }
+};
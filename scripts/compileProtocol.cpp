@@ -0,0 +1,199 @@
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+Wire format between the compile server (main --server) and its client.
+One connection carries one request and its response, each sent as a frame:
+a 32-bit little-endian length followed by that many bytes. Inside a frame,
+integers are fixed-size little-endian and strings are a 32-bit length plus
+their bytes. The request carries the source text itself and the response the
+texts the compiler produced, so the server never touches the client's files.
+The server only compiles: programs never run inside it, where one that loops
+forever would hold a worker for good.
+*/
+
+// Directory the socket goes in by default, private to the user: $XDG_RUNTIME_DIR, or one of their own in /tmp
+inline string defaultServerDirectory()
+{
+    const char *runtimeDirectory = getenv("XDG_RUNTIME_DIR");
+    if (runtimeDirectory != nullptr && runtimeDirectory[0] == '/')
+        return runtimeDirectory;
+    return "/tmp/jwd-compiler-" + to_string(getuid());
+}
+
+inline string defaultServerSocket()
+{
+    return defaultServerDirectory() + "/jwd-compiler.sock";
+}
+
+struct CompileRequest
+{
+    uint8_t optimizationLevel = 0;
+    string source;
+};
+
+struct CompileResponse
+{
+    bool succeeded = false;
+    string tac;
+    string assembly;
+    string log;   // Progress messages
+    string error; // Diagnostic when the compilation failed
+};
+
+// Appends fields to a frame payload
+class FrameWriter
+{
+public:
+    string payload;
+
+    void putInteger(uint32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            payload += (char)(value >> (8 * i));
+    }
+
+    void putString(const string &text)
+    {
+        putInteger(text.size());
+        payload += text;
+    }
+};
+
+// Reads fields back out of a frame payload; a short payload makes every later read fail
+class FrameReader
+{
+public:
+    explicit FrameReader(const string &payload) : payload(payload) {}
+
+    bool getInteger(uint32_t &value)
+    {
+        if (payload.size() - offset < 4)
+            return false;
+        value = 0;
+        for (int i = 0; i < 4; i++)
+            value |= (uint32_t)(uint8_t)payload[offset + i] << (8 * i);
+        offset += 4;
+        return true;
+    }
+
+    bool getString(string &text)
+    {
+        uint32_t length;
+        if (!getInteger(length) || payload.size() - offset < length)
+            return false;
+        text = payload.substr(offset, length);
+        offset += length;
+        return true;
+    }
+
+private:
+    const string &payload;
+    size_t offset = 0;
+};
+
+inline string encodeRequest(const CompileRequest &request)
+{
+    FrameWriter writer;
+    writer.putInteger(request.optimizationLevel);
+    writer.putString(request.source);
+    return writer.payload;
+}
+
+inline bool decodeRequest(const string &payload, CompileRequest &request)
+{
+    FrameReader reader(payload);
+    uint32_t optimizationLevel;
+    if (!reader.getInteger(optimizationLevel) || !reader.getString(request.source))
+        return false;
+    request.optimizationLevel = optimizationLevel;
+    return true;
+}
+
+inline string encodeResponse(const CompileResponse &response)
+{
+    FrameWriter writer;
+    writer.putInteger(response.succeeded);
+    writer.putString(response.tac);
+    writer.putString(response.assembly);
+    writer.putString(response.log);
+    writer.putString(response.error);
+    return writer.payload;
+}
+
+inline bool decodeResponse(const string &payload, CompileResponse &response)
+{
+    FrameReader reader(payload);
+    uint32_t succeeded;
+    if (!reader.getInteger(succeeded) || !reader.getString(response.tac) ||
+        !reader.getString(response.assembly) || !reader.getString(response.log) || !reader.getString(response.error))
+        return false;
+    response.succeeded = succeeded != 0;
+    return true;
+}
+
+// Writes a whole frame, false if the peer went away
+inline bool sendFrame(int socket, const string &payload)
+{
+    FrameWriter header;
+    header.putInteger(payload.size());
+    string frame = header.payload + payload;
+    for (size_t sent = 0; sent < frame.size();)
+    {
+        ssize_t count = send(socket, frame.data() + sent, frame.size() - sent, MSG_NOSIGNAL);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        sent += count;
+    }
+    return true;
+}
+
+inline bool receiveExactly(int socket, char *buffer, size_t length)
+{
+    for (size_t received = 0; received < length;)
+    {
+        ssize_t count = recv(socket, buffer + received, length - received, 0);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return false;
+        received += count;
+    }
+    return true;
+}
+
+inline bool receiveFrame(int socket, string &payload)
+{
+    char header[4];
+    if (!receiveExactly(socket, header, 4))
+        return false;
+    string lengthField(header, 4);
+    uint32_t length = 0;
+    FrameReader(lengthField).getInteger(length);
+    // Nothing legitimate comes close, a bigger length means the peer is not speaking this protocol
+    if (length > (1u << 30))
+        return false;
+    payload.resize(length);
+    return receiveExactly(socket, payload.data(), length);
+}
+
+// Address of a socket path, false when the path does not fit
+inline bool socketAddress(const string &path, sockaddr_un &address)
+{
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(address.sun_path))
+        return false;
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
@@ -0,0 +1,117 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <stdexcept>
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+Resident compiler behind --server.
+Listens on a Unix socket and hands every accepted connection to a worker of
+the thread pool, which reads one CompileRequest, compiles the source with a
+fresh Compiler and answers with a CompileResponse. Nothing is written to
+disk apart from the compilation cache, if one is configured; the client
+writes the outputs where it wants them.
+Only the user who started the server can connect: the socket is created with
+mode 0600, and by default in a directory nobody else can enter.
+*/
+class CompileServer
+{
+public:
+    CompileServer(const string &socketPath, const CompileOptions &options, size_t threadCount)
+        : socketPath(socketPath), options(options), pool(threadCount) {}
+
+    // Serves until the process is killed, throws if the socket cannot be set up
+    void run()
+    {
+        sockaddr_un address;
+        if (!socketAddress(socketPath, address))
+            throw runtime_error("Socket path is too long: " + socketPath);
+        if (socketPath == defaultServerSocket())
+            preparePrivateDirectory(defaultServerDirectory());
+        removeStaleSocket();
+        int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (listener < 0)
+            throw runtime_error("Could not create a socket");
+        // Created without group and other permissions, so there is no moment where others can connect
+        mode_t previousMask = umask(0177);
+        bool bound = bind(listener, (sockaddr *)&address, sizeof(address)) == 0;
+        umask(previousMask);
+        if (!bound || listen(listener, SOMAXCONN) != 0)
+        {
+            close(listener);
+            throw runtime_error("Could not listen on " + socketPath);
+        }
+        cout << "Compile server listening on " << socketPath << endl;
+
+        while (true)
+        {
+            int connection = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+            if (connection < 0)
+                continue;
+            pool.submit([this, connection]
+                        {
+                serve(connection);
+                close(connection); });
+        }
+    }
+
+private:
+    string socketPath;
+    CompileOptions options;
+    ThreadPool pool;
+
+    // Creates `directory` for this user alone, or checks that the one already there is
+    static void preparePrivateDirectory(const string &directory)
+    {
+        if (mkdir(directory.c_str(), 0700) != 0 && errno != EEXIST)
+            throw runtime_error("Could not create " + directory);
+        struct stat status;
+        if (lstat(directory.c_str(), &status) != 0 || !S_ISDIR(status.st_mode) || status.st_uid != getuid() ||
+            (status.st_mode & 0077) != 0)
+            throw runtime_error(directory + " must be a directory owned by this user with mode 0700");
+    }
+
+    // A socket file left by an earlier server would make bind fail; anything else at the path is not ours to delete
+    void removeStaleSocket() const
+    {
+        struct stat status;
+        if (lstat(socketPath.c_str(), &status) != 0)
+            return;
+        if (!S_ISSOCK(status.st_mode))
+            throw runtime_error(socketPath + " already exists and is not a socket");
+        unlink(socketPath.c_str());
+    }
+
+    void serve(int connection)
+    {
+        string payload;
+        CompileRequest request;
+        if (!receiveFrame(connection, payload) || !decodeRequest(payload, request))
+            return;
+
+        CompileOptions requestOptions = options;
+        requestOptions.optimizationLevel = request.optimizationLevel;
+        requestOptions.mode = MODE_ASSEMBLY;
+        CompileResponse response;
+        ostringstream log;
+        try
+        {
+            CompileResult result = Compiler(requestOptions, log).translate(request.source);
+            response.succeeded = true;
+            response.tac = move(result.tac);
+            response.assembly = move(result.assembly);
+        }
+        catch (const exception &error)
+        {
+            response.error = error.what();
+        }
+        response.log = log.str();
+        sendFrame(connection, encodeResponse(response));
+    }
+};
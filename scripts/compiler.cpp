@@ -0,0 +1,329 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <memory>
+#include <functional>
+#include <exception>
+
+using namespace std;
+
+enum CompileMode : uint8_t
+{
+    MODE_ASSEMBLY,   // TAC and assembly text only
+    MODE_OBJECT,     // Also assemble into outputFile (-c)
+    MODE_EXECUTABLE, // Also assemble and link into outputFile (-o)
+    MODE_RUN,        // Interpret the TAC (--run)
+    MODE_JIT,        // Compile to memory and call it (--jit)
+};
+
+struct CompileOptions
+{
+    int optimizationLevel = 0;
+    CompileMode mode = MODE_ASSEMBLY;
+    string tacFile = "output/TAC-Output.txt";
+    string assemblyFile = "output/Assembly-Output.txt";
+    string outputFile;     // Object file or executable
+    string cacheDirectory; // Compilation cache, off when empty
+    size_t threadCount = 1; // Threads the functions of one program are optimized and translated on
+    bool avx2 = false;      // Vectorize with 256-bit AVX2 instructions instead of SSE2 (-mavx2)
+};
+
+// Texts a compilation produces, before they are written anywhere
+struct CompileResult
+{
+    string tac;
+    string assembly; // Empty with MODE_RUN and MODE_JIT
+    int status = 0;  // The program's exit status with MODE_RUN and MODE_JIT
+};
+
+/*
+The whole pipeline for one source file, from lexing to the requested output.
+Every stage is a fresh instance owned by translate(), so any number of
+compilations can run side by side on different threads. Problems in the
+program throw a CompileError and I/O or toolchain failures a runtime_error;
+nothing exits the process. Progress messages go to `log`.
+With a cache directory, a compilation that writes assembly first looks its
+source up in the CompilationCache and on a hit only writes out the stored
+TAC and assembly.
+Every phase is timed into timeReport(), which costs a couple of clock reads
+per phase whether or not the report is printed.
+The top-level code and every function are separate units from the
+intermediate code on. With several threads, the control flow graph,
+optimizer and code generation phases each run on all units at once, so a
+program with many functions takes about as long as its largest one. Only
+allocations on the compiling thread count towards a phase, and only when
+countAllocations is set.
+From -O1, counted loops over arrays are vectorized, two elements at a time
+with SSE2 or four with AVX2.
+*/
+class Compiler
+{
+public:
+    Compiler(const CompileOptions &options, ostream &log) : options(options), log(log) {}
+
+    // Compiles a file into the outputs named by the options, returns CompileResult::status
+    int compile(const string &inputFileName)
+    {
+        // Source stays mapped until the compilation is over, tokens are views into it
+        report.begin("read source");
+        SourceFile source(inputFileName);
+        report.end();
+        report.count("bytes", source.view().size());
+        CompileResult result = translate(source.view());
+
+        report.begin("write outputs");
+        writeTextFile(options.tacFile, result.tac);
+        log << "Intermediate code written to " << options.tacFile << endl;
+        if (options.mode == MODE_RUN || options.mode == MODE_JIT)
+        {
+            report.end();
+            return result.status;
+        }
+        writeTextFile(options.assemblyFile, result.assembly);
+        log << "Assembly code generated in " << options.assemblyFile << endl;
+        report.end();
+        if (options.mode == MODE_OBJECT || options.mode == MODE_EXECUTABLE)
+        {
+            report.begin("assemble and link");
+            buildNative();
+            report.end();
+        }
+        return result.status;
+    }
+
+    // Source text to TAC and assembly text, or to the program's status when it is run in-process
+    CompileResult translate(string_view source)
+    {
+        CompileResult result;
+        // The JIT runs its code on this machine, so AVX2 code needs a CPU that has it
+        if (options.mode == MODE_JIT && options.avx2 && !__builtin_cpu_supports("avx2"))
+            throw runtime_error("Error: -mavx2 code cannot run with --jit on a CPU without AVX2");
+
+        // The interpreter and the JIT need the code itself, not its text
+        bool cached = !options.cacheDirectory.empty() && options.mode != MODE_RUN && options.mode != MODE_JIT;
+        CompilationCache cache(options.cacheDirectory);
+        string cacheKey;
+        if (cached)
+        {
+            report.begin("cache lookup");
+            cacheKey = CompilationCache::keyOf(source, options.optimizationLevel, options.avx2);
+            bool hit = cache.load(cacheKey, result.tac, result.assembly);
+            report.end();
+            report.count("hit", hit);
+            if (hit)
+            {
+                log << "Cache hit, intermediate code and assembly restored from " << options.cacheDirectory << endl;
+                return result;
+            }
+        }
+
+        // Lexical Analysis
+        report.begin("lexer");
+        Lexer lexer(source);
+        TokenStream tokens = lexer.tokenize();
+        report.end();
+        report.count("tokens", tokens.size());
+
+        // Parser builds the AST in a per-compilation arena
+        report.begin("parser");
+        SymbolTable symbolTable;
+        Arena arena;
+        Parser parser(tokens, symbolTable, arena);
+        Stmt *program = parser.parseProgram();
+        symbolTable.displaySymbolTable(log);
+        log << "\nCompilation completed successfully." << endl;
+        report.end();
+
+        // Intermediate Code Generation, unit 0 is the top-level code and unit i + 1 function i
+        report.begin("intermediate code");
+        vector<IntermediateCodeGenerator> units = IntermediateCodeGenerator::generateProgram(program, parser.functions(), symbolTable, vectorWidth());
+        report.end();
+        report.count("functions", parser.functions().size());
+        report.count("instructions", totalOf(units, [](const IntermediateCodeGenerator &unit)
+                                             { return unit.instructions.size(); }));
+        report.count("temps", totalOf(units, [](const IntermediateCodeGenerator &unit)
+                                      { return (size_t)unit.tempCount; }));
+
+        // Split the TAC into basic blocks and drop code that can never run
+        report.begin("control flow graph");
+        vector<unique_ptr<ControlFlowGraph>> cfgs(units.size());
+        forEachUnit(units.size(), [&](size_t unit)
+                    {
+            cfgs[unit] = make_unique<ControlFlowGraph>(units[unit].instructions);
+            cfgs[unit]->threadJumps();
+            cfgs[unit]->removeUnreachableBlocks(); });
+        report.end();
+        if (options.optimizationLevel >= 1)
+        {
+            report.begin("optimizer");
+            forEachUnit(units.size(), [&](size_t unit)
+                        {
+                SsaOptimizer optimizer(*cfgs[unit], units[unit]);
+                optimizer.run();
+                cfgs[unit]->threadJumps();
+                cfgs[unit]->removeUnreachableBlocks(); });
+            report.end();
+        }
+        for (size_t unit = 0; unit < units.size(); unit++)
+        {
+            units[unit].instructions = cfgs[unit]->linearize();
+            units[unit].labelCount = cfgs[unit]->labelCount();
+        }
+        cfgs.clear();
+        report.count("instructions", totalOf(units, [](const IntermediateCodeGenerator &unit)
+                                             { return unit.instructions.size(); }));
+
+        report.begin("print TAC");
+        ostringstream tac;
+        for (size_t unit = 0; unit < units.size(); unit++)
+        {
+            if (unit > 0)
+                tac << "\n";
+            units[unit].printInstructions(tac);
+        }
+        result.tac = tac.str();
+        report.end();
+
+        if (options.mode == MODE_RUN)
+        {
+            report.begin("interpret");
+            VirtualMachine vm;
+            vm.load(units);
+            result.status = vm.run();
+            report.end();
+            return result;
+        }
+
+        // Generate Assembly, the string constants of all units are laid out first as code refers to them by offset
+        report.begin("code generation");
+        vector<vector<size_t>> stringOffsets;
+        string strings = AssemblyGenerator::layoutStrings(units, stringOffsets);
+        vector<AssemblyGenerator> generators(units.size());
+        forEachUnit(units.size(), [&](size_t unit)
+                    {
+            generators[unit].optimizationLevel = options.optimizationLevel;
+            // With the JIT, machine code goes straight into memory and no assembly text is produced
+            generators[unit].callable = options.mode == MODE_JIT;
+            generators[unit].generate(units[unit], stringOffsets[unit]); });
+        report.end();
+        report.count("instructions", totalOf(generators, [](const AssemblyGenerator &generator)
+                                             { return generator.instructions().size(); }));
+        if (options.mode == MODE_JIT)
+        {
+            report.begin("jit and run");
+            JitCompiler jit;
+            result.status = jit.run(generators, strings);
+            report.end();
+            return result;
+        }
+        report.begin("print assembly");
+        ostringstream assembly;
+        AssemblyGenerator::printProgram(generators, strings, assembly);
+        result.assembly = assembly.str();
+        report.end();
+        if (cached)
+        {
+            report.begin("cache store");
+            cache.store(cacheKey, result.tac, result.assembly);
+            report.end();
+        }
+        return result;
+    }
+
+    // Native object file or executable from the assembly file, per the options
+    void buildNative()
+    {
+        if (options.mode == MODE_OBJECT)
+        {
+            Toolchain::assemble(options.assemblyFile, options.outputFile);
+            log << "Object file written to " << options.outputFile << endl;
+        }
+        else if (options.mode == MODE_EXECUTABLE)
+        {
+            string objectFile = options.outputFile + ".o";
+            Toolchain::assemble(options.assemblyFile, objectFile);
+            try
+            {
+                Toolchain::link(objectFile, options.outputFile);
+            }
+            catch (const runtime_error &)
+            {
+                remove(objectFile.c_str());
+                throw;
+            }
+            remove(objectFile.c_str());
+            log << "Executable written to " << options.outputFile << endl;
+        }
+    }
+
+    const TimeReport &timeReport() const
+    {
+        return report;
+    }
+
+    static void writeTextFile(const string &fileName, const string &text)
+    {
+        ofstream file(fileName);
+        if (!file.is_open())
+            throw runtime_error("Error: Could not write to file " + fileName);
+        file << text;
+    }
+
+private:
+    CompileOptions options;
+    ostream &log;
+    TimeReport report;
+    unique_ptr<ThreadPool> workers; // Started by the first phase that has several units to work on
+
+    // Elements a vectorized loop handles at a time, 0 when loops are left alone
+    int vectorWidth() const
+    {
+        if (options.optimizationLevel < 1)
+            return 0;
+        return options.avx2 ? 4 : 2;
+    }
+
+    // Runs work(unit) for every unit, on the thread pool when there are several threads and units
+    void forEachUnit(size_t unitCount, const function<void(size_t)> &work)
+    {
+        if (options.threadCount <= 1 || unitCount == 1)
+        {
+            for (size_t unit = 0; unit < unitCount; unit++)
+                work(unit);
+            return;
+        }
+        if (!workers)
+            workers = make_unique<ThreadPool>(min(options.threadCount, unitCount));
+        // A task must not throw on a worker, the first failure is rethrown here instead
+        vector<exception_ptr> errors(unitCount);
+        for (size_t unit = 0; unit < unitCount; unit++)
+        {
+            workers->submit([&, unit]
+                            {
+                try
+                {
+                    work(unit);
+                }
+                catch (...)
+                {
+                    errors[unit] = current_exception();
+                } });
+        }
+        workers->wait();
+        for (const exception_ptr &error : errors)
+        {
+            if (error)
+                rethrow_exception(error);
+        }
+    }
+
+    template <typename T, typename Size>
+    static size_t totalOf(const vector<T> &items, Size sizeOf)
+    {
+        size_t total = 0;
+        for (const T &item : items)
+            total += sizeOf(item);
+        return total;
+    }
+};
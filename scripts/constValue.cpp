@@ -0,0 +1,187 @@
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <cstdint>
+#include <charconv>
+
+using namespace std;
+
+enum ConstKind : uint8_t
+{
+    CONST_NONE,   // Not known while compiling
+    CONST_INT,    // integer
+    CONST_FLOAT,  // real
+    CONST_STRING, // text
+};
+
+/*
+A value known at compile time, tagged with its kind.
+Integers are 64-bit and wrap like the generated code's registers. String
+text is a view of memory that lives as long as the compilation: the token
+stream's interned literals or the arena, which holds folded concatenations.
+*/
+struct ConstValue
+{
+    ConstKind kind = CONST_NONE;
+    union
+    {
+        int64_t integer = 0;
+        double real;
+    };
+    string_view text;
+
+    static ConstValue ofInt(int64_t value)
+    {
+        ConstValue constant;
+        constant.kind = CONST_INT;
+        constant.integer = value;
+        return constant;
+    }
+
+    static ConstValue ofFloat(double value)
+    {
+        ConstValue constant;
+        constant.kind = CONST_FLOAT;
+        constant.real = value;
+        return constant;
+    }
+
+    static ConstValue ofString(string_view value)
+    {
+        ConstValue constant;
+        constant.kind = CONST_STRING;
+        constant.text = value;
+        return constant;
+    }
+
+    bool isKnown() const
+    {
+        return kind != CONST_NONE;
+    }
+
+    // As shown in the symbol table, empty when the value is not known
+    string toString() const
+    {
+        switch (kind)
+        {
+        case CONST_INT:
+            return to_string(integer);
+        case CONST_FLOAT:
+        {
+            ostringstream text;
+            text << real;
+            return text.str();
+        }
+        case CONST_STRING:
+            return string(text);
+        default:
+            return "";
+        }
+    }
+};
+
+// Value of a decimal literal, false if it does not fit in 64 bits
+inline bool parseIntegerLiteral(string_view digits, int64_t &value)
+{
+    auto [end, error] = from_chars(digits.data(), digits.data() + digits.size(), value);
+    return error == errc() && end == digits.data() + digits.size();
+}
+
+// Strings grown by folding past this length are left to the program, so the arena cannot blow up
+constexpr size_t maxFoldedStringLength = 64 * 1024;
+
+/*
+Folds `left op right` the way the generated code would compute it, or
+returns CONST_NONE when it cannot: an operand is unknown, the kinds do not
+mix, or the operation traps at run time (division by zero and INT64_MIN / -1
+are left for the program to fault on). Arithmetic on an int and a float is
+done in floating point, comparisons give the int 0 or 1, and string + string
+is a concatenation copied into `arena`.
+*/
+inline ConstValue foldBinary(TokenType op, const ConstValue &left, const ConstValue &right, Arena &arena)
+{
+    if (left.kind == CONST_INT && right.kind == CONST_INT)
+    {
+        // Unsigned arithmetic wraps without undefined behaviour, as the registers do
+        uint64_t a = left.integer, b = right.integer;
+        switch (op)
+        {
+        case T_PLUS:
+            return ConstValue::ofInt((int64_t)(a + b));
+        case T_MINUS:
+            return ConstValue::ofInt((int64_t)(a - b));
+        case T_MUL:
+            return ConstValue::ofInt((int64_t)(a * b));
+        case T_DIV:
+            if (right.integer == 0 || (left.integer == INT64_MIN && right.integer == -1))
+                return ConstValue{};
+            return ConstValue::ofInt(left.integer / right.integer);
+        case T_LT:
+            return ConstValue::ofInt(left.integer < right.integer);
+        case T_GT:
+            return ConstValue::ofInt(left.integer > right.integer);
+        case T_LE:
+            return ConstValue::ofInt(left.integer <= right.integer);
+        case T_GE:
+            return ConstValue::ofInt(left.integer >= right.integer);
+        case T_EQ:
+            return ConstValue::ofInt(left.integer == right.integer);
+        case T_NEQ:
+            return ConstValue::ofInt(left.integer != right.integer);
+        default:
+            return ConstValue{};
+        }
+    }
+
+    bool numeric = (left.kind == CONST_INT || left.kind == CONST_FLOAT) && (right.kind == CONST_INT || right.kind == CONST_FLOAT);
+    if (numeric)
+    {
+        double a = left.kind == CONST_INT ? (double)left.integer : left.real;
+        double b = right.kind == CONST_INT ? (double)right.integer : right.real;
+        switch (op)
+        {
+        case T_PLUS:
+            return ConstValue::ofFloat(a + b);
+        case T_MINUS:
+            return ConstValue::ofFloat(a - b);
+        case T_MUL:
+            return ConstValue::ofFloat(a * b);
+        case T_DIV:
+            return ConstValue::ofFloat(a / b);
+        case T_LT:
+            return ConstValue::ofInt(a < b);
+        case T_GT:
+            return ConstValue::ofInt(a > b);
+        case T_LE:
+            return ConstValue::ofInt(a <= b);
+        case T_GE:
+            return ConstValue::ofInt(a >= b);
+        case T_EQ:
+            return ConstValue::ofInt(a == b);
+        case T_NEQ:
+            return ConstValue::ofInt(a != b);
+        default:
+            return ConstValue{};
+        }
+    }
+
+    if (left.kind == CONST_STRING && right.kind == CONST_STRING && op == T_PLUS &&
+        left.text.size() + right.text.size() <= maxFoldedStringLength)
+    {
+        char *memory = static_cast<char *>(arena.allocate(left.text.size() + right.text.size(), 1));
+        memcpy(memory, left.text.data(), left.text.size());
+        memcpy(memory + left.text.size(), right.text.data(), right.text.size());
+        return ConstValue::ofString(string_view(memory, left.text.size() + right.text.size()));
+    }
+    return ConstValue{};
+}
+
+struct Token
+{
+    TokenType type;
+    ConstValue value; // Value known while compiling, CONST_NONE when it depends on the run
+    size_t lineNumber;
+
+    // These attributes are only used to return values between functions
+    struct Expr *node = nullptr; // Tree computing the value
+};
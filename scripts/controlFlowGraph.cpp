@@ -0,0 +1,350 @@
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+
+struct PhiArgument
+{
+    int block; // Id of the predecessor the value flows in from
+    TacOperand value;
+};
+
+// dest = phi(...), only present while the optimizer keeps the graph in SSA form
+struct PhiNode
+{
+    TacOperand dest;
+    TacOperand original; // Name the phi was placed for
+    vector<PhiArgument> arguments;
+};
+
+struct BasicBlock
+{
+    int id = 0;                          // Stable identity, unlike the block's index it survives block removal
+    int64_t label = -1;                  // Label the block starts with, -1 if it has none
+    vector<PhiNode> phis;
+    vector<TacInstruction> instructions; // Body of the block, without its label
+    vector<int> successors;
+    vector<int> predecessors;
+};
+
+/*
+Control flow graph over flat TAC.
+Blocks are kept in layout order, so a block that does not end in a jump falls
+through to the next one in `blocks`; blocks[0] is the entry. Passes that edit
+instructions or blocks call computeEdges() (and computeDominators() if they
+need it) again afterwards, and linearize() turns the graph back into TAC.
+*/
+class ControlFlowGraph
+{
+public:
+    vector<BasicBlock> blocks;
+    vector<int> immediateDominators; // Block -> immediate dominator, -1 for the entry and unreachable blocks
+    vector<int> reversePostorder;    // Reachable blocks, every block before its successors except on back edges
+    vector<int> dominatorEnter;      // Block -> preorder number in the dominator tree, -1 when unreachable
+    vector<int> dominatorExit;       // Block -> largest preorder number among the blocks it dominates
+
+    explicit ControlFlowGraph(const vector<TacInstruction> &code)
+    {
+        blocks.push_back(newBlock());
+        for (const TacInstruction &instr : code)
+        {
+            if (instr.op == TAC_LABEL)
+            {
+                // A label starts a new block unless the current one is still empty and unlabeled
+                if (blocks.back().label != -1 || !blocks.back().instructions.empty())
+                    blocks.push_back(newBlock());
+                blocks.back().label = instr.dest.value;
+                nextLabel = max(nextLabel, instr.dest.value + 1);
+                continue;
+            }
+            blocks.back().instructions.push_back(instr);
+            if (isTerminator(instr.op))
+                blocks.push_back(newBlock());
+        }
+        computeEdges();
+    }
+
+    // Empty block with a fresh id, the caller places it in `blocks`
+    BasicBlock newBlock()
+    {
+        BasicBlock block;
+        block.id = nextBlockId++;
+        return block;
+    }
+
+    // Label of a block, giving it a fresh one if it has none yet
+    int64_t labelOf(int block)
+    {
+        if (blocks[block].label == -1)
+        {
+            blocks[block].label = newLabel();
+            labelBlocks[blocks[block].label] = block;
+        }
+        return blocks[block].label;
+    }
+
+    static bool isTerminator(TacOpcode op)
+    {
+        return isJumpOpcode(op) || op == TAC_RETURN;
+    }
+
+    // Fresh label number that does not clash with any label in the code
+    int64_t newLabel()
+    {
+        return nextLabel++;
+    }
+
+    int64_t labelCount() const
+    {
+        return nextLabel;
+    }
+
+    int blockOfLabel(int64_t label) const
+    {
+        return labelBlocks.at(label);
+    }
+
+    // Rebuilds successor and predecessor lists from the jumps and the block layout
+    void computeEdges()
+    {
+        labelBlocks.clear();
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            if (blocks[i].label != -1)
+                labelBlocks[blocks[i].label] = i;
+            blocks[i].successors.clear();
+            blocks[i].predecessors.clear();
+        }
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            BasicBlock &block = blocks[i];
+            bool fallsThrough = true;
+            if (!block.instructions.empty())
+            {
+                const TacInstruction &last = block.instructions.back();
+                if (isJumpOpcode(last.op))
+                    addEdge(i, blockOfLabel(last.dest.value));
+                fallsThrough = last.op != TAC_GOTO && last.op != TAC_RETURN;
+            }
+            if (fallsThrough && i + 1 < blocks.size())
+                addEdge(i, i + 1);
+        }
+    }
+
+    // Retargets jumps that land on empty blocks or on a lone goto to where control ends up
+    void threadJumps()
+    {
+        for (BasicBlock &block : blocks)
+        {
+            if (block.instructions.empty())
+                continue;
+            TacInstruction &last = block.instructions.back();
+            if (!isJumpOpcode(last.op))
+                continue;
+
+            int target = blockOfLabel(last.dest.value);
+            for (size_t hops = 0; hops < blocks.size(); hops++)
+            {
+                const BasicBlock &targetBlock = blocks[target];
+                if (targetBlock.instructions.empty() && target + 1 < (int)blocks.size())
+                    target++;
+                else if (targetBlock.instructions.size() == 1 && targetBlock.instructions[0].op == TAC_GOTO)
+                    target = blockOfLabel(targetBlock.instructions[0].dest.value);
+                else
+                    break;
+            }
+            last.dest.value = labelOf(target);
+        }
+        computeEdges();
+    }
+
+    // Drops blocks that cannot be reached from the entry, along with the jumps inside them
+    void removeUnreachableBlocks()
+    {
+        vector<bool> reachable(blocks.size(), false);
+        vector<int> worklist = {0};
+        reachable[0] = true;
+        while (!worklist.empty())
+        {
+            int block = worklist.back();
+            worklist.pop_back();
+            for (int successor : blocks[block].successors)
+            {
+                if (!reachable[successor])
+                {
+                    reachable[successor] = true;
+                    worklist.push_back(successor);
+                }
+            }
+        }
+
+        vector<BasicBlock> kept;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            if (reachable[i])
+                kept.push_back(move(blocks[i]));
+        }
+        blocks.swap(kept);
+        computeEdges();
+    }
+
+    // Immediate dominators by the iterative algorithm of Cooper, Harvey and Kennedy
+    void computeDominators()
+    {
+        computeReversePostorder();
+        vector<int> order(blocks.size(), -1); // Block -> position in reversePostorder
+        for (size_t i = 0; i < reversePostorder.size(); i++)
+            order[reversePostorder[i]] = i;
+
+        immediateDominators.assign(blocks.size(), -1);
+        immediateDominators[0] = 0;
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t i = 1; i < reversePostorder.size(); i++)
+            {
+                int block = reversePostorder[i];
+                int newDominator = -1;
+                for (int predecessor : blocks[block].predecessors)
+                {
+                    if (immediateDominators[predecessor] == -1)
+                        continue;
+                    newDominator = newDominator == -1 ? predecessor : intersect(predecessor, newDominator, order);
+                }
+                if (immediateDominators[block] != newDominator)
+                {
+                    immediateDominators[block] = newDominator;
+                    changed = true;
+                }
+            }
+        }
+        immediateDominators[0] = -1;
+
+        // A block dominates exactly the blocks numbered within its subtree
+        vector<vector<int>> children = dominatorTree();
+        dominatorEnter.assign(blocks.size(), -1);
+        dominatorExit.assign(blocks.size(), -1);
+        vector<pair<int, size_t>> stack = {{0, 0}}; // Block and its next child
+        int number = 0;
+        dominatorEnter[0] = number++;
+        while (!stack.empty())
+        {
+            auto &[block, next] = stack.back();
+            if (next < children[block].size())
+            {
+                int child = children[block][next++];
+                dominatorEnter[child] = number++;
+                stack.push_back({child, 0});
+                continue;
+            }
+            dominatorExit[block] = number - 1;
+            stack.pop_back();
+        }
+    }
+
+    // Whether every path from the entry to `block` goes through `dominator`
+    bool dominates(int dominator, int block) const
+    {
+        if (block == dominator)
+            return true;
+        return dominatorEnter[block] != -1 && dominatorEnter[dominator] != -1 && dominatorEnter[dominator] <= dominatorEnter[block] &&
+               dominatorEnter[block] <= dominatorExit[dominator];
+    }
+
+    vector<vector<int>> dominatorTree() const
+    {
+        vector<vector<int>> children(blocks.size());
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            if (immediateDominators[i] != -1)
+                children[immediateDominators[i]].push_back(i);
+        }
+        return children;
+    }
+
+    /*
+    Flattens the graph back into TAC in layout order.
+    Jumps to the block that follows anyway are dropped, and only labels that
+    are still the target of a jump are emitted.
+    */
+    vector<TacInstruction> linearize() const
+    {
+        vector<vector<TacInstruction>::const_iterator> ends; // End of the emitted part of every block
+        unordered_map<int64_t, bool> referencedLabels;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            const vector<TacInstruction> &code = blocks[i].instructions;
+            auto end = code.end();
+            if (!code.empty() && code.back().op == TAC_GOTO && i + 1 < blocks.size() &&
+                blocks[i + 1].label == code.back().dest.value)
+                end--;
+            ends.push_back(end);
+            for (auto it = code.begin(); it != end; it++)
+            {
+                if (isJumpOpcode(it->op))
+                    referencedLabels[it->dest.value] = true;
+            }
+        }
+
+        vector<TacInstruction> code;
+        for (size_t i = 0; i < blocks.size(); i++)
+        {
+            if (blocks[i].label != -1 && referencedLabels.count(blocks[i].label))
+                code.push_back(TacInstruction{TAC_LABEL, TacOperand{OPERAND_LABEL, blocks[i].label}});
+            code.insert(code.end(), blocks[i].instructions.cbegin(), ends[i]);
+        }
+        return code;
+    }
+
+private:
+    unordered_map<int64_t, int> labelBlocks; // Label -> block starting with it
+    int64_t nextLabel = 1;
+    int nextBlockId = 0;
+
+    void addEdge(int from, int to)
+    {
+        if (find(blocks[from].successors.begin(), blocks[from].successors.end(), to) != blocks[from].successors.end())
+            return;
+        blocks[from].successors.push_back(to);
+        blocks[to].predecessors.push_back(from);
+    }
+
+    void computeReversePostorder()
+    {
+        reversePostorder.clear();
+        vector<bool> visited(blocks.size(), false);
+        vector<pair<int, size_t>> stack = {{0, 0}}; // Block and index of its next successor to visit
+        visited[0] = true;
+        while (!stack.empty())
+        {
+            auto &[block, next] = stack.back();
+            if (next < blocks[block].successors.size())
+            {
+                int successor = blocks[block].successors[next++];
+                if (!visited[successor])
+                {
+                    visited[successor] = true;
+                    stack.push_back({successor, 0});
+                }
+                continue;
+            }
+            reversePostorder.push_back(block);
+            stack.pop_back();
+        }
+        reverse(reversePostorder.begin(), reversePostorder.end());
+    }
+
+    int intersect(int first, int second, const vector<int> &order) const
+    {
+        while (first != second)
+        {
+            while (order[first] > order[second])
+                first = immediateDominators[first];
+            while (order[second] > order[first])
+                second = immediateDominators[second];
+        }
+        return first;
+    }
+};
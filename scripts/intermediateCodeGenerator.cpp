@@ -1,31 +1,249 @@
 #include <iostream>
 #include <vector>
+#include <string>
 
 using namespace std;
 
+/*
+Lowers the AST to TAC one unit at a time: the top-level statements are one
+unit and every function is another, with temps, labels, variables and string
+constants of its own. Units only refer to each other through the functions
+they call, so each can be optimized and translated on its own. With a
+vectorWidth, the counted loops LoopVectorizer accepts run vectorWidth
+iterations at a time in vector registers, and the iterations left over run
+in the ordinary loop.
+*/
 class IntermediateCodeGenerator
 {
 public:
-    vector<string> instructions;
+    vector<TacInstruction> instructions;
+    vector<string> variableNames; // Variable id -> name in the generated code
+    StringPool strings;           // String constants referenced by OPERAND_STR, each stored once
     int tempCount = 0;
     int labelCount = 1;
+    string name;                  // Function the code belongs to, empty for the top-level statements
+    vector<TacOperand> parameters; // Variables the arguments arrive in, in order
+    vector<string> arrayNames;     // Array id -> name in the generated code
+    vector<int64_t> arrayLengths;  // Array id -> number of elements
+    int vectorWidth = 0;           // Elements per vector register, 0 to leave every loop scalar
 
-    string newTemp()
+    // The top-level statements as unit 0 and function i as unit i + 1
+    static vector<IntermediateCodeGenerator> generateProgram(const Stmt *program, const vector<Function> &functions, const SymbolTable &symbols,
+                                                             int vectorWidth = 0)
     {
-        return "temp_" + to_string(tempCount++);
+        vector<IntermediateCodeGenerator> units(functions.size() + 1);
+        for (IntermediateCodeGenerator &unit : units)
+            unit.vectorWidth = vectorWidth;
+        units[0].generate(program, symbols, functions);
+        for (size_t i = 0; i < functions.size(); i++)
+            units[i + 1].generate(functions[i], symbols, functions);
+        return units;
     }
 
-    string newLabel()
+    // Lowers top-level statements to TAC, statements are emitted in source order
+    void generate(const Stmt *program, const SymbolTable &symbols, const vector<Function> &functionList)
     {
-        return "L" + to_string(labelCount++);
+        symbolTable = &symbols;
+        functions = &functionList;
+        symbolOperands.assign(symbols.size(), TacOperand{});
+        lowerStatements(program);
     }
 
-    void addInstruction(const string &instr)
+    // Lowers the body of a function
+    void generate(const Function &function, const SymbolTable &symbols, const vector<Function> &functionList)
     {
-        if (instr[0] == 'L')
-            instructions.push_back(instr);
-        else 
-            instructions.push_back("    " + instr);
+        name = function.name;
+        symbolTable = &symbols;
+        functions = &functionList;
+        symbolOperands.assign(symbols.size(), TacOperand{});
+        for (uint32_t parameter : function.parameters)
+            parameters.push_back(symbolOperand(parameter));
+        lowerStatements(function.body);
+    }
+
+    bool isFunction() const
+    {
+        return !name.empty();
+    }
+
+    string_view functionName(int64_t index) const
+    {
+        return (*functions)[index].name;
+    }
+
+    // A temp no other instruction uses, as the optimizer needs for new SSA values
+    TacOperand newTemp()
+    {
+        return TacOperand{OPERAND_TEMP, tempCount++};
+    }
+
+    TacOperand newLabel()
+    {
+        return TacOperand{OPERAND_LABEL, labelCount++};
+    }
+
+    // Operand for a named variable, registering the name on first use
+    TacOperand variable(const string &name)
+    {
+        uint32_t id = variableIds.intern(name);
+        if (id == variableNames.size())
+            variableNames.push_back(name);
+        return TacOperand{OPERAND_VAR, id};
+    }
+
+    // Operand for a string constant, equal texts share one pool entry
+    TacOperand stringConstant(string_view value)
+    {
+        return TacOperand{OPERAND_STR, strings.intern(value)};
+    }
+
+    void addInstruction(const TacInstruction &instr)
+    {
+        instructions.push_back(instr);
+    }
+
+    void addInstruction(TacOpcode op, TacOperand dest, TacOperand left = {}, TacOperand right = {})
+    {
+        instructions.push_back(TacInstruction{op, dest, left, right});
+    }
+
+    string operandToString(const TacOperand &operand) const
+    {
+        switch (operand.kind)
+        {
+        case OPERAND_TEMP:
+            return "temp_" + to_string(operand.value);
+        case OPERAND_VAR:
+            return variableNames[operand.value];
+        case OPERAND_IMM:
+            return to_string(operand.value);
+        case OPERAND_STR:
+            return "\"" + strings[operand.value] + "\"";
+        case OPERAND_LABEL:
+            return "L" + to_string(operand.value);
+        case OPERAND_FUNCTION:
+            return string(functionName(operand.value));
+        case OPERAND_ARRAY:
+            return arrayNames[operand.value];
+        case OPERAND_VECTOR:
+            return "v" + to_string(operand.value);
+        default:
+            return "";
+        }
+    }
+
+    // Textual form of an instruction, labels are flush left and everything else is indented
+    string instructionToString(const TacInstruction &instr) const
+    {
+        string dest = operandToString(instr.dest);
+        string left = operandToString(instr.left);
+        string right = operandToString(instr.right);
+        switch (instr.op)
+        {
+        case TAC_COPY:
+            return "    " + dest + " = " + left;
+        case TAC_LABEL:
+            return dest + ":";
+        case TAC_IF_LT:
+        case TAC_IF_GT:
+        case TAC_IF_EQ:
+        case TAC_IF_NEQ:
+        case TAC_IF_LE:
+        case TAC_IF_GE:
+            return "    if " + left + " " + opcodeSymbol(comparisonOfBranch(instr.op)) + " " + right + " goto " + dest;
+        case TAC_GOTO:
+            return "    goto " + dest;
+        case TAC_RETURN:
+            return "    return " + left;
+        case TAC_ARG:
+            return "    arg " + left;
+        case TAC_CALL:
+            return "    " + dest + " = call " + left + ", " + right;
+        case TAC_LOAD_ELEMENT:
+            return "    " + dest + " = " + left + "[" + right + "]";
+        case TAC_STORE_ELEMENT:
+            return "    " + dest + "[" + left + "] = " + right;
+        case TAC_CLEAR:
+            return "    clear " + dest;
+        case TAC_VECTOR_LOAD:
+            return "    " + dest + " = " + left + "[" + right + ":" + to_string(vectorWidth) + "]";
+        case TAC_VECTOR_STORE:
+            return "    " + dest + "[" + left + ":" + to_string(vectorWidth) + "] = " + right;
+        case TAC_VECTOR_SPLAT:
+            return "    " + dest + " = splat " + left;
+        default:
+            return "    " + dest + " = " + left + " " + opcodeSymbol(instr.op) + " " + right;
+        }
+    }
+
+    static string opcodeSymbol(TacOpcode op)
+    {
+        switch (op)
+        {
+        case TAC_ADD:
+        case TAC_CONCAT:
+        case TAC_VECTOR_ADD:
+            return "+";
+        case TAC_SUB:
+        case TAC_VECTOR_SUB:
+            return "-";
+        case TAC_MUL:
+            return "*";
+        case TAC_DIV:
+            return "/";
+        case TAC_LT:
+            return "<";
+        case TAC_GT:
+            return ">";
+        case TAC_EQ:
+            return "==";
+        case TAC_NEQ:
+            return "!=";
+        case TAC_LE:
+            return "<=";
+        case TAC_GE:
+            return ">=";
+        default:
+            return "";
+        }
+    }
+
+    // Opcode for a binary operator applied to values of `dataType`
+    static TacOpcode binaryOpcode(TokenType op, TokenType dataType)
+    {
+        switch (op)
+        {
+        case T_PLUS:
+            return dataType == T_STRING ? TAC_CONCAT : TAC_ADD;
+        case T_MINUS:
+            return TAC_SUB;
+        case T_MUL:
+            return TAC_MUL;
+        case T_DIV:
+            return TAC_DIV;
+        default:
+            return comparisonOpcode(op);
+        }
+    }
+
+    // Opcode for a comparison token
+    static TacOpcode comparisonOpcode(TokenType type)
+    {
+        switch (type)
+        {
+        case T_LT:
+            return TAC_LT;
+        case T_GT:
+            return TAC_GT;
+        case T_EQ:
+            return TAC_EQ;
+        case T_NEQ:
+            return TAC_NEQ;
+        case T_LE:
+            return TAC_LE;
+        default:
+            return TAC_GE;
+        }
     }
 
     void writeToOutputFile(string fileName)
@@ -33,37 +251,397 @@ public:
         ofstream outputFile(fileName);
         if (!outputFile.is_open())
         {
-            cerr << "Error: Could not write to file " << fileName << endl;
-            exit(1);
+            throw runtime_error("Error: Could not write to file " + fileName);
+        }
+        printInstructions(outputFile);
+        outputFile.close();
+    }
+
+    // A function's code comes under a header naming it and its parameters
+    void printInstructions(ostream &out = cout) const
+    {
+        if (isFunction())
+        {
+            out << "function " << name << "(";
+            for (size_t i = 0; i < parameters.size(); i++)
+                out << (i == 0 ? "" : ", ") << operandToString(parameters[i]);
+            out << "):\n";
         }
         for (const auto &instr : instructions)
         {
-            outputFile << instr << endl;
+            out << instructionToString(instr) << "\n";
         }
-        outputFile.close();
-        cout << "Intermediate code written to " << "output/TAC-Output.txt" << endl;
     }
 
-    void printInstructions()
+private:
+    StringInterner variableIds; // Name -> variable id, ids match variableNames
+    const SymbolTable *symbolTable = nullptr;
+    const vector<Function> *functions = nullptr; // Every function of the program, for the names of callees
+    vector<TacOperand> symbolOperands; // Symbol index -> variable operand, filled on first use
+    vector<TacOperand> freeIntTemps;    // Temps whose value has been consumed, by type
+    vector<TacOperand> freeStringTemps;
+    vector<bool> vectorInUse;           // Vector register -> holding a value of the loop being lowered
+
+    /*
+    Every temp the lowering creates holds one subexpression and is read by
+    exactly one instruction, after which it is released for reuse. The number
+    of temps is then bounded by the deepest expression instead of growing with
+    the program, and so are the registers and stack slots they need.
+    */
+    TacOperand acquireTemp(TokenType dataType)
     {
-        bool isBlockStarted = false;
-        for (const auto &instr : instructions)
+        vector<TacOperand> &freeTemps = freeTempsOf(dataType);
+        if (freeTemps.empty())
+            return newTemp();
+        TacOperand temp = freeTemps.back();
+        freeTemps.pop_back();
+        return temp;
+    }
+
+    void releaseTemp(const TacOperand &operand, TokenType dataType)
+    {
+        if (operand.kind == OPERAND_TEMP)
+            freeTempsOf(dataType).push_back(operand);
+    }
+
+    vector<TacOperand> &freeTempsOf(TokenType dataType)
+    {
+        return dataType == T_STRING ? freeStringTemps : freeIntTemps;
+    }
+
+    /*
+    Vector registers are handed out lowest first, the same way. The last one
+    is left to the assembly generator as scratch, and the splat registers a
+    loop holds are only released once the whole loop has been lowered.
+    */
+    TacOperand acquireVector()
+    {
+        if (vectorInUse.empty())
+            vectorInUse.assign(LoopVectorizer::vectorRegisters - 1, false);
+        size_t number = 0;
+        while (vectorInUse[number])
+            number++;
+        vectorInUse[number] = true;
+        return TacOperand{OPERAND_VECTOR, (int64_t)number};
+    }
+
+    void releaseVector(const TacOperand &operand)
+    {
+        vectorInUse[operand.value] = false;
+    }
+
+    // Operand for a variable, or for an array, registering it on first use
+    TacOperand symbolOperand(uint32_t symbol)
+    {
+        if (symbolOperands[symbol].kind == OPERAND_NONE)
         {
-            if (instr.find("L") != std::string::npos)
+            const Symbol &declared = symbolTable->symbolAt(symbol);
+            if (declared.isArray())
             {
-                cout << instr << endl;
-                isBlockStarted = true;
+                symbolOperands[symbol] = TacOperand{OPERAND_ARRAY, (int64_t)arrayNames.size()};
+                arrayNames.push_back(declared.icgName);
+                arrayLengths.push_back(declared.arrayLength);
             }
-            else if (instr.find("goto") != std::string::npos)
+            else
+                symbolOperands[symbol] = variable(declared.icgName);
+        }
+        return symbolOperands[symbol];
+    }
+
+    void lowerStatements(const Stmt *statement)
+    {
+        for (; statement != nullptr; statement = statement->next)
+        {
+            lowerStatement(statement);
+        }
+    }
+
+    void lowerStatement(const Stmt *statement)
+    {
+        switch (statement->kind)
+        {
+        case STMT_DECLARATION:
+            if (symbolTable->symbolAt(statement->symbol).isArray())
+                addInstruction(TAC_CLEAR, symbolOperand(statement->symbol));
+            else if (statement->value != nullptr)
+                lowerCopy(symbolOperand(statement->symbol), statement->value);
+            break;
+        case STMT_ASSIGNMENT:
+            lowerCopy(symbolOperand(statement->symbol), statement->value);
+            break;
+        case STMT_INCREMENT:
+        {
+            TacOperand variable = symbolOperand(statement->symbol);
+            addInstruction(statement->op == T_PLUS ? TAC_ADD : TAC_SUB, variable, variable, immediateOperand(1));
+            break;
+        }
+        case STMT_RETURN:
+        {
+            TacOperand value = lowerExpression(statement->value);
+            addInstruction(TAC_RETURN, TacOperand{}, value);
+            releaseTemp(value, statement->value->dataType);
+            break;
+        }
+        case STMT_BLOCK:
+            lowerStatements(statement->body);
+            break;
+        case STMT_CALL:
+            releaseTemp(lowerExpression(statement->value), statement->value->dataType);
+            break;
+        case STMT_ELEMENT:
+        {
+            TacOperand index = lowerExpression(statement->index);
+            TacOperand value = lowerExpression(statement->value);
+            addInstruction(TAC_STORE_ELEMENT, symbolOperand(statement->symbol), index, value);
+            releaseTemp(index, T_INT);
+            releaseTemp(value, T_INT);
+            break;
+        }
+        default:
+            lowerBlockStatement(statement);
+        }
+    }
+
+    /*
+    Bodies are laid out so that the common path falls through:
+      if:    if !cond goto Lfalse; body; [goto Lend; Lfalse: else;] Lend:
+      loops: init; goto Lcond; Lbody: body; step; Lcond: if cond goto Lbody
+    so a loop runs a single compare-and-branch per iteration.
+    */
+    void lowerBlockStatement(const Stmt *statement)
+    {
+        if (statement->kind == STMT_IF)
+        {
+            TacOperand falseConditionLabel = newLabel();
+            lowerBranch(statement->value, falseConditionLabel, false);
+            lowerStatement(statement->body);
+            if (statement->elseBody != nullptr)
             {
-                cout << instr << endl;
-                isBlockStarted = false;
+                TacOperand endLabel = newLabel();
+                addInstruction(TAC_GOTO, endLabel);
+                addInstruction(TAC_LABEL, falseConditionLabel);
+                lowerStatement(statement->elseBody);
+                addInstruction(TAC_LABEL, endLabel);
             }
             else
             {
-                string output = isBlockStarted ? "    " + instr : instr;
-                cout << output << endl;
+                // IF without ELSE continues after the body
+                addInstruction(TAC_LABEL, falseConditionLabel);
             }
+            return;
+        }
+
+        VectorLoop plan;
+        if (vectorWidth > 0 && LoopVectorizer::analyze(statement, vectorWidth, *symbolTable, plan))
+        {
+            lowerVectorLoop(statement, plan);
+        }
+        else if (statement->kind == STMT_FOR && statement->init != nullptr)
+        {
+            lowerStatement(statement->init);
+        }
+        TacOperand bodyLabel = newLabel();
+        TacOperand conditionLabel = newLabel();
+        addInstruction(TAC_GOTO, conditionLabel);
+        addInstruction(TAC_LABEL, bodyLabel);
+        lowerStatement(statement->body); // Body of FOR/WHILE
+        if (statement->kind == STMT_FOR)
+        {
+            lowerStatement(statement->step); // Iterator before testing the condition again
+        }
+        addInstruction(TAC_LABEL, conditionLabel);
+        lowerBranch(statement->value, bodyLabel, true);
+    }
+
+    /*
+    Runs the iterations of a loop LoopVectorizer accepted a vector at a time,
+    leaving the counter at the first iteration still to run:
+      init; [if N > shortest goto Lscalar;] splat the invariants; goto Lcond
+      Lbody: the stores, vectorWidth elements each; i = i + vectorWidth
+      Lcond: if i + vectorWidth - 1 < N goto Lbody
+      Lscalar:
+    The ordinary loop lowered after it runs the rest. A bound the parser could
+    not compute is checked against the shortest array first, so that a loop
+    leaving its arrays runs in the ordinary loop and traps at the first bad
+    element, as it would without vectors.
+    */
+    void lowerVectorLoop(const Stmt *loop, const VectorLoop &plan)
+    {
+        lowerStatement(loop->init);
+        TacOperand counter = symbolOperand(plan.counter);
+        TacOperand scalarLabel = newLabel();
+        if (plan.bound->kind != EXPR_NUMBER)
+        {
+            TacOperand bound = lowerExpression(plan.bound);
+            addInstruction(TAC_IF_GT, scalarLabel, bound, immediateOperand(plan.shortestArray));
+            releaseTemp(bound, T_INT);
+        }
+
+        vector<TacOperand> splats;
+        for (const Expr *invariant : plan.invariants)
+        {
+            splats.push_back(acquireVector());
+            TacOperand value = lowerExpression(invariant);
+            addInstruction(TAC_VECTOR_SPLAT, splats.back(), value);
+            releaseTemp(value, T_INT);
+        }
+
+        TacOperand bodyLabel = newLabel();
+        TacOperand conditionLabel = newLabel();
+        addInstruction(TAC_GOTO, conditionLabel);
+        addInstruction(TAC_LABEL, bodyLabel);
+        for (const Stmt *store : plan.stores)
+        {
+            TacOperand value = lowerVectorExpression(store->value, plan, splats, counter);
+            addInstruction(TAC_VECTOR_STORE, symbolOperand(store->symbol), counter, value);
+            releaseVectorTemp(value, splats);
+        }
+        addInstruction(TAC_ADD, counter, counter, immediateOperand(vectorWidth));
+
+        addInstruction(TAC_LABEL, conditionLabel);
+        if (plan.bound->kind == EXPR_NUMBER)
+        {
+            addInstruction(TAC_IF_LT, bodyLabel, counter, immediateOperand(plan.bound->number - (vectorWidth - 1)));
+        }
+        else
+        {
+            TacOperand last = acquireTemp(T_INT);
+            addInstruction(TAC_ADD, last, counter, immediateOperand(vectorWidth - 1));
+            TacOperand bound = lowerExpression(plan.bound);
+            addInstruction(TAC_IF_LT, bodyLabel, last, bound);
+            releaseTemp(last, T_INT);
+            releaseTemp(bound, T_INT);
+        }
+        for (const TacOperand &splat : splats)
+            releaseVector(splat);
+        addInstruction(TAC_LABEL, scalarLabel);
+    }
+
+    // Emits the vector code computing `expression` for vectorWidth iterations, returns the register holding it
+    TacOperand lowerVectorExpression(const Expr *expression, const VectorLoop &plan, const vector<TacOperand> &splats, TacOperand counter)
+    {
+        switch (expression->kind)
+        {
+        case EXPR_ELEMENT:
+        {
+            TacOperand lanes = acquireVector();
+            addInstruction(TAC_VECTOR_LOAD, lanes, symbolOperand(expression->symbol), counter);
+            return lanes;
+        }
+        case EXPR_BINARY:
+        {
+            TacOperand left = lowerVectorExpression(expression->left, plan, splats, counter);
+            TacOperand right = lowerVectorExpression(expression->right, plan, splats, counter);
+            // Unlike with temps, the result may reuse an operand's register, as the destructive SSE forms want
+            releaseVectorTemp(right, splats);
+            releaseVectorTemp(left, splats);
+            TacOperand result = acquireVector();
+            addInstruction(expression->op == T_PLUS ? TAC_VECTOR_ADD : TAC_VECTOR_SUB, result, left, right);
+            return result;
+        }
+        default:
+            for (size_t i = 0; i < plan.invariants.size(); i++)
+            {
+                if (LoopVectorizer::sameInvariant(plan.invariants[i], expression))
+                    return splats[i];
+            }
+            throw logic_error("Vector loop reads a value that was not splat");
+        }
+    }
+
+    // Releases a vector register unless it holds one of the loop's splats
+    void releaseVectorTemp(const TacOperand &operand, const vector<TacOperand> &splats)
+    {
+        for (const TacOperand &splat : splats)
+        {
+            if (splat == operand)
+                return;
+        }
+        releaseVector(operand);
+    }
+
+    // Emits a jump to `target` taken when `condition` evaluates to `whenTrue`
+    void lowerBranch(const Expr *condition, TacOperand target, bool whenTrue)
+    {
+        // A condition the parser folded to a number either always jumps or never does
+        if (condition->kind == EXPR_NUMBER)
+        {
+            if ((condition->number != 0) == whenTrue)
+                addInstruction(TAC_GOTO, target);
+            return;
+        }
+        if (condition->kind == EXPR_BINARY && isComparisonOperator(condition->op))
+        {
+            TacOperand left = lowerExpression(condition->left);
+            TacOperand right = lowerExpression(condition->right);
+            TacOpcode comparison = comparisonOpcode(condition->op);
+            addInstruction(branchOpcode(whenTrue ? comparison : negateComparison(comparison)), target, left, right);
+            releaseTemp(left, condition->left->dataType);
+            releaseTemp(right, condition->right->dataType);
+            return;
+        }
+        TacOperand value = lowerExpression(condition);
+        addInstruction(whenTrue ? TAC_IF_NEQ : TAC_IF_EQ, target, value, immediateOperand(0));
+        releaseTemp(value, condition->dataType);
+    }
+
+    // dest = value
+    void lowerCopy(TacOperand dest, const Expr *value)
+    {
+        TacOperand source = lowerExpression(value);
+        addInstruction(TAC_COPY, dest, source);
+        releaseTemp(source, value->dataType);
+    }
+
+    // Emits the code computing `expression` and returns the operand holding its value
+    TacOperand lowerExpression(const Expr *expression)
+    {
+        switch (expression->kind)
+        {
+        case EXPR_NUMBER:
+            return immediateOperand(expression->number);
+        case EXPR_STRING:
+            return stringConstant(expression->text);
+        case EXPR_VARIABLE:
+            return symbolOperand(expression->symbol);
+        case EXPR_CALL:
+            return lowerCall(expression);
+        case EXPR_ELEMENT:
+        {
+            TacOperand index = lowerExpression(expression->left);
+            TacOperand result = acquireTemp(T_INT);
+            addInstruction(TAC_LOAD_ELEMENT, result, symbolOperand(expression->symbol), index);
+            releaseTemp(index, T_INT);
+            return result;
+        }
+        default:
+        {
+            TacOperand left = lowerExpression(expression->left);
+            TacOperand right = lowerExpression(expression->right);
+            // The result is taken before the operands are released, so it never overwrites one of them
+            TacOperand result = acquireTemp(expression->dataType);
+            addInstruction(binaryOpcode(expression->op, expression->dataType), result, left, right);
+            releaseTemp(left, expression->left->dataType);
+            releaseTemp(right, expression->right->dataType);
+            return result;
+        }
+        }
+    }
+
+    // Every argument is computed before the first one is passed, so the ARGs of a call are never split by another call
+    TacOperand lowerCall(const Expr *call)
+    {
+        vector<TacOperand> arguments;
+        for (const Expr *argument = call->left; argument != nullptr; argument = argument->next)
+            arguments.push_back(lowerExpression(argument));
+        size_t index = 0;
+        for (const Expr *argument = call->left; argument != nullptr; argument = argument->next, index++)
+        {
+            addInstruction(TAC_ARG, TacOperand{}, arguments[index]);
+            releaseTemp(arguments[index], argument->dataType);
         }
+        TacOperand result = acquireTemp(call->dataType);
+        addInstruction(TAC_CALL, result, TacOperand{OPERAND_FUNCTION, call->symbol}, immediateOperand(arguments.size()));
+        return result;
     }
 };
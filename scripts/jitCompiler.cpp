@@ -0,0 +1,516 @@
+#include <vector>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include <stdexcept>
+#include <cstring>
+#include <cstdint>
+#include <sys/mman.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+Runs the program behind --jit.
+The instructions selected by the AssemblyGenerator (in callable mode) are
+encoded straight into x86-64 machine code, the top-level code first and every
+function after it, with the string constant blob placed after the code and
+addressed RIP-relative. The buffer is mapped writable
+while it is filled and then switched to read+execute before it is called, so
+it is never writable and executable at once. Jumps always use 32-bit
+displacements, which keeps encoding to a single pass plus a patch-up of the
+displacements once every label, and every function, is placed. Vector
+instructions get their legacy SSE2 encoding, or the VEX one in units with
+AVX2 code, which the compiler only produces when the CPU has AVX2.
+*/
+class JitCompiler
+{
+public:
+    // Encodes the units (the top-level code, then function i as unit i + 1), runs them and returns the program's exit status
+    int run(const vector<AssemblyGenerator> &units, const string &strings)
+    {
+        encode(units, strings);
+
+        size_t pageSize = sysconf(_SC_PAGESIZE);
+        size_t length = (bytes.size() + pageSize - 1) / pageSize * pageSize;
+        void *memory = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED)
+            throw runtime_error("JIT: could not map memory for the generated code");
+        memcpy(memory, bytes.data(), bytes.size());
+        if (mprotect(memory, length, PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(memory, length);
+            throw runtime_error("JIT: could not make the generated code executable");
+        }
+
+        int64_t (*program)() = reinterpret_cast<int64_t (*)()>(memory);
+        int64_t value = program();
+        munmap(memory, length);
+        // Only the low byte reaches the parent, as with the exit syscall
+        return (int)(value & 0xFF);
+    }
+
+private:
+    enum FixupKind : uint8_t
+    {
+        FIXUP_LABEL,
+        FIXUP_STRING,
+        FIXUP_RUNTIME,
+        FIXUP_FUNCTION,
+    };
+
+    // A rel32 field to fill in once its target's offset is known
+    struct Fixup
+    {
+        size_t at;  // Offset of the 32-bit field
+        size_t end; // Offset the displacement is relative to, the end of the instruction
+        FixupKind kind;
+        int64_t target;
+    };
+
+    vector<uint8_t> bytes;
+    vector<Fixup> fixups;
+    unordered_map<int64_t, size_t> labelOffsets; // Labels of the unit being encoded, each unit numbers its own
+    bool avx2 = false;                           // Whether the unit being encoded uses YMM registers
+
+    void encode(const vector<AssemblyGenerator> &units, const string &strings)
+    {
+        bytes.clear();
+        fixups.clear();
+        bool usesConcat = false;
+        vector<size_t> unitOffsets;
+        vector<Fixup> pending; // Fixups to other units, the runtime and the strings, resolved at the end
+        for (const AssemblyGenerator &unit : units)
+        {
+            unitOffsets.push_back(bytes.size());
+            labelOffsets.clear();
+            avx2 = unit.usesAvx2();
+            for (const AsmInstruction &instr : unit.instructions())
+            {
+                encodeInstruction(instr);
+                usesConcat = usesConcat || (instr.op == ASM_CALL && instr.dest.kind == ASM_RUNTIME);
+            }
+            for (const Fixup &fixup : fixups)
+            {
+                if (fixup.kind == FIXUP_LABEL)
+                    patch(fixup, labelOffsets.at(fixup.target));
+                else
+                    pending.push_back(fixup);
+            }
+            fixups.clear();
+        }
+
+        size_t concatOffset = bytes.size();
+        if (usesConcat)
+            encodeConcatTrampoline();
+        size_t stringsOffset = bytes.size();
+        bytes.insert(bytes.end(), strings.begin(), strings.end());
+
+        for (const Fixup &fixup : pending)
+        {
+            size_t target = fixup.kind == FIXUP_STRING     ? stringsOffset + fixup.target
+                            : fixup.kind == FIXUP_FUNCTION ? unitOffsets[fixup.target + 1]
+                                                           : concatOffset;
+            patch(fixup, target);
+        }
+    }
+
+    void patch(const Fixup &fixup, size_t target)
+    {
+        int32_t displacement = (int32_t)((int64_t)target - (int64_t)fixup.end);
+        memcpy(&bytes[fixup.at], &displacement, 4);
+    }
+
+    void put(uint8_t byte)
+    {
+        bytes.push_back(byte);
+    }
+
+    void put32(int32_t value)
+    {
+        for (int i = 0; i < 4; i++)
+            put((uint8_t)(value >> (8 * i)));
+    }
+
+    void put64(int64_t value)
+    {
+        for (int i = 0; i < 8; i++)
+            put((uint8_t)(value >> (8 * i)));
+    }
+
+    void putRel32(FixupKind kind, int64_t target)
+    {
+        fixups.push_back(Fixup{bytes.size(), bytes.size() + 4, kind, target});
+        put32(0);
+    }
+
+    /*
+    REX prefix, opcode and ModRM (plus displacement) for an instruction whose
+    ModRM reg field is `reg` and whose r/m operand is `rm`. A register, a stack
+    slot, an array element and a string constant can be r/m; `immediateBytes`
+    follow the instruction and count towards where a RIP-relative displacement
+    is taken from.
+    */
+    void encodeModRm(initializer_list<uint8_t> opcode, int reg, const AsmOperand &rm, bool wide, int immediateBytes = 0)
+    {
+        uint8_t rex = 0x40 | (wide ? 8 : 0) | ((reg & 8) ? 4 : 0) | ((indexOf(rm) & 8) ? 2 : 0) | ((baseOf(rm) & 8) ? 1 : 0);
+        // SPL, BPL, SIL and DIL only exist with a REX prefix
+        bool byteNeedsRex = rm.kind == ASM_BYTE_REGISTER && rm.value >= 4 && rm.value < 8;
+        if (rex != 0x40 || byteNeedsRex)
+            put(rex);
+        for (uint8_t byte : opcode)
+            put(byte);
+        putModRm(reg, rm, immediateBytes);
+    }
+
+    /*
+    Three-byte VEX prefix, opcode and ModRM. `map` selects the 0F (1) or 0F38
+    (2) opcode map, `prefix` the implied 66 (1) or F3 (2), and `source` is the
+    extra register operand, 0 when the instruction has none.
+    */
+    void encodeVex(int map, int prefix, bool wide, bool ymm, int source, uint8_t opcode, int reg, const AsmOperand &rm)
+    {
+        put(0xC4);
+        put((uint8_t)(((reg & 8) ? 0 : 0x80) | ((indexOf(rm) & 8) ? 0 : 0x40) | ((baseOf(rm) & 8) ? 0 : 0x20) | map));
+        put((uint8_t)((wide ? 0x80 : 0) | ((~source & 15) << 3) | (ymm ? 4 : 0) | prefix));
+        put(opcode);
+        putModRm(reg, rm, 0);
+    }
+
+    // Register of the r/m operand, or the base register of a memory operand
+    static int baseOf(const AsmOperand &rm)
+    {
+        if (rm.kind == ASM_STACK || rm.kind == ASM_ELEMENT)
+            return RBP;
+        return rm.kind == ASM_STRING ? 0 : (int)rm.value;
+    }
+
+    static int indexOf(const AsmOperand &rm)
+    {
+        return rm.kind == ASM_ELEMENT ? rm.index : 0;
+    }
+
+    // ModRM, SIB and displacement addressing `rm`
+    void putModRm(int reg, const AsmOperand &rm, int immediateBytes)
+    {
+        uint8_t regBits = (reg & 7) << 3;
+        switch (rm.kind)
+        {
+        case ASM_STACK:
+        case ASM_ELEMENT:
+        {
+            // [RBP + disp] or, through a SIB byte, [RBP + index * 8 + disp]
+            int32_t displacement = -8 * (int32_t)(rm.value + 1);
+            uint8_t rmBits = rm.kind == ASM_ELEMENT ? 4 : (RBP & 7);
+            bool shortForm = displacement >= INT8_MIN;
+            put((shortForm ? 0x40 : 0x80) | regBits | rmBits);
+            if (rm.kind == ASM_ELEMENT)
+                put(0xC0 | ((rm.index & 7) << 3) | (RBP & 7));
+            if (shortForm)
+                put((uint8_t)displacement);
+            else
+                put32(displacement);
+            break;
+        }
+        case ASM_STRING:
+            put(0x00 | regBits | 5); // [RIP + disp32]
+            fixups.push_back(Fixup{bytes.size(), bytes.size() + 4 + immediateBytes, FIXUP_STRING, rm.value});
+            put32(0);
+            break;
+        default:
+            put(0xC0 | regBits | (rm.value & 7));
+        }
+    }
+
+    static uint8_t conditionCode(Condition condition)
+    {
+        switch (condition)
+        {
+        case COND_L:
+            return 0xC;
+        case COND_G:
+            return 0xF;
+        case COND_E:
+            return 0x4;
+        case COND_NE:
+            return 0x5;
+        case COND_LE:
+            return 0xE;
+        case COND_B:
+            return 0x2;
+        case COND_AE:
+            return 0x3;
+        default:
+            return 0xD;
+        }
+    }
+
+    // ADD, SUB, XOR and CMP share their encodings apart from an opcode extension
+    void encodeAlu(int extension, const AsmInstruction &instr)
+    {
+        if (instr.src.kind == ASM_IMMEDIATE)
+        {
+            bool shortForm = instr.src.value >= INT8_MIN && instr.src.value <= INT8_MAX;
+            encodeModRm({(uint8_t)(shortForm ? 0x83 : 0x81)}, extension, instr.dest, true, shortForm ? 1 : 4);
+            if (shortForm)
+                put((uint8_t)instr.src.value);
+            else
+                put32((int32_t)instr.src.value);
+        }
+        else if (instr.src.kind == ASM_REGISTER)
+            encodeModRm({(uint8_t)(extension * 8 + 0x01)}, instr.src.value, instr.dest, true);
+        else
+            encodeModRm({(uint8_t)(extension * 8 + 0x03)}, instr.dest.value, instr.src, true);
+    }
+
+    void encodeInstruction(const AsmInstruction &instr)
+    {
+        switch (instr.op)
+        {
+        case ASM_MOV:
+            if (instr.src.kind == ASM_IMMEDIATE && !fitsInt32(instr.src.value))
+            {
+                // MOV r64, imm64
+                put(0x48 | ((instr.dest.value & 8) ? 1 : 0));
+                put(0xB8 + (instr.dest.value & 7));
+                put64(instr.src.value);
+            }
+            else if (instr.src.kind == ASM_IMMEDIATE)
+            {
+                encodeModRm({0xC7}, 0, instr.dest, true, 4);
+                put32((int32_t)instr.src.value);
+            }
+            else if (instr.src.kind == ASM_REGISTER)
+                encodeModRm({0x89}, instr.src.value, instr.dest, true);
+            else
+                encodeModRm({0x8B}, instr.dest.value, instr.src, true);
+            break;
+        case ASM_MOVZX:
+            encodeModRm({0x0F, 0xB6}, instr.dest.value, instr.src, true);
+            break;
+        case ASM_LEA:
+            encodeModRm({0x8D}, instr.dest.value, instr.src, true);
+            break;
+        case ASM_ADD:
+            encodeAlu(0, instr);
+            break;
+        case ASM_SUB:
+            encodeAlu(5, instr);
+            break;
+        case ASM_XOR:
+            encodeAlu(6, instr);
+            break;
+        case ASM_CMP:
+            encodeAlu(7, instr);
+            break;
+        case ASM_IMUL:
+            if (instr.src.kind == ASM_IMMEDIATE)
+            {
+                bool shortForm = instr.src.value >= INT8_MIN && instr.src.value <= INT8_MAX;
+                encodeModRm({(uint8_t)(shortForm ? 0x6B : 0x69)}, instr.dest.value, instr.dest, true, shortForm ? 1 : 4);
+                if (shortForm)
+                    put((uint8_t)instr.src.value);
+                else
+                    put32((int32_t)instr.src.value);
+            }
+            else
+                encodeModRm({0x0F, 0xAF}, instr.dest.value, instr.src, true);
+            break;
+        case ASM_IDIV:
+            encodeModRm({0xF7}, 7, instr.dest, true);
+            break;
+        case ASM_CQO:
+            put(0x48);
+            put(0x99);
+            break;
+        case ASM_TEST:
+            encodeModRm({0x85}, instr.src.value, instr.dest, true);
+            break;
+        case ASM_SETCC:
+            encodeModRm({0x0F, (uint8_t)(0x90 + conditionCode(instr.condition))}, 0, instr.dest, false);
+            break;
+        case ASM_JMP:
+            put(0xE9);
+            putRel32(FIXUP_LABEL, instr.dest.value);
+            break;
+        case ASM_JCC:
+            put(0x0F);
+            put(0x80 + conditionCode(instr.condition));
+            putRel32(FIXUP_LABEL, instr.dest.value);
+            break;
+        case ASM_PUSH:
+            if (instr.dest.kind == ASM_REGISTER)
+                pushRegister(instr.dest.value);
+            else if (instr.dest.kind == ASM_IMMEDIATE)
+            {
+                put(0x68);
+                put32((int32_t)instr.dest.value);
+            }
+            else
+                encodeModRm({0xFF}, 6, instr.dest, false);
+            break;
+        case ASM_POP:
+            popRegister(instr.dest.value);
+            break;
+        case ASM_CALL:
+            put(0xE8);
+            putRel32(instr.dest.kind == ASM_FUNCTION ? FIXUP_FUNCTION : FIXUP_RUNTIME, instr.dest.value);
+            break;
+        case ASM_RET:
+            put(0xC3);
+            break;
+        case ASM_SYSCALL:
+            put(0x0F);
+            put(0x05);
+            break;
+        case ASM_DEFINE_LABEL:
+            labelOffsets[instr.dest.value] = bytes.size();
+            break;
+        case ASM_REP_STOSQ:
+            put(0xF3);
+            put(0x48);
+            put(0xAB);
+            break;
+        case ASM_UD2:
+            put(0x0F);
+            put(0x0B);
+            break;
+        case ASM_VZEROUPPER:
+            put(0xC5);
+            put(0xF8);
+            put(0x77);
+            break;
+        default:
+            if (avx2)
+                encodeAvx2(instr);
+            else
+                encodeSse2(instr);
+        }
+    }
+
+    // Vector instructions on XMM registers, the mandatory 66 or F3 prefix goes before the REX prefix
+    void encodeSse2(const AsmInstruction &instr)
+    {
+        bool store = instr.dest.kind != ASM_VECTOR;
+        switch (instr.op)
+        {
+        case ASM_MOVDQU:
+            put(0xF3);
+            if (store)
+                encodeModRm({0x0F, 0x7F}, instr.src.value, instr.dest, false);
+            else
+                encodeModRm({0x0F, 0x6F}, instr.dest.value, instr.src, false);
+            break;
+        case ASM_MOVDQA:
+            put(0x66);
+            encodeModRm({0x0F, 0x6F}, instr.dest.value, instr.src, false);
+            break;
+        case ASM_PADDQ:
+            put(0x66);
+            encodeModRm({0x0F, 0xD4}, instr.dest.value, instr.src, false);
+            break;
+        case ASM_PSUBQ:
+            put(0x66);
+            encodeModRm({0x0F, 0xFB}, instr.dest.value, instr.src, false);
+            break;
+        case ASM_MOVQ:
+            put(0x66);
+            encodeModRm({0x0F, 0x6E}, instr.dest.value, instr.src, true);
+            break;
+        case ASM_BROADCAST:
+            // PUNPCKLQDQ of the register with itself
+            put(0x66);
+            encodeModRm({0x0F, 0x6C}, instr.dest.value, instr.src, false);
+            break;
+        default:
+            throw logic_error("JIT: no encoding for instruction " + to_string(instr.op));
+        }
+    }
+
+    // Vector instructions on YMM registers
+    void encodeAvx2(const AsmInstruction &instr)
+    {
+        bool store = instr.dest.kind != ASM_VECTOR;
+        int source = instr.extra.kind == ASM_NONE ? (int)instr.dest.value : (int)instr.extra.value;
+        switch (instr.op)
+        {
+        case ASM_MOVDQU:
+            if (store)
+                encodeVex(1, 2, false, true, 0, 0x7F, instr.src.value, instr.dest);
+            else
+                encodeVex(1, 2, false, true, 0, 0x6F, instr.dest.value, instr.src);
+            break;
+        case ASM_MOVDQA:
+            encodeVex(1, 1, false, true, 0, 0x6F, instr.dest.value, instr.src);
+            break;
+        case ASM_PADDQ:
+            encodeVex(1, 1, false, true, source, 0xD4, instr.dest.value, instr.src);
+            break;
+        case ASM_PSUBQ:
+            encodeVex(1, 1, false, true, source, 0xFB, instr.dest.value, instr.src);
+            break;
+        case ASM_MOVQ:
+            encodeVex(1, 1, true, false, 0, 0x6E, instr.dest.value, instr.src);
+            break;
+        case ASM_BROADCAST:
+            encodeVex(2, 1, false, true, 0, 0x59, instr.dest.value, instr.src);
+            break;
+        default:
+            throw logic_error("JIT: no encoding for instruction " + to_string(instr.op));
+        }
+    }
+
+    void pushRegister(int reg)
+    {
+        if (reg & 8)
+            put(0x41);
+        put(0x50 + (reg & 7));
+    }
+
+    void popRegister(int reg)
+    {
+        if (reg & 8)
+            put(0x41);
+        put(0x58 + (reg & 7));
+    }
+
+    /*
+    The generated code calls RUNTIME_CONCAT with both strings pushed and
+    expects every register but RAX (and the scratch RDX and R11) to survive.
+    This adapter saves the caller-saved registers the allocator hands out,
+    aligns the stack and calls concatenate() with the System V convention.
+    */
+    void encodeConcatTrampoline()
+    {
+        static const Register saved[] = {RCX, RSI, RDI, R8, R9, R10};
+        for (Register reg : saved)
+            pushRegister(reg);
+        // Return address at RSP + 48, then the right and left strings
+        for (uint8_t byte : {0x48, 0x8B, 0x7C, 0x24, 0x40}) // MOV RDI, [RSP + 64]
+            put(byte);
+        for (uint8_t byte : {0x48, 0x8B, 0x74, 0x24, 0x38}) // MOV RSI, [RSP + 56]
+            put(byte);
+        pushRegister(RBP);
+        for (uint8_t byte : {0x48, 0x89, 0xE5, 0x48, 0x83, 0xE4, 0xF0}) // MOV RBP, RSP; AND RSP, -16
+            put(byte);
+        put(0x48); // MOV RAX, imm64
+        put(0xB8);
+        put64((int64_t)(intptr_t)&concatenate);
+        put(0xFF); // CALL RAX
+        put(0xD0);
+        for (uint8_t byte : {0x48, 0x89, 0xEC}) // MOV RSP, RBP
+            put(byte);
+        popRegister(RBP);
+        for (size_t i = size(saved); i-- > 0;)
+            popRegister(saved[i]);
+        put(0xC3);
+    }
+
+    // Strings built at run time live until the thread exits
+    static const char *concatenate(const char *left, const char *right)
+    {
+        static thread_local deque<string> heap;
+        heap.push_back(string(left) + right);
+        return heap.back().c_str();
+    }
+};
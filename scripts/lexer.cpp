@@ -1,6 +1,9 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
+#include <cstring>
+#include <cstdint>
 
 using namespace std;
 
@@ -8,9 +11,10 @@ class Lexer
 {
 
 private:
-    string src;
+    string_view src; // View of the (memory-mapped) source, tokens point into it
     size_t position;
     size_t lineNumber;
+    TokenStream tokens;
     /*
     It hold positive values.
     In C++, size_t is an unsigned integer data type used to represent the
@@ -19,31 +23,37 @@ private:
     */
 
 public:
-    Lexer(const string &src)
+    Lexer(string_view src)
     {
         this->src = src;
         this->position = 0;
         this->lineNumber = 0;
     }
 
-    vector<Token> tokenize()
+    TokenStream tokenize()
     {
-        vector<Token> tokens;
+        // Offsets are stored in 32 bits
+        if (src.size() >= UINT32_MAX)
+        {
+            throw CompileError("Source file is too large (4 GiB limit)");
+        }
+        // Rough upper bound on token density so the arrays do not keep regrowing on large inputs
+        tokens.reserve(src.size() / 4 + 1);
         while (position < src.size())
         {
             char current = src[position];
 
             if (current == '\n')
             {
-                lineNumber++;
                 position++;
+                newLine();
                 continue;
             }
 
             // Detect Single line comments
-            if (current == '/' && src[position + 1] == '/')
+            if (current == '/' && peek(1) == '/')
             {
-                while (src[position] != '\n' && position <= src.size())
+                while (position < src.size() && src[position] != '\n')
                 {
                     position++;
                 }
@@ -54,16 +64,23 @@ public:
             if (current == '"')
             {
                 position++;
-                // string str = "\"";
-                string str = "";
-                while (src[position] != '"')
+                const char *closingQuote = static_cast<const char *>(
+                    memchr(src.data() + position, '"', src.size() - position));
+                if (closingQuote == nullptr)
                 {
-                    str = str + src[position];
-                    position++;
+                    throw CompileError("Unterminated string literal at line " + to_string(lineNumber));
                 }
-                // str += src[position];
-                position++;
-                tokens.push_back(Token{T_STRING, str, lineNumber});
+                size_t length = closingQuote - (src.data() + position);
+                string_view str = src.substr(position, length);
+                addToken(T_STRING, str);
+                // Keep the line table right for string literals spanning several lines
+                size_t end = position + length;
+                while (position < end)
+                {
+                    if (src[position++] == '\n')
+                        newLine();
+                }
+                position++; // Closing quote
                 continue;
             }
 
@@ -74,55 +91,55 @@ public:
             }
             if (isdigit(current))
             {
-                tokens.push_back(Token{T_NUM, consumeNumber(), lineNumber});
+                addToken(T_NUM, consumeNumber());
                 continue;
             }
             if (isalpha(current))
             {
-                string word = consumeWord();
+                string_view word = consumeWord();
                 if (word == "int")
-                    tokens.push_back(Token{T_INT, word, lineNumber});
+                    addToken(T_INT, word);
                 else if (word == "float")
-                    tokens.push_back(Token{T_FLOAT, word, lineNumber});
+                    addToken(T_FLOAT, word);
                 else if (word == "string")
-                    tokens.push_back(Token{T_STRING, word, lineNumber});
+                    addToken(T_STRING, word);
                 else if (word == "if")
-                    tokens.push_back(Token{T_IF, word, lineNumber});
+                    addToken(T_IF, word);
                 else if (word == "else")
-                    tokens.push_back(Token{T_ELSE, word, lineNumber});
+                    addToken(T_ELSE, word);
                 else if (word == "return")
-                    tokens.push_back(Token{T_RETURN, word, lineNumber});
+                    addToken(T_RETURN, word);
                 else if (word == "while")
-                    tokens.push_back(Token{T_WHILE, word, lineNumber});
+                    addToken(T_WHILE, word);
                 else if (word == "for")
-                    tokens.push_back(Token{T_FOR, word, lineNumber});
+                    addToken(T_FOR, word);
                 else
-                    tokens.push_back(Token{T_ID, word, lineNumber});
+                    addToken(T_ID, word);
                 continue;
             }
 
             // Handle Multi-character Operators (==, <=, >=)
-            if (current == '=' && src[position + 1] == '=')
+            if (current == '=' && peek(1) == '=')
             {
-                tokens.push_back(Token{T_EQ, "==", lineNumber});
+                addToken(T_EQ, src.substr(position, 2));
                 position += 2;
                 continue;
             }
-            else if (current == '!' && src[position + 1] == '=')
+            else if (current == '!' && peek(1) == '=')
             {
-                tokens.push_back(Token{T_NEQ, "!=", lineNumber});
+                addToken(T_NEQ, src.substr(position, 2));
                 position += 2;
                 continue;
             }
-            else if (current == '<' && src[position + 1] == '=')
+            else if (current == '<' && peek(1) == '=')
             {
-                tokens.push_back(Token{T_LE, "<=", lineNumber});
+                addToken(T_LE, src.substr(position, 2));
                 position += 2;
                 continue;
             }
-            else if (current == '>' && src[position + 1] == '=')
+            else if (current == '>' && peek(1) == '=')
             {
-                tokens.push_back(Token{T_GE, ">=", lineNumber});
+                addToken(T_GE, src.substr(position, 2));
                 position += 2;
                 continue;
             }
@@ -131,54 +148,62 @@ public:
             switch (current)
             {
             case '=':
-                tokens.push_back(Token{T_ASSIGN, "=", lineNumber});
+                addToken(T_ASSIGN, src.substr(position, 1));
                 break;
             case '+':
-                tokens.push_back(Token{T_PLUS, "+", lineNumber});
+                addToken(T_PLUS, src.substr(position, 1));
                 break;
             case '-':
-                tokens.push_back(Token{T_MINUS, "-", lineNumber});
+                addToken(T_MINUS, src.substr(position, 1));
                 break;
             case '*':
-                tokens.push_back(Token{T_MUL, "*", lineNumber});
+                addToken(T_MUL, src.substr(position, 1));
                 break;
             case '/':
-                tokens.push_back(Token{T_DIV, "/", lineNumber});
+                addToken(T_DIV, src.substr(position, 1));
                 break;
             case '(':
-                tokens.push_back(Token{T_LPAREN, "(", lineNumber});
+                addToken(T_LPAREN, src.substr(position, 1));
                 break;
             case ')':
-                tokens.push_back(Token{T_RPAREN, ")", lineNumber});
+                addToken(T_RPAREN, src.substr(position, 1));
                 break;
             case '{':
-                tokens.push_back(Token{T_LBRACE, "{", lineNumber});
+                addToken(T_LBRACE, src.substr(position, 1));
                 break;
             case '}':
-                tokens.push_back(Token{T_RBRACE, "}", lineNumber});
+                addToken(T_RBRACE, src.substr(position, 1));
                 break;
             case ';':
-                tokens.push_back(Token{T_SEMICOLON, ";", lineNumber});
+                addToken(T_SEMICOLON, src.substr(position, 1));
+                break;
+            case ',':
+                addToken(T_COMMA, src.substr(position, 1));
+                break;
+            case '[':
+                addToken(T_LBRACKET, src.substr(position, 1));
+                break;
+            case ']':
+                addToken(T_RBRACKET, src.substr(position, 1));
                 break;
             case '>':
-                tokens.push_back(Token{T_GT, ">", lineNumber});
+                addToken(T_GT, src.substr(position, 1));
                 break;
             case '<':
-                tokens.push_back(Token{T_LT, "<", lineNumber});
+                addToken(T_LT, src.substr(position, 1));
                 break;
             default:
-                cout << "Unexpected character: " << current << endl;
-                exit(1);
+                throw CompileError("Unexpected character: " + string(1, current));
             }
             position++;
         }
-        tokens.push_back(Token{T_EOF, "", lineNumber});
+        addToken(T_EOF, src.substr(src.size()));
 
         // printTokens(tokens);
-        return tokens;
+        return move(tokens);
     }
 
-    string consumeNumber()
+    string_view consumeNumber()
     {
         size_t start = position;
         while (position < src.size() && isdigit(src[position]))
@@ -186,7 +211,7 @@ public:
         return src.substr(start, position - start);
     }
 
-    string consumeWord()
+    string_view consumeWord()
     {
         size_t start = position;
         while (position < src.size() && isalnum(src[position]))
@@ -194,11 +219,30 @@ public:
         return src.substr(start, position - start);
     }
 
-    void printTokens(vector<Token> tokens)
+    // Character `offset` places ahead of the current one, '\0' past the end of the buffer
+    char peek(size_t offset) const
+    {
+        return position + offset < src.size() ? src[position + offset] : '\0';
+    }
+
+    // Tokens only reference the source buffer, no string is allocated while lexing
+    void addToken(TokenType type, string_view lexeme)
+    {
+        tokens.push(type, lexeme.data() - src.data(), tokens.values.internView(lexeme));
+    }
+
+    // `position` must point at the first character of the new line
+    void newLine()
+    {
+        lineNumber++;
+        tokens.lineStarts.push_back(position);
+    }
+
+    void printTokens(const TokenStream &tokens)
     {
         for (size_t i = 0; i < tokens.size(); i++)
         {
-            cout << tokens[i].value << "\t" << getTokenName(tokens[i].type) << "\t" << tokens[i].lineNumber << endl;
+            cout << tokens.text(i) << "\t" << getTokenName(tokens.type(i)) << "\t" << tokens.line(i) << endl;
         }
     }
 };
\ No newline at end of file
@@ -0,0 +1,168 @@
+#include <vector>
+#include <cstdint>
+
+using namespace std;
+
+// What LoopVectorizer found out about a loop it can vectorize
+struct VectorLoop
+{
+    uint32_t counter = 0;             // Symbol of the loop variable i
+    const Expr *bound = nullptr;      // N in i < N
+    int64_t shortestArray = 0;        // Elements of the shortest array the body touches
+    vector<const Stmt *> stores;      // The body, a list of a[i] = value
+    vector<const Expr *> invariants;  // Numbers and variables the body reads, each splat into a vector register once
+};
+
+/*
+Recognizes the counted loops, as parseBlockStatement builds them, whose
+iterations can run `width` at a time:
+  for (int i = start; i < N; i++) { a[i] = value; b[i] = value; ... }
+start is a literal that is not negative, N is made of numbers and variables,
+and the body only stores to elements at index i. A value is a sum or
+difference of elements at index i, numbers and variables. Every iteration then
+touches element i of each array and nothing else, so no iteration depends on
+another, and nothing the body does changes N or the variables it reads.
+*/
+class LoopVectorizer
+{
+public:
+    static constexpr int vectorRegisters = 16;
+
+    static bool analyze(const Stmt *loop, int width, const SymbolTable &symbols, VectorLoop &plan)
+    {
+        plan = VectorLoop{};
+        if (loop->kind != STMT_FOR || loop->init == nullptr || !countsFromLiteral(loop->init, symbols))
+            return false;
+        plan.counter = loop->init->symbol;
+
+        const Expr *condition = loop->value;
+        if (condition->kind != EXPR_BINARY || condition->op != T_LT || !isCounter(condition->left, plan) ||
+            !isInvariantBound(condition->right, plan))
+            return false;
+        plan.bound = condition->right;
+        if (loop->step->kind != STMT_INCREMENT || loop->step->op != T_PLUS || loop->step->symbol != plan.counter)
+            return false;
+
+        const Stmt *body = loop->body->kind == STMT_BLOCK ? loop->body->body : loop->body;
+        if (body == nullptr || (loop->body->kind != STMT_BLOCK && body->kind != STMT_ELEMENT))
+            return false;
+        int registersNeeded = 0;
+        for (const Stmt *statement = body; statement != nullptr; statement = statement->next)
+        {
+            if (statement->kind != STMT_ELEMENT || !isCounter(statement->index, plan))
+                return false;
+            int needed = 0;
+            if (!isVectorizable(statement->value, symbols, plan, needed))
+                return false;
+            registersNeeded = max(registersNeeded, needed);
+            touch(statement->symbol, symbols, plan);
+            plan.stores.push_back(statement);
+            if (loop->body->kind != STMT_BLOCK)
+                break;
+        }
+
+        // One register is kept as scratch by the code generator
+        if ((int)plan.invariants.size() + registersNeeded + 1 > vectorRegisters)
+            return false;
+        // A loop known to leave its arrays traps anyway, and one too short for a single vector is left alone
+        int64_t start = loop->init->value->number;
+        if (plan.bound->kind == EXPR_NUMBER && (plan.bound->number > plan.shortestArray || plan.bound->number - start < width))
+            return false;
+        return true;
+    }
+
+private:
+    // int i = start or i = start, with start a literal that is not negative
+    static bool countsFromLiteral(const Stmt *init, const SymbolTable &symbols)
+    {
+        if (init->kind != STMT_DECLARATION && init->kind != STMT_ASSIGNMENT)
+            return false;
+        const Symbol &counter = symbols.symbolAt(init->symbol);
+        return !counter.isArray() && counter.value.type == T_INT && init->value != nullptr &&
+               init->value->kind == EXPR_NUMBER && init->value->number >= 0;
+    }
+
+    static bool isCounter(const Expr *expression, const VectorLoop &plan)
+    {
+        return expression->kind == EXPR_VARIABLE && expression->symbol == plan.counter;
+    }
+
+    // Numbers and int variables other than i, combined with +, - and *
+    static bool isInvariantBound(const Expr *expression, const VectorLoop &plan)
+    {
+        switch (expression->kind)
+        {
+        case EXPR_NUMBER:
+            return true;
+        case EXPR_VARIABLE:
+            return expression->dataType == T_INT && !isCounter(expression, plan);
+        case EXPR_BINARY:
+            return (expression->op == T_PLUS || expression->op == T_MINUS || expression->op == T_MUL) &&
+                   isInvariantBound(expression->left, plan) && isInvariantBound(expression->right, plan);
+        default:
+            return false;
+        }
+    }
+
+    /*
+    Whether `expression` can be computed a vector at a time, with `needed` set
+    to the vector registers it takes besides those of the invariants. The left
+    operand of an operation is held while the right one is computed.
+    */
+    static bool isVectorizable(const Expr *expression, const SymbolTable &symbols, VectorLoop &plan, int &needed)
+    {
+        switch (expression->kind)
+        {
+        case EXPR_NUMBER:
+            addInvariant(expression, plan);
+            needed = 0;
+            return true;
+        case EXPR_VARIABLE:
+            if (expression->dataType != T_INT || isCounter(expression, plan))
+                return false;
+            addInvariant(expression, plan);
+            needed = 0;
+            return true;
+        case EXPR_ELEMENT:
+            if (!isCounter(expression->left, plan))
+                return false;
+            touch(expression->symbol, symbols, plan);
+            needed = 1;
+            return true;
+        case EXPR_BINARY:
+        {
+            int left = 0, right = 0;
+            if ((expression->op != T_PLUS && expression->op != T_MINUS) || expression->dataType != T_INT ||
+                !isVectorizable(expression->left, symbols, plan, left) || !isVectorizable(expression->right, symbols, plan, right))
+                return false;
+            needed = max(max(left, right + 1), 1);
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    static void touch(uint32_t array, const SymbolTable &symbols, VectorLoop &plan)
+    {
+        int64_t length = symbols.symbolAt(array).arrayLength;
+        if (plan.shortestArray == 0 || length < plan.shortestArray)
+            plan.shortestArray = length;
+    }
+
+    static void addInvariant(const Expr *expression, VectorLoop &plan)
+    {
+        for (const Expr *invariant : plan.invariants)
+        {
+            if (sameInvariant(invariant, expression))
+                return;
+        }
+        plan.invariants.push_back(expression);
+    }
+
+public:
+    static bool sameInvariant(const Expr *a, const Expr *b)
+    {
+        return a->kind == b->kind && (a->kind == EXPR_NUMBER ? a->number == b->number : a->symbol == b->symbol);
+    }
+};
@@ -1,4 +1,5 @@
 #include <vector>
+#include <unordered_map>
 
 using namespace std;
 
@@ -6,406 +7,599 @@ class Parser
 {
 
 public:
-    Parser(const vector<Token> &tokens, SymbolTable &symbolTable, IntermediateCodeGenerator &icg)
-        : tokens(tokens), position(0), symbolTable(symbolTable), icg(icg)
+    Parser(const TokenStream &tokens, SymbolTable &symbolTable, Arena &arena)
+        : tokens(tokens), position(0), symbolTable(symbolTable), arena(arena)
     {
-        this->dataTypes[T_INT] = T_INT;
-        this->dataTypes[T_STRING] = T_STRING;
-        this->dataTypes[T_FLOAT] = T_FLOAT;
-        this->dataTypes[T_CHAR] = T_CHAR;
-
-        this->blockStatement[T_IF] = T_IF;
-        this->blockStatement[T_WHILE] = T_WHILE;
-        this->blockStatement[T_FOR] = T_FOR;
     }
 
-    void parseProgram()
+    // Returns the program's top-level statement list, nodes live in the arena given to the constructor
+    // Function definitions are collected into functions() on the way
+    Stmt *parseProgram()
     {
-        while (tokens[position].type != T_EOF)
+        StatementList program;
+        while (tokens.type(position) != T_EOF)
         {
-            // cout << "before: " << tokens[position].value << endl;
-            parseStatement();
-            // cout << "before: " << tokens[position].value << endl;
+            // cout << "before: " << tokens.text(position) << endl;
+            if (isDataType(tokens.type(position)) && tokens.type(position + 1) == T_ID && tokens.type(position + 2) == T_LPAREN)
+                parseFunction();
+            else
+                program.append(parseStatement());
+            // cout << "before: " << tokens.text(position) << endl;
         }
+        return program.first;
+    }
 
-        symbolTable.displaySymbolTable();
+    // Function definitions in source order, a call refers to one by its index here
+    const vector<Function> &functions() const
+    {
+        return functionList;
     }
 
 private:
-    vector<Token> tokens;
+    const TokenStream &tokens; // Walked by index, owned by the caller
     size_t position;
-    map<TokenType, TokenType> dataTypes;
-    map<TokenType, TokenType> blockStatement;
     SymbolTable &symbolTable;
-    IntermediateCodeGenerator &icg;
+    Arena &arena;
+    vector<Function> functionList;
+    unordered_map<uint32_t, uint32_t> functionIds; // Interned name id -> index in functionList
+    int currentFunction = -1;                      // Function whose body is being parsed, -1 at the top level
+
+    // Every argument is passed in a register, as the first six are in the System V ABI
+    static constexpr size_t maxParameters = 6;
+    // Arrays live in the stack frame of the code declaring them, which this keeps well inside the stack
+    static constexpr int64_t maxArrayLength = 1 << 16;
+
+    // Appends statements through a tail pointer so lists are built in order
+    struct StatementList
+    {
+        Stmt *first = nullptr;
+        Stmt **tail = &first;
 
-    void parseStatement()
+        void append(Stmt *statement)
+        {
+            *tail = statement;
+            tail = &statement->next;
+        }
+    };
+
+    Stmt *parseStatement()
     {
-        // cout << "tokens[position].value: " << tokens[position].value << endl;
-        if (dataTypes.find(tokens[position].type) != dataTypes.end())
+        // cout << "tokens.text(position): " << tokens.text(position) << endl;
+        if (isDataType(tokens.type(position)))
+        {
+            return parseDeclaration(tokens.type(position));
+        }
+        else if (tokens.type(position) == T_ID && tokens.type(position + 1) == T_LPAREN)
         {
-            parseDeclaration(dataTypes[tokens[position].type]);
+            return parseCallStatement();
         }
-        else if (tokens[position].type == T_ID)
+        else if (tokens.type(position) == T_ID)
         {
-            parseAssignment();
+            return parseAssignment();
         }
-        else if (blockStatement.find(tokens[position].type) != blockStatement.end())
+        else if (isBlockStatement(tokens.type(position)))
         {
-            parseBlockStatement(tokens[position].type);
+            return parseBlockStatement(tokens.type(position));
         }
-        else if (tokens[position].type == T_RETURN)
+        else if (tokens.type(position) == T_RETURN)
         {
-            parseReturnStatement();
+            return parseReturnStatement();
         }
-        else if (tokens[position].type == T_LBRACE)
+        else if (tokens.type(position) == T_LBRACE)
         {
-            parseBlock();
+            return parseBlock();
         }
         else
         {
-            cout << "Syntax error: unexpected token " << getQuotesAroundStr(tokens[position].value) << endl;
-            exit(1);
+            throw CompileError("Syntax error: unexpected token " + getQuotesAroundStr(tokenText(position)));
         }
     }
 
-    void parseBlock()
+    Stmt *parseBlock()
     {
+        Stmt *block = newStatement(STMT_BLOCK);
+        StatementList body;
         expect(T_LBRACE);
-        while (tokens[position].type != T_RBRACE && tokens[position].type != T_EOF)
+        symbolTable.enterScope();
+        while (tokens.type(position) != T_RBRACE && tokens.type(position) != T_EOF)
         {
-            parseStatement();
+            body.append(parseStatement());
         }
+        symbolTable.exitScope();
         expect(T_RBRACE);
+        block->body = body.first;
+        return block;
     }
 
-    void parseDeclaration(TokenType dataType)
+    Stmt *parseDeclaration(TokenType dataType)
     {
+        Stmt *declaration = newStatement(STMT_DECLARATION);
         expect(dataType);
-        string identifierName = tokens[position].value;
+        uint32_t nameId = tokens.valueId(position);
+        string_view identifierName = tokens.text(position);
         expect(T_ID);
-        Token symbolInstance;
-        if (tokens[position].type == T_ASSIGN)
+        if (tokens.type(position) == T_LBRACKET)
+        {
+            declaration->symbol = parseArrayLength(dataType, nameId, identifierName);
+            expect(T_SEMICOLON);
+            return declaration;
+        }
+        Token symbolInstance{};
+        if (tokens.type(position) == T_ASSIGN)
         {
             expect(T_ASSIGN);
-            if (tokens[position].type == T_STRING)
+            if (tokens.type(position) == T_STRING)
             {
-                symbolInstance = Token{T_STRING, tokens[position].value};
-                expect(T_STRING);
+                symbolInstance = parseFactor();
             }
-            else if (tokens[position].type == T_NUM || tokens[position].type == T_ID)
+            else if (tokens.type(position) == T_NUM || tokens.type(position) == T_ID)
             {
-                symbolInstance = parseAndEvaluateExpression();
+                symbolInstance = parseAndEvaluateExpression(Token{dataType});
             }
         }
         symbolInstance.type = dataType;
-        symbolTable.declareVariable(identifierName, symbolInstance);
+        declaration->symbol = symbolTable.declareVariable(nameId, identifierName, symbolInstance);
         expect(T_SEMICOLON);
-        if (symbolInstance.icgVariable != "")
-            icg.addInstruction(identifierName + " = " + symbolInstance.icgVariable);
-        else if (symbolInstance.value != "")
-        {
-            if (symbolInstance.type == T_STRING)
-            {
-                symbolInstance.value = "\"" + symbolInstance.value + "\"";
-            }
-            icg.addInstruction(identifierName + " = " + symbolInstance.value);
-        }
+        declaration->value = symbolInstance.node; // Null when the variable starts without a value
+        return declaration;
     }
 
-    string parseAssignment(bool generateIntermediateCode = true)
+    Stmt *parseAssignment()
     {
-        string symbol = tokens[position].value;
+        Stmt *assignment = newStatement(STMT_ASSIGNMENT);
+        uint32_t nameId = tokens.valueId(position);
+        string_view name = tokens.text(position);
         expect(T_ID);
-        Token symbolInstance = symbolTable.getVariableToken(symbol);
-        if (tokens[position].type == T_PLUS || tokens[position].type == T_MINUS)
+        assignment->symbol = symbolTable.resolve(nameId, name);
+        if (symbolTable.symbolAt(assignment->symbol).isArray() || tokens.type(position) == T_LBRACKET)
         {
-            parseIncrementDecrementOperator(symbol, &symbolInstance);
+            assignment->kind = STMT_ELEMENT;
+            assignment->index = parseIndex(assignment->symbol, position - 1);
+            expect(T_ASSIGN);
+            assignment->value = parseElementValue();
+            expect(T_SEMICOLON);
+            return assignment;
+        }
+        Token symbolInstance = symbolTable.symbolAt(assignment->symbol).value;
+        if (tokens.type(position) == T_PLUS || tokens.type(position) == T_MINUS)
+        {
+            assignment->kind = STMT_INCREMENT;
+            assignment->op = parseIncrementDecrementOperator(&symbolInstance);
         }
         else
         {
             expect(T_ASSIGN);
             symbolInstance = parseAndEvaluateExpression(symbolInstance);
             expect(T_SEMICOLON);
+            assignment->value = symbolInstance.node;
         }
-        symbolTable.updateVariable(symbol, symbolInstance);
-        string assignmentTo = symbolInstance.icgVariable == "" ? symbolInstance.value : symbolInstance.icgVariable;
-        string icgInstruction = symbol + " = " + assignmentTo;
-        if (generateIntermediateCode)
-        {
-            icg.addInstruction(icgInstruction); // Generate intermediate code for the assignment.
-        }
-        return icgInstruction;
+        symbolTable.updateVariable(nameId, name, symbolInstance);
+        return assignment;
     }
 
-    void parseBlockStatement(TokenType blockStatementKeyword)
+    // [length] after the name of an array being declared, returns the array's symbol
+    uint32_t parseArrayLength(TokenType dataType, uint32_t nameId, string_view name)
     {
+        size_t line = tokens.line(position);
+        expect(T_LBRACKET);
+        Token length = parseAndEvaluateExpression(Token{T_INT});
+        expect(T_RBRACKET);
+        if (dataType != T_INT)
+            reportError("Array " + getQuotesAroundStr(string(name)) + " has elements of type " + getTokenName(dataType) + ", only int arrays are supported",
+                        "Error at line number: " + to_string(line));
+        if (length.node->kind != EXPR_NUMBER || length.node->number < 1 || length.node->number > maxArrayLength)
+            reportError("The length of array " + getQuotesAroundStr(string(name)) + " must be a constant from 1 to " + to_string(maxArrayLength),
+                        "Error at line number: " + to_string(line));
+        return symbolTable.declareArray(nameId, name, dataType, length.node->number);
+    }
+
+    /*
+    [index] after the array named at `namePosition`. An index the parser can
+    compute must be in range; any other is checked when the program runs.
+    */
+    Expr *parseIndex(uint32_t symbol, size_t namePosition)
+    {
+        size_t line = tokens.line(namePosition);
+        const Symbol &array = symbolTable.symbolAt(symbol);
+        if (!array.isArray())
+            reportError(getQuotesAroundStr(tokenText(namePosition)) + " is not an array", "Error at line number: " + to_string(line));
+        if (tokens.type(position) != T_LBRACKET)
+            reportError("Array " + getQuotesAroundStr(tokenText(namePosition)) + " can only be used one element at a time",
+                        "Error at line number: " + to_string(line));
+        expect(T_LBRACKET);
+        Expr *index = parseAndEvaluateExpression(Token{T_INT}).node;
+        expect(T_RBRACKET);
+        if (index->dataType != T_INT)
+            reportError("The index of array " + getQuotesAroundStr(tokenText(namePosition)) + " must be an int",
+                        "Error at line number: " + to_string(line));
+        if (index->kind == EXPR_NUMBER && (index->number < 0 || index->number >= array.arrayLength))
+            reportError("Index " + to_string(index->number) + " is out of range for array " + getQuotesAroundStr(tokenText(namePosition)) +
+                            " of " + to_string(array.arrayLength) + " elements",
+                        "Error at line number: " + to_string(line));
+        return index;
+    }
+
+    // The value stored into an element, which has to be an int like the element
+    Expr *parseElementValue()
+    {
+        size_t line = tokens.line(position);
+        Expr *value = parseAndEvaluateExpression(Token{T_INT}).node;
+        if (value->dataType != T_INT)
+            reportError("Only int values can be stored in an array", "Error at line number: " + to_string(line));
+        return value;
+    }
+
+    Stmt *parseBlockStatement(TokenType blockStatementKeyword)
+    {
+        Stmt *statement = newStatement(blockStatementKeyword == T_IF ? STMT_IF : (blockStatementKeyword == T_WHILE ? STMT_WHILE : STMT_FOR));
         expect(blockStatementKeyword);
         expect(T_LPAREN);
-        string loopStartLabel;
         if (blockStatementKeyword == T_FOR)
         {
+            // Variables declared in the header are only visible inside the loop
+            symbolTable.enterScope();
+
             // Initialization / Declaration of iterator
-            if (dataTypes.find(tokens[position].type) != dataTypes.end())
+            if (isDataType(tokens.type(position)))
             {
-                parseDeclaration(tokens[position].type);
+                statement->init = parseDeclaration(tokens.type(position));
             }
-            else if (tokens[position].type == T_ID)
+            else if (tokens.type(position) == T_ID)
             {
-                parseAssignment();
+                statement->init = parseAssignment();
             }
         }
 
-        if (blockStatementKeyword == T_WHILE || blockStatementKeyword == T_FOR)
-        {
-            // Starting label of FOR loop
-            loopStartLabel = icg.newLabel();
-            icg.addInstruction(loopStartLabel + ":");
-        }
-
         // Evaluating condition
         Token condition = parseAndEvaluateExpression();
+        statement->value = condition.node;
 
-        string trueConditionLabel = icg.newLabel();
-        string falseConditionLabel = icg.newLabel();
-        icg.addInstruction("if " + condition.icgVariable + " goto " + trueConditionLabel);
-        icg.addInstruction("goto " + falseConditionLabel);
-        icg.addInstruction(trueConditionLabel + ":");
-
-        string iteratorInstruction; // To receive instruction for iterator part of FOR loop
         if (blockStatementKeyword == T_FOR)
         {
             expect(T_SEMICOLON);
-            iteratorInstruction = parseAssignment(false);
+            statement->step = parseAssignment(); // Iterator part of FOR loop
         }
 
         expect(T_RPAREN);
 
-        parseStatement(); // Body of IF/FOR/WHILE
+        statement->body = parseStatement(); // Body of IF/FOR/WHILE
 
         if (blockStatementKeyword == T_FOR)
         {
-            icg.addInstruction(iteratorInstruction); // Iterator instruction before going to start of loop
-            icg.addInstruction("goto " + loopStartLabel);
-            icg.addInstruction(falseConditionLabel + ":");
+            symbolTable.exitScope();
         }
-        else if (blockStatementKeyword == T_WHILE)
+        else if (blockStatementKeyword == T_IF && tokens.type(position) == T_ELSE)
         {
-            icg.addInstruction("goto " + loopStartLabel);
-            icg.addInstruction(falseConditionLabel + ":");
+            expect(T_ELSE);
+            statement->elseBody = parseStatement();
         }
-        else if (blockStatementKeyword == T_IF && tokens[position].type == T_ELSE)
+        return statement;
+    }
+
+    /*
+    returnType name(type parameter, ...) { body }
+    The function is registered before its body is parsed, so it can call
+    itself, and calls must come after the definition. Parameters share the
+    scope of the body's statements, which cannot see top-level variables.
+    */
+    void parseFunction()
+    {
+        Function function;
+        function.returnType = tokens.type(position++);
+        uint32_t nameId = tokens.valueId(position);
+        function.name = tokens.text(position);
+        size_t line = tokens.line(position);
+        expect(T_ID);
+        if (functionIds.count(nameId))
+            reportError("Semantic error: Function " + getQuotesAroundStr(string(function.name)) + " is already defined.",
+                        "Error at line number: " + to_string(line));
+
+        expect(T_LPAREN);
+        symbolTable.enterFunction();
+        while (tokens.type(position) != T_RPAREN)
+        {
+            if (!function.parameters.empty())
+                expect(T_COMMA);
+            TokenType type = tokens.type(position);
+            if (!isDataType(type))
+                reportError("Syntax error: expected a parameter type but found " + tokenText(position),
+                            "Error at line number: " + to_string(tokens.line(position)));
+            position++;
+            uint32_t parameterId = tokens.valueId(position);
+            string_view parameterName = tokens.text(position);
+            expect(T_ID);
+            if (function.parameters.size() == maxParameters)
+                reportError("Function " + getQuotesAroundStr(string(function.name)) + " has more than " + to_string(maxParameters) + " parameters",
+                            "Error at line number: " + to_string(line));
+            // A parameter always holds a value, it is just not known while compiling
+            uint32_t symbol = symbolTable.declareVariable(parameterId, parameterName, Token{type});
+            symbolTable.updateVariable(parameterId, parameterName, Token{type, ConstValue{}, line, newVariable(symbol, type)});
+            function.parameters.push_back(symbol);
+        }
+        expect(T_RPAREN);
+
+        functionIds[nameId] = functionList.size();
+        currentFunction = functionList.size();
+        functionList.push_back(move(function));
+        StatementList body;
+        expect(T_LBRACE);
+        while (tokens.type(position) != T_RBRACE && tokens.type(position) != T_EOF)
         {
-            string elseLabel = icg.newLabel();
-            icg.addInstruction("goto " + elseLabel);
-            icg.addInstruction(falseConditionLabel + ":");
-            expect(T_ELSE);
-            parseStatement();
-            icg.addInstruction(elseLabel + ":");
+            body.append(parseStatement());
         }
+        symbolTable.exitFunction();
+        expect(T_RBRACE);
+        functionList[currentFunction].body = body.first;
+        currentFunction = -1;
     }
 
-    void parseReturnStatement()
+    // name(arguments); with the returned value dropped
+    Stmt *parseCallStatement()
     {
-        expect(T_RETURN);
-        Token exp = parseAndEvaluateExpression();
+        Stmt *statement = newStatement(STMT_CALL);
+        size_t namePosition = position++;
+        statement->value = parseCall(namePosition).node;
         expect(T_SEMICOLON);
-        string statement = exp.icgVariable == "" ? exp.value : exp.icgVariable;
-        icg.addInstruction("return " + statement);
+        return statement;
     }
 
-    void parseIncrementDecrementOperator(string identifier, Token *identifierValue)
+    // The arguments of a call to the function named at `namePosition`, the opening parenthesis is next
+    Token parseCall(size_t namePosition)
     {
-        if (tokens[position].type == T_PLUS)
-        {
-            expect(T_PLUS);
-            expect(T_PLUS);
-            int value = stoi(identifierValue->value);
-            identifierValue->value = to_string(value + 1);
-            identifierValue->icgVariable = identifier + " + 1";
-        }
-        else if (tokens[position].type == T_MINUS)
+        size_t line = tokens.line(namePosition);
+        auto found = functionIds.find(tokens.valueId(namePosition));
+        if (found == functionIds.end())
+            throw CompileError("Semantic error: Function " + getQuotesAroundStr(tokenText(namePosition)) + " is not defined.");
+        const Function &function = functionList[found->second];
+        Expr *call = arena.make<Expr>(Expr{EXPR_CALL, function.returnType});
+        call->symbol = found->second;
+
+        Expr **argument = &call->left;
+        size_t count = 0;
+        expect(T_LPAREN);
+        while (tokens.type(position) != T_RPAREN)
         {
-            expect(T_MINUS);
-            expect(T_MINUS);
-            int value = stoi(identifierValue->value);
-            identifierValue->value = to_string(value - 1);
-            identifierValue->icgVariable = identifier + " - 1";
+            if (count > 0)
+                expect(T_COMMA);
+            // Typed like its parameter, so that + on string arguments concatenates
+            TokenType type = count < function.parameters.size() ? symbolTable.symbolAt(function.parameters[count]).value.type : T_INT;
+            *argument = parseAndEvaluateExpression(Token{type}).node;
+            argument = &(*argument)->next;
+            count++;
         }
+        expect(T_RPAREN);
+        if (count != function.parameters.size())
+            reportError("Function " + getQuotesAroundStr(tokenText(namePosition)) + " takes " + to_string(function.parameters.size()) +
+                            " arguments but is given " + to_string(count),
+                        "Error at line number: " + to_string(line));
+        return Token{function.returnType, ConstValue{}, line, call};
+    }
+
+    Stmt *parseReturnStatement()
+    {
+        Stmt *statement = newStatement(STMT_RETURN);
+        expect(T_RETURN);
+        // A function returns a value of its declared type, the program an exit status
+        Token exp = parseAndEvaluateExpression(Token{currentFunction == -1 ? T_INT : functionList[currentFunction].returnType});
+        expect(T_SEMICOLON);
+        statement->value = exp.node;
+        return statement;
     }
 
+    // Returns the operator applied to the variable, T_PLUS for ++ and T_MINUS for --
+    TokenType parseIncrementDecrementOperator(Token *identifierValue)
+    {
+        TokenType op = tokens.type(position) == T_PLUS ? T_PLUS : T_MINUS;
+        expect(op);
+        expect(op);
+        identifierValue->value = foldBinary(op, identifierValue->value, ConstValue::ofInt(1), arena);
+        return op;
+    }
+
+    // Values are tracked as ConstValues: known while every operand is, CONST_NONE from there on
     Token parseAndEvaluateExpression(Token initialValue = {})
     {
         Token result = initialValue;
         Token firstTerm = parseTerm();
-        result.icgVariable = firstTerm.icgVariable == "" ? firstTerm.value : firstTerm.icgVariable;
-        if (firstTerm.type == T_ID)
-        {
-            Token symbolInstance = symbolTable.getVariableToken(firstTerm.value);
-            string identifierValue = symbolInstance.value;
-            TokenType identifierType = symbolInstance.type;
-
-            if (identifierValue == "")
-                showErrorMessagesAndExit(getQuotesAroundStr(firstTerm.value) + " has value undefined!");
-
-            result.value = identifierValue;
-        }
-        else
+        result.node = firstTerm.node;
+        // parseTerm has already resolved identifiers to their symbol's value
+        result.value = firstTerm.value;
+        while (tokens.type(position) == T_PLUS || tokens.type(position) == T_MINUS)
         {
-            result.value = firstTerm.value;
+            TokenType op = tokens.type(position++);
+            Token nextTerm = parseTerm();
+            if (op == T_MINUS && result.type == T_STRING)
+                reportError("Cannot perform '-' op on type string");
+            result.value = foldBinary(op, result.value, nextTerm.value, arena);
+            result.node = newBinary(op, result.type, result.node, nextTerm.node);
         }
-        while (tokens[position].type == T_PLUS || tokens[position].type == T_MINUS)
+        if (isComparisonOperator(tokens.type(position)))
         {
-            string op = tokens[position].type == T_PLUS ? "+" : "-";
-            position++;
-            bool isNextTermIdentifier = false;
-            Token nextTerm = parseTerm(&isNextTermIdentifier);
-            string nextTermValue = nextTerm.value;
-            TokenType nextTermType = result.type;
-            if (nextTerm.type == T_ID)
-            {
-                Token tempSymbolInstance = symbolTable.getVariableToken(nextTerm.value);
-                nextTermValue = tempSymbolInstance.value;
-                nextTermType = tempSymbolInstance.type;
-            }
-            if (nextTermType != result.type) // Validation check for operation between different data types
-                showErrorMessagesAndExit(
-                    "Operation '" + op + "' cannot be applied between type: " + getTokenName(result.type) + " and " + getTokenName(nextTermType) + "!");
-            if (op == "+")
-            {
-                if (result.type == T_INT)
-                    result.value = to_string(stoi(result.value) + stoi(nextTermValue));
-                else
-                    result.value += nextTermValue;
-            }
-            else
-            {
-                if (result.type == T_INT)
-                    result.value = to_string(stoi(result.value) - stoi(nextTermValue));
-
-                else if (result.type == T_STRING)
-                    showErrorMessagesAndExit("Cannot perform '-' op on type string");
-            }
-            string newVar = icg.newTemp();
-            string nextTermVar = nextTerm.icgVariable == "" ? nextTerm.value : nextTerm.icgVariable;
-            cout << "isNextTermIdentifier: " << isNextTermIdentifier << endl;
-            if (result.type == T_STRING && !isNextTermIdentifier)
-            {
-                nextTermVar = "\"" + nextTermVar + "\"";
-            }
-            icg.addInstruction(newVar + " = " + result.icgVariable + " " + op + " " + nextTermVar);
-            result.icgVariable = newVar;
-        }
-        // if (tokens[position].type == T_GT || tokens[position].type == T_LT || tokens[position].type == T_EQ)
-        if (isComparisonOperator(tokens[position].type))
-        {
-            TokenType comparisonOp = tokens[position].type;
+            TokenType comparisonOp = tokens.type(position);
             position++;
             Token nextExp = parseAndEvaluateExpression();
-            string nextExpVar = nextExp.icgVariable == "" ? nextExp.value : nextExp.icgVariable;
-            string icgVar = icg.newTemp();
-            icg.addInstruction(icgVar + " = " + result.icgVariable + " " + getTokenName(comparisonOp) + " " + nextExpVar);
-            result.icgVariable = icgVar;
+            // Strings are compared by address, which interning and folding change between -O0 and -O1
+            if (producesString(result.node) || producesString(nextExp.node))
+                reportError("Cannot perform " + getQuotesAroundStr(getTokenName(comparisonOp)) + " op on type string");
+            result.value = foldBinary(comparisonOp, result.value, nextExp.value, arena);
+            result.node = newBinary(comparisonOp, T_INT, result.node, nextExp.node);
         }
         return result;
     }
 
-    Token parseTerm(bool *isNextTermIdentifier = nullptr)
+    Token parseTerm()
     {
-        Token factor = parseFactor();
-        Token result = factor;
-        if (factor.type == T_ID)
+        Token result = parseFactor();
+        while (tokens.type(position) == T_MUL || tokens.type(position) == T_DIV)
         {
-            result = symbolTable.getVariableToken(factor.value);
-            result.icgVariable = factor.value;
-            if (isNextTermIdentifier != nullptr)
-                *isNextTermIdentifier = true;
-        }
-        while (tokens[position].type == T_MUL || tokens[position].type == T_DIV)
-        {
-            // position++;
-            // factor = parseFactor();
-
-            TokenType op = tokens[position++].type;
-            Token nextFactor = parseFactor();
-            string nextFactorValue = nextFactor.value;
-            if (nextFactor.type == T_ID)
-            {
-                Token symbolInstance = symbolTable.getVariableToken(nextFactor.value);
-
-                if (symbolInstance.value == "")
-                    showErrorMessagesAndExit(getQuotesAroundStr(nextFactor.value) + " has value undefined!");
-
-                nextFactorValue = symbolInstance.value;
-                if (isNextTermIdentifier != nullptr)
-                    *isNextTermIdentifier = true;
-            }
-
-            string resultStr = result.icgVariable == "" ? result.value : result.icgVariable;
-            if (op == T_MUL)
-            {
-                result.value = to_string(stoi(result.value) * stoi(nextFactorValue));
-            }
-            else if (op == T_DIV)
-            {
-                result.value = to_string(stoi(result.value) / stoi(nextFactorValue));
-            }
-
-            string temp = icg.newTemp();
-            icg.addInstruction(temp + " = " + resultStr + (op == T_MUL ? " * " : " / ") + nextFactor.value);
-            result.icgVariable = temp;
+            TokenType op = tokens.type(position++);
+            Token nextFactor = parseFactor(true);
+            result.value = foldBinary(op, result.value, nextFactor.value, arena);
+            result.node = newBinary(op, T_INT, result.node, nextFactor.node);
         }
         return result;
     }
 
-    Token parseFactor()
+    // Literal, variable or parenthesized expression, with its tree in `node`
+    // With `requireValue`, a variable that was declared without a value is an error
+    Token parseFactor(bool requireValue = false)
     {
-        if (tokens[position].type == T_NUM || tokens[position].type == T_ID || tokens[position].type == T_STRING)
+        size_t factorPosition = position;
+        size_t line = tokens.line(position);
+        switch (tokens.type(position++))
         {
-            position++;
-            return tokens[position - 1];
+        case T_NUM:
+        {
+            int64_t number;
+            if (!parseIntegerLiteral(tokens.text(factorPosition), number))
+                reportError("Integer literal " + getQuotesAroundStr(tokenText(factorPosition)) + " does not fit in 64 bits",
+                            "Error at line number: " + to_string(line));
+            return Token{T_NUM, ConstValue::ofInt(number), line, newNumber(number)};
+        }
+        case T_STRING:
+        {
+            string_view text = tokens.text(factorPosition);
+            return Token{T_STRING, ConstValue::ofString(text), line, newString(text)};
+        }
+        case T_ID:
+        {
+            if (tokens.type(position) == T_LPAREN)
+                return parseCall(factorPosition);
+            uint32_t symbol = symbolTable.resolve(tokens.valueId(factorPosition), tokens.text(factorPosition));
+            if (symbolTable.symbolAt(symbol).isArray() || tokens.type(position) == T_LBRACKET)
+            {
+                // Elements start at 0, so they always have a value, but not one known while compiling
+                Expr *element = arena.make<Expr>(Expr{EXPR_ELEMENT, T_INT});
+                element->symbol = symbol;
+                element->left = parseIndex(symbol, factorPosition);
+                return Token{T_INT, ConstValue{}, line, element};
+            }
+            Token value = symbolTable.symbolAt(symbol).value;
+            if (requireValue && value.node == nullptr)
+                reportError(getQuotesAroundStr(tokenText(factorPosition)) + " has value undefined!");
+            value.node = newVariable(symbol, value.type);
+            return value;
         }
-        else if (tokens[position].type == T_LPAREN)
+        case T_LPAREN:
         {
-            expect(T_LPAREN);
             Token exp = parseAndEvaluateExpression();
             expect(T_RPAREN);
             return exp;
         }
-        else
-        {
-            cout << "Syntax error: unexpected token " << getQuotesAroundStr(tokens[position].value) << endl;
-            exit(1);
+        default:
+            throw CompileError("Syntax error: unexpected token " + getQuotesAroundStr(tokenText(factorPosition)));
         }
-        return Token{};
     }
 
     void expect(TokenType type)
     {
-        if (tokens[position].type == type)
+        if (tokens.type(position) == type)
         {
             position++;
         }
         else
         {
-            showErrorMessagesAndExit(
-                "Syntax error: expected " + getTokenName(type) + " but found " + tokens[position].value,
-                "Error at line number: " + to_string(tokens[position].lineNumber));
-            exit(1);
+            reportError(
+                "Syntax error: expected " + getTokenName(type) + " but found " + tokenText(position),
+                "Error at line number: " + to_string(tokens.line(position)));
         }
     }
 
-    template <typename... Args>
-    void showErrorMessagesAndExit(const string &str, const Args &...args)
+    // Text is a view into the token stream or the arena, both outlive the AST
+    Expr *newString(string_view text)
+    {
+        Expr *literal = arena.make<Expr>(Expr{EXPR_STRING, T_STRING});
+        literal->text = text;
+        return literal;
+    }
+
+    Expr *newNumber(int64_t number)
+    {
+        Expr *literal = arena.make<Expr>(Expr{EXPR_NUMBER, T_INT});
+        literal->number = number;
+        return literal;
+    }
+
+    // Whether an expression produces a string, whatever type its context expected
+    static bool producesString(const Expr *expr)
+    {
+        if (expr->kind == EXPR_BINARY)
+            return expr->op == T_PLUS && (producesString(expr->left) || producesString(expr->right));
+        return expr->dataType == T_STRING;
+    }
+
+    Expr *newVariable(uint32_t symbol, TokenType dataType)
+    {
+        Expr *variable = arena.make<Expr>(Expr{EXPR_VARIABLE, dataType});
+        variable->symbol = symbol;
+        return variable;
+    }
+
+    // An operation on two literals is folded into a literal
+    Expr *newBinary(TokenType op, TokenType dataType, Expr *left, Expr *right)
+    {
+        // Concatenation is associative, so (s + "a") + "b" is s + "ab" and the literals fold
+        if (dataType == T_STRING && op == T_PLUS && right->kind == EXPR_STRING &&
+            left->kind == EXPR_BINARY && left->op == T_PLUS && left->right->kind == EXPR_STRING)
+        {
+            ConstValue tail = foldBinary(op, literalValue(left->right), literalValue(right), arena);
+            if (tail.kind == CONST_STRING)
+                return newBinary(op, dataType, left->left, newString(tail.text));
+        }
+
+        ConstValue folded = foldBinary(op, literalValue(left), literalValue(right), arena);
+        if (folded.kind == CONST_INT)
+            return newNumber(folded.integer);
+        if (folded.kind == CONST_STRING)
+            return newString(folded.text);
+
+        Expr *binary = arena.make<Expr>(Expr{EXPR_BINARY, dataType, op});
+        binary->left = left;
+        binary->right = right;
+        return binary;
+    }
+
+    static ConstValue literalValue(const Expr *expression)
     {
-        cout << "ERROR => " << str << endl;
-        showErrorMessagesAndExit(args...);
+        if (expression->kind == EXPR_NUMBER)
+            return ConstValue::ofInt(expression->number);
+        if (expression->kind == EXPR_STRING)
+            return ConstValue::ofString(expression->text);
+        return ConstValue{};
     }
 
-    void showErrorMessagesAndExit(const string &str)
+    Stmt *newStatement(StmtKind kind)
+    {
+        Stmt *statement = arena.make<Stmt>(Stmt{kind});
+        statement->lineNumber = tokens.line(position);
+        return statement;
+    }
+
+    // Keywords starting a declaration and a statement with a body, plain tests so a Parser costs nothing to construct
+    static bool isDataType(TokenType type)
+    {
+        return type == T_INT || type == T_STRING || type == T_FLOAT || type == T_CHAR;
+    }
+
+    static bool isBlockStatement(TokenType type)
+    {
+        return type == T_IF || type == T_WHILE || type == T_FOR;
+    }
+
+    // Tokens only carry an interned view into the source, the parser copies out the text it keeps
+    string tokenText(size_t index) const
+    {
+        return string(tokens.text(index));
+    }
+
+    // Throws a CompileError carrying one "ERROR => " line per message
+    template <typename... Args>
+    [[noreturn]] void reportError(const Args &...messages)
     {
-        cout << "ERROR => " << str << endl;
-        exit(1);
+        string text;
+        for (const string &message : {string(messages)...})
+            text += (text.empty() ? "" : "\n") + string("ERROR => ") + message;
+        throw CompileError(text);
     }
 
     string getQuotesAroundStr(string text)
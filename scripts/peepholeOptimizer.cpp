@@ -0,0 +1,309 @@
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+using namespace std;
+
+/*
+Pattern-driven cleanup of generated assembly, run at -O1 before it is written.
+Patterns look at a window of neighbouring instructions and rely on register
+liveness, computed over the instruction list with labels and jumps as block
+boundaries, to know when a register (or the flags) is no longer needed:
+  MOV r, r                          -> removed
+  MOV a, b / MOV b, a               -> MOV a, b
+  MOV r, x / MOV y, r  (r dead)     -> MOV y, x
+  MOV r, x / OP y, r   (r dead)     -> OP y, x
+  SETcc / MOVZX r / CMP r, 0 / JNE  -> SETcc / MOVZX r / Jcc, and the
+                                       SETcc and MOVZX go too when r is dead
+  Jcc L1 / JMP L2 / L1:             -> J!cc L2 / L1:
+  JMP L / L:                        -> L:
+  PUSH x / POP r                    -> MOV r, x
+  MOV r, 0             (flags dead) -> XOR r, r
+  an instruction whose results are all dead -> removed
+*/
+class PeepholeOptimizer
+{
+public:
+    void run(vector<AsmInstruction> &code)
+    {
+        bool changed = true;
+        while (changed)
+        {
+            computeLiveness(code);
+            changed = false;
+            vector<AsmInstruction> result;
+            for (size_t i = 0; i < code.size(); i++)
+            {
+                size_t consumed = rewrite(code, i, result);
+                if (consumed != 0)
+                {
+                    i += consumed - 1;
+                    changed = true;
+                    continue;
+                }
+                result.push_back(code[i]);
+            }
+            code.swap(result);
+        }
+    }
+
+    static Condition negate(Condition condition)
+    {
+        switch (condition)
+        {
+        case COND_L:
+            return COND_GE;
+        case COND_G:
+            return COND_LE;
+        case COND_E:
+            return COND_NE;
+        case COND_NE:
+            return COND_E;
+        case COND_LE:
+            return COND_G;
+        case COND_GE:
+            return COND_L;
+        case COND_B:
+            return COND_AE;
+        case COND_AE:
+            return COND_B;
+        default:
+            return COND_NONE;
+        }
+    }
+
+private:
+    static constexpr uint32_t FLAGS = 1u << 16;
+    static constexpr uint32_t FRAME = (1u << RSP) | (1u << RBP); // Writes to these are never dead
+    static constexpr uint32_t argumentRegisters = (1u << RDI) | (1u << RSI) | (1u << RDX) | (1u << RCX) | (1u << R8) | (1u << R9);
+
+    vector<uint32_t> liveAfter; // Instruction -> registers (and FLAGS) live right after it
+
+    static uint32_t registersOf(const AsmOperand &operand)
+    {
+        return operand.kind == ASM_REGISTER || operand.kind == ASM_BYTE_REGISTER ? 1u << operand.value : 0;
+    }
+
+    static bool isMemory(const AsmOperand &operand)
+    {
+        return operand.kind == ASM_STACK || operand.kind == ASM_ELEMENT;
+    }
+
+    // Registers a memory operand is addressed through
+    static uint32_t addressRegisters(const AsmOperand &operand)
+    {
+        if (operand.kind == ASM_ELEMENT)
+            return (1u << RBP) | (1u << operand.index);
+        return operand.kind == ASM_STACK ? 1u << RBP : 0;
+    }
+
+    // Registers an instruction reads and writes
+    static void effects(const AsmInstruction &instr, uint32_t &uses, uint32_t &defs)
+    {
+        uint32_t dest = registersOf(instr.dest), src = registersOf(instr.src);
+        uses = src;
+        defs = 0;
+        switch (instr.op)
+        {
+        case ASM_MOV:
+        case ASM_MOVZX:
+        case ASM_LEA:
+            defs = dest;
+            break;
+        case ASM_XOR:
+            // XOR r, r only writes r
+            uses = instr.dest == instr.src ? 0 : uses | dest;
+            defs = dest | FLAGS;
+            break;
+        case ASM_ADD:
+        case ASM_SUB:
+        case ASM_IMUL:
+            uses |= dest;
+            defs = dest | FLAGS;
+            break;
+        case ASM_IDIV:
+            uses = dest | (1u << RAX) | (1u << RDX);
+            defs = (1u << RAX) | (1u << RDX) | FLAGS;
+            break;
+        case ASM_CQO:
+            uses = 1u << RAX;
+            defs = 1u << RDX;
+            break;
+        case ASM_CMP:
+        case ASM_TEST:
+            uses |= dest;
+            defs = FLAGS;
+            break;
+        case ASM_SETCC:
+            // Only the low byte is written, but generated code never reads the rest of the register after it
+            uses = FLAGS;
+            defs = dest;
+            break;
+        case ASM_JCC:
+            uses = FLAGS;
+            break;
+        case ASM_PUSH:
+            uses = dest;
+            break;
+        case ASM_POP:
+            defs = dest;
+            break;
+        case ASM_RET:
+            uses = (1u << RAX) | FRAME;
+            break;
+        case ASM_CALL:
+            // Runtime helpers take their arguments on the stack and preserve everything but RAX
+            defs = (1u << RAX) | FLAGS;
+            // A function takes them in registers and may change any register the System V ABI does not preserve
+            if (instr.dest.kind == ASM_FUNCTION)
+            {
+                uses = argumentRegisters;
+                defs = argumentRegisters | (1u << RAX) | (1u << RDX) | (1u << R10) | (1u << R11) | FLAGS;
+            }
+            break;
+        case ASM_SYSCALL:
+            // The generated code only makes syscalls with up to three arguments
+            uses = (1u << RAX) | (1u << RDI) | (1u << RSI) | (1u << RDX);
+            defs = (1u << RAX) | (1u << RCX) | (1u << R11);
+            break;
+        case ASM_REP_STOSQ:
+            uses = (1u << RAX) | (1u << RCX) | (1u << RDI);
+            defs = (1u << RCX) | (1u << RDI);
+            break;
+        default:
+            // Vector instructions only read general purpose registers, and vector registers are not tracked
+            break;
+        }
+        uses |= addressRegisters(instr.dest) | addressRegisters(instr.src);
+    }
+
+    void computeLiveness(const vector<AsmInstruction> &code)
+    {
+        size_t count = code.size();
+        unordered_map<int64_t, size_t> labels;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (code[i].op == ASM_DEFINE_LABEL)
+                labels[code[i].dest.value] = i;
+        }
+
+        vector<uint32_t> liveBefore(count + 1, 0);
+        liveAfter.assign(count, 0);
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (size_t i = count; i-- > 0;)
+            {
+                const AsmInstruction &instr = code[i];
+                uint32_t out = 0;
+                if (instr.op == ASM_JMP || instr.op == ASM_JCC)
+                {
+                    auto target = labels.find(instr.dest.value);
+                    out |= target == labels.end() ? ~0u : liveBefore[target->second];
+                }
+                if (instr.op != ASM_JMP && instr.op != ASM_RET)
+                    out |= liveBefore[i + 1];
+                uint32_t uses, defs;
+                effects(instr, uses, defs);
+                uint32_t in = uses | (out & ~defs);
+                if (out != liveAfter[i] || in != liveBefore[i])
+                {
+                    liveAfter[i] = out;
+                    liveBefore[i] = in;
+                    changed = true;
+                }
+            }
+        }
+    }
+
+    bool isDead(size_t index, uint32_t registers) const
+    {
+        return (registers & FRAME) == 0 && (liveAfter[index] & registers) == 0;
+    }
+
+    /*
+    Tries the patterns at code[i], appending replacement instructions to
+    `result`. Returns how many instructions of `code` were consumed, 0 when
+    nothing matched.
+    */
+    size_t rewrite(const vector<AsmInstruction> &code, size_t i, vector<AsmInstruction> &result) const
+    {
+        const AsmInstruction &instr = code[i];
+        const AsmInstruction *next = i + 1 < code.size() ? &code[i + 1] : nullptr;
+        uint32_t uses, defs;
+        effects(instr, uses, defs);
+
+        if (instr.op == ASM_MOV && instr.dest == instr.src)
+            return 1;
+
+        // Instructions without side effects whose results nobody reads
+        bool pure = instr.op == ASM_MOV || instr.op == ASM_MOVZX || instr.op == ASM_LEA || instr.op == ASM_ADD || instr.op == ASM_SUB ||
+                    instr.op == ASM_IMUL || instr.op == ASM_XOR || instr.op == ASM_CQO || instr.op == ASM_CMP ||
+                    instr.op == ASM_TEST || instr.op == ASM_SETCC;
+        if (pure && !isMemory(instr.dest) && defs != 0 && isDead(i, defs))
+            return 1;
+
+        // Values passed between registers through the stack, as arguments are
+        if (instr.op == ASM_PUSH && next != nullptr && next->op == ASM_POP)
+        {
+            result.push_back(AsmInstruction{ASM_MOV, next->dest, instr.dest});
+            return 2;
+        }
+
+        if (instr.op == ASM_JMP && next != nullptr && next->op == ASM_DEFINE_LABEL && next->dest == instr.dest)
+            return 1;
+
+        if (instr.op == ASM_JCC && next != nullptr && next->op == ASM_JMP && i + 2 < code.size() &&
+            code[i + 2].op == ASM_DEFINE_LABEL && code[i + 2].dest == instr.dest)
+        {
+            result.push_back(AsmInstruction{ASM_JCC, next->dest, {}, negate(instr.condition)});
+            return 2;
+        }
+
+        // Unless the first MOV changes the register the second one's memory operand is addressed through
+        if (instr.op == ASM_MOV && next != nullptr && next->op == ASM_MOV && next->dest == instr.src && next->src == instr.dest &&
+            (addressRegisters(instr.src) & registersOf(instr.dest)) == 0)
+        {
+            result.push_back(instr);
+            return 2;
+        }
+
+        // A register only used to carry a value into the next instruction
+        if (instr.op == ASM_MOV && instr.dest.kind == ASM_REGISTER && next != nullptr && next->src == instr.dest &&
+            next->dest != instr.dest && (addressRegisters(next->dest) & registersOf(instr.dest)) == 0 &&
+            isDead(i + 1, registersOf(instr.dest)) &&
+            (next->op == ASM_MOV || next->op == ASM_ADD || next->op == ASM_SUB || next->op == ASM_IMUL || next->op == ASM_CMP))
+        {
+            bool twoMemory = isMemory(next->dest) && isMemory(instr.src);
+            bool wideImmediate = instr.src.kind == ASM_IMMEDIATE && !fitsInt32(instr.src.value) &&
+                                 !(next->op == ASM_MOV && next->dest.kind == ASM_REGISTER);
+            bool memoryIntoImul = next->op == ASM_IMUL && isMemory(next->dest);
+            if (!twoMemory && !wideImmediate && !memoryIntoImul && instr.src.kind != ASM_STRING)
+            {
+                result.push_back(AsmInstruction{next->op, next->dest, instr.src, next->condition});
+                return 2;
+            }
+        }
+
+        // Branch on the flags of the comparison instead of on the boolean it produced
+        if (instr.op == ASM_SETCC && i + 3 < code.size() && code[i + 1].op == ASM_MOVZX &&
+            code[i + 1].src == instr.dest && code[i + 2].op == ASM_CMP && code[i + 2].dest == code[i + 1].dest &&
+            code[i + 2].src == immediate(0) && code[i + 3].op == ASM_JCC &&
+            (code[i + 3].condition == COND_NE || code[i + 3].condition == COND_E))
+        {
+            Condition condition = code[i + 3].condition == COND_NE ? instr.condition : negate(instr.condition);
+            result.push_back(instr);
+            result.push_back(code[i + 1]);
+            result.push_back(AsmInstruction{ASM_JCC, code[i + 3].dest, {}, condition});
+            return 4;
+        }
+
+        if (instr.op == ASM_MOV && instr.dest.kind == ASM_REGISTER && instr.src == immediate(0) && isDead(i, FLAGS))
+        {
+            result.push_back(AsmInstruction{ASM_XOR, instr.dest, instr.dest});
+            return 1;
+        }
+        return 0;
+    }
+};
@@ -0,0 +1,441 @@
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+
+using namespace std;
+
+/*
+Linear-scan register allocation (Poletto and Sarkar) over linear TAC.
+Liveness is solved on the control flow graph of the code. Every temp and
+variable then gets one live interval (a recycled temp gets one per value, see
+splitTemps), from the first to the last point where
+it is live. Instruction k reads its operands at 2k and writes its result at
+2k + 1, so a value whose last use is the instruction defining another can
+hand its register over. Intervals are taken in order of their start. Each one
+gets a free register, preferring the register of the copy it comes from so
+the move disappears. When none is free, the interval that ends last is
+spilled to a stack slot for its whole lifetime.
+A call clobbers the caller-saved registers, so for every call the allocator
+also lists the ones that hold a value living across it, for the caller to
+save around the call.
+*/
+class RegisterAllocator
+{
+public:
+    // Registers handed out, caller-saved ones first; RAX, RDX and R11 are kept as scratch registers
+    static constexpr Register allocatable[] = {RCX, RSI, RDI, R8, R9, R10, RBX, R12, R13, R14, R15};
+    static constexpr size_t callerSavedCount = 6; // allocatable[0..5] are not preserved by a call
+
+    int stackSlots = 0;
+
+    // Allocates locations for the names in `code`, which is then translated as instructions()
+    void allocate(const vector<TacInstruction> &code)
+    {
+        names.clear();
+        indexOf.clear();
+        locations.clear();
+        stackSlots = 0;
+        splitTemps(code);
+        ControlFlowGraph cfg(renamed);
+        for (const BasicBlock &block : cfg.blocks)
+        {
+            for (const TacInstruction &instr : block.instructions)
+            {
+                for (const TacOperand *operand : {&instr.dest, &instr.left, &instr.right})
+                {
+                    if (isNamedOperand(*operand))
+                        nameIndex(*operand);
+                }
+            }
+        }
+        intervals = buildIntervals(cfg);
+        scan();
+        findCallSaves(cfg);
+    }
+
+    // Register or stack slot holding a temp or variable
+    AsmOperand locationOf(const TacOperand &operand) const
+    {
+        return locations[indexOf.at(operandKey(operand))];
+    }
+
+    // The code that was allocated, with recycled temps renamed apart
+    const vector<TacInstruction> &instructions() const
+    {
+        return renamed;
+    }
+
+    // Whether the value of `operand` on entry to the code is read, as a parameter's is when it is used
+    bool isLiveOnEntry(const TacOperand &operand) const
+    {
+        auto index = indexOf.find(operandKey(operand));
+        return index != indexOf.end() && intervals[index->second].start == 0;
+    }
+
+    // Caller-saved registers holding a value that lives across the `call`th TAC_CALL of the code
+    const vector<Register> &savedAcross(size_t call) const
+    {
+        return callSaves[call];
+    }
+
+    // Callee-saved registers the code writes, which a function has to restore before it returns
+    vector<Register> calleeSavedUsed() const
+    {
+        vector<Register> used;
+        for (size_t i = callerSavedCount; i < size(allocatable); i++)
+        {
+            if (find(locations.begin(), locations.end(), registerOperand(allocatable[i])) != locations.end())
+                used.push_back(allocatable[i]);
+        }
+        return used;
+    }
+
+private:
+    struct Interval
+    {
+        int start = INT_MAX;
+        int end = -1;
+        int hint = -1; // Name this one is copied from
+    };
+
+    vector<TacOperand> names;
+    unordered_map<int64_t, int> indexOf; // Operand key -> index in names
+    vector<AsmOperand> locations;        // Name index -> where it lives
+    vector<TacInstruction> renamed;
+    vector<Interval> intervals;          // Name index -> live interval
+    vector<vector<Register>> callSaves;  // Call ordinal -> registers to save around it
+
+    /*
+    The intermediate code generator recycles temps, so one temp can hold many
+    short-lived values in turn, and a single interval would stretch across all
+    of them. A temp that is written before it is read in every block it is read
+    in never carries a value between blocks, so each of its definitions starts
+    a new value and is renamed to a fresh temp. Other temps keep their name.
+    */
+    void splitTemps(const vector<TacInstruction> &code)
+    {
+        renamed = code;
+        unordered_set<int64_t> crossesBlocks, written;
+        int64_t nextTemp = 0;
+        for (const TacInstruction &instr : code)
+        {
+            if (instr.op == TAC_LABEL)
+            {
+                written.clear();
+                continue;
+            }
+            for (const TacOperand *operand : {&instr.left, &instr.right, &instr.dest})
+            {
+                if (operand->kind == OPERAND_TEMP)
+                    nextTemp = max(nextTemp, operand->value + 1);
+            }
+            for (const TacOperand *operand : {&instr.left, &instr.right})
+            {
+                if (operand->kind == OPERAND_TEMP && !written.count(operand->value))
+                    crossesBlocks.insert(operand->value);
+            }
+            if (hasDestination(instr.op) && instr.dest.kind == OPERAND_TEMP)
+                written.insert(instr.dest.value);
+            if (ControlFlowGraph::isTerminator(instr.op))
+                written.clear();
+        }
+
+        unordered_map<int64_t, int64_t> current; // Temp -> name of the value it holds now
+        for (TacInstruction &instr : renamed)
+        {
+            for (TacOperand *operand : {&instr.left, &instr.right})
+            {
+                if (operand->kind == OPERAND_TEMP && !crossesBlocks.count(operand->value))
+                    operand->value = current.at(operand->value);
+            }
+            if (hasDestination(instr.op) && instr.dest.kind == OPERAND_TEMP && !crossesBlocks.count(instr.dest.value))
+            {
+                auto [it, first] = current.try_emplace(instr.dest.value, instr.dest.value);
+                if (!first)
+                    it->second = nextTemp++;
+                instr.dest.value = it->second;
+            }
+        }
+    }
+
+    int nameIndex(const TacOperand &operand)
+    {
+        auto [it, inserted] = indexOf.emplace(operandKey(operand), names.size());
+        if (inserted)
+            names.push_back(operand);
+        return it->second;
+    }
+
+    /*
+    Only names some block reads before writing them can be live on entry to a
+    block, so liveness is solved over those alone, as bitsets. A block is
+    solved again only when the live-in set of one of its successors changes.
+    Names live across a whole block need not be looked at there: an interval
+    reaches past the name's first and last occurrences only through a block
+    that jumps back to an earlier one, or one that only earlier blocks jump
+    from. Other blocks lie inside the interval either way.
+    */
+    vector<Interval> buildIntervals(const ControlFlowGraph &cfg)
+    {
+        size_t blockCount = cfg.blocks.size();
+
+        // Names each block reads before writing them, and names it writes
+        vector<vector<int>> uses(blockCount), defs(blockCount);
+        vector<int> written(names.size(), -1); // Name -> last block that wrote it
+        for (size_t b = 0; b < blockCount; b++)
+        {
+            for (const TacInstruction &instr : cfg.blocks[b].instructions)
+            {
+                for (const TacOperand *operand : {&instr.left, &instr.right})
+                {
+                    if (isNamedOperand(*operand) && written[indexOf[operandKey(*operand)]] != (int)b)
+                        uses[b].push_back(indexOf[operandKey(*operand)]);
+                }
+                if (hasDestination(instr.op) && written[indexOf[operandKey(instr.dest)]] != (int)b)
+                {
+                    written[indexOf[operandKey(instr.dest)]] = b;
+                    defs[b].push_back(indexOf[operandKey(instr.dest)]);
+                }
+            }
+        }
+
+        // Bit of each name that may be live on entry to a block, -1 for the others
+        vector<int> bitOf(names.size(), -1);
+        vector<int> nameOfBit;
+        for (const vector<int> &read : uses)
+        {
+            for (int name : read)
+            {
+                if (bitOf[name] == -1)
+                {
+                    bitOf[name] = nameOfBit.size();
+                    nameOfBit.push_back(name);
+                }
+            }
+        }
+        size_t words = (nameOfBit.size() + 63) / 64;
+        auto liveOutOf = [&](const vector<vector<uint64_t>> &liveIn, size_t b, vector<uint64_t> &out)
+        {
+            out.assign(words, 0);
+            for (int successor : cfg.blocks[b].successors)
+            {
+                for (size_t w = 0; w < words; w++)
+                    out[w] |= liveIn[successor][w];
+            }
+        };
+
+        vector<vector<uint64_t>> liveIn(blockCount, vector<uint64_t>(words));
+        vector<int> worklist;
+        vector<bool> queued(blockCount, true);
+        for (size_t b = 0; b < blockCount; b++)
+            worklist.push_back(b);
+        vector<uint64_t> in;
+        while (!worklist.empty())
+        {
+            int b = worklist.back();
+            worklist.pop_back();
+            queued[b] = false;
+            // in = uses | (out & ~defs)
+            liveOutOf(liveIn, b, in);
+            for (int name : defs[b])
+            {
+                if (bitOf[name] != -1)
+                    in[bitOf[name] / 64] &= ~(1ull << (bitOf[name] % 64));
+            }
+            for (int name : uses[b])
+                in[bitOf[name] / 64] |= 1ull << (bitOf[name] % 64);
+            if (in == liveIn[b])
+                continue;
+            liveIn[b].swap(in);
+            for (int predecessor : cfg.blocks[b].predecessors)
+            {
+                if (!queued[predecessor])
+                {
+                    queued[predecessor] = true;
+                    worklist.push_back(predecessor);
+                }
+            }
+        }
+
+        vector<Interval> intervals(names.size());
+        auto extend = [&](int name, int position)
+        {
+            intervals[name].start = min(intervals[name].start, position);
+            intervals[name].end = max(intervals[name].end, position);
+        };
+        auto extendAll = [&](const vector<uint64_t> &set, int position)
+        {
+            for (size_t w = 0; w < words; w++)
+            {
+                for (uint64_t bits = set[w]; bits != 0; bits &= bits - 1)
+                    extend(nameOfBit[w * 64 + __builtin_ctzll(bits)], position);
+            }
+        };
+
+        int position = 0; // Index of the next instruction, labels excluded
+        vector<uint64_t> out;
+        for (size_t b = 0; b < blockCount; b++)
+        {
+            const BasicBlock &block = cfg.blocks[b];
+            const vector<TacInstruction> &code = block.instructions;
+            bool jumpsBack = any_of(block.successors.begin(), block.successors.end(), [&](int successor)
+                                    { return successor <= (int)b; });
+            bool noEarlierPredecessor = none_of(block.predecessors.begin(), block.predecessors.end(), [&](int predecessor)
+                                            { return predecessor < (int)b; });
+            if (jumpsBack || noEarlierPredecessor)
+            {
+                extendAll(liveIn[b], 2 * position);
+                liveOutOf(liveIn, b, out);
+                extendAll(out, 2 * (position + (int)code.size()) - 1);
+            }
+            for (const TacInstruction &instr : code)
+            {
+                for (const TacOperand *operand : {&instr.left, &instr.right})
+                {
+                    if (isNamedOperand(*operand))
+                        extend(indexOf[operandKey(*operand)], 2 * position);
+                }
+                if (hasDestination(instr.op))
+                {
+                    int dest = indexOf[operandKey(instr.dest)];
+                    extend(dest, 2 * position + 1);
+                    if (instr.op == TAC_COPY && isNamedOperand(instr.left))
+                        intervals[dest].hint = indexOf[operandKey(instr.left)];
+                }
+                position++;
+            }
+        }
+        return intervals;
+    }
+
+    void scan()
+    {
+        vector<int> order;
+        for (size_t i = 0; i < intervals.size(); i++)
+        {
+            if (intervals[i].end >= 0)
+                order.push_back(i);
+        }
+        sort(order.begin(), order.end(), [&](int a, int b)
+             { return intervals[a].start != intervals[b].start ? intervals[a].start < intervals[b].start : a < b; });
+
+        vector<int> registerOf(names.size(), -1);
+        vector<int> slotOf(names.size(), -1);
+        bool isFree[16] = {};
+        for (Register reg : allocatable)
+            isFree[reg] = true;
+        vector<int> active; // Names holding a register, by increasing end
+
+        for (int current : order)
+        {
+            const Interval &interval = intervals[current];
+            while (!active.empty() && intervals[active.front()].end < interval.start)
+            {
+                isFree[registerOf[active.front()]] = true;
+                active.erase(active.begin());
+            }
+
+            int reg = -1;
+            if (interval.hint != -1 && registerOf[interval.hint] != -1 && isFree[registerOf[interval.hint]])
+                reg = registerOf[interval.hint];
+            for (size_t i = 0; reg == -1 && i < size(allocatable); i++)
+            {
+                if (isFree[allocatable[i]])
+                    reg = allocatable[i];
+            }
+            if (reg == -1)
+            {
+                // Spill whichever of the current interval and the active ones lives longest
+                int victim = active.back();
+                if (intervals[victim].end <= interval.end)
+                {
+                    slotOf[current] = stackSlots++;
+                    continue;
+                }
+                reg = registerOf[victim];
+                registerOf[victim] = -1;
+                slotOf[victim] = stackSlots++;
+                active.pop_back();
+            }
+
+            registerOf[current] = reg;
+            isFree[reg] = false;
+            auto position = upper_bound(active.begin(), active.end(), current, [&](int a, int b)
+                                        { return intervals[a].end < intervals[b].end; });
+            active.insert(position, current);
+        }
+
+        locations.assign(names.size(), AsmOperand{});
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            if (registerOf[i] != -1)
+                locations[i] = registerOperand((Register)registerOf[i]);
+            else if (slotOf[i] != -1)
+                locations[i] = AsmOperand{ASM_STACK, slotOf[i]};
+        }
+    }
+
+    /*
+    A value needs saving when it is live both before a call (read at 2k) and
+    after it has returned (2k + 2 on). Calls and register intervals are swept
+    together in order of position: an interval joins a heap by end once it has
+    started, and leaves it once it ends before the call being looked at, which
+    then has to save the registers of what is left.
+    */
+    void findCallSaves(const ControlFlowGraph &cfg)
+    {
+        callSaves.clear();
+        vector<int> calls; // Position of each call
+        int position = 0;
+        for (const BasicBlock &block : cfg.blocks)
+        {
+            for (const TacInstruction &instr : block.instructions)
+            {
+                if (instr.op == TAC_CALL)
+                    calls.push_back(position);
+                position++;
+            }
+        }
+        if (calls.empty())
+            return;
+
+        vector<int> starting; // Names in registers, by start
+        for (size_t i = 0; i < names.size(); i++)
+        {
+            if (locations[i].kind == ASM_REGISTER)
+                starting.push_back(i);
+        }
+        sort(starting.begin(), starting.end(), [&](int a, int b)
+             { return intervals[a].start < intervals[b].start; });
+
+        auto laterEnd = [&](int a, int b)
+        { return intervals[a].end > intervals[b].end; };
+        vector<int> started; // Min-heap by end
+        int holding[16] = {}; // Register -> intervals in started that it holds
+        size_t next = 0;
+        for (int call : calls)
+        {
+            for (; next < starting.size() && intervals[starting[next]].start <= 2 * call; next++)
+            {
+                started.push_back(starting[next]);
+                push_heap(started.begin(), started.end(), laterEnd);
+                holding[locations[starting[next]].value]++;
+            }
+            while (!started.empty() && intervals[started.front()].end < 2 * call + 2)
+            {
+                holding[locations[started.front()].value]--;
+                pop_heap(started.begin(), started.end(), laterEnd);
+                started.pop_back();
+            }
+            callSaves.emplace_back();
+            for (size_t r = 0; r < callerSavedCount; r++)
+            {
+                if (holding[allocatable[r]] > 0)
+                    callSaves.back().push_back(allocatable[r]);
+            }
+        }
+    }
+};
@@ -0,0 +1,84 @@
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/*
+Owns the bytes of a source file for the whole compilation.
+Regular files are memory-mapped read-only so the lexer can hand out views into
+the file without copying it; anything that cannot be mapped (pipes, empty files)
+is read into an owned string instead. Tokens keep string_views into this buffer,
+so a SourceFile must outlive every token produced from it.
+*/
+class SourceFile
+{
+public:
+    explicit SourceFile(const string &fileName)
+    {
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            throw runtime_error("Error: Could not open file " + fileName);
+        }
+
+        struct stat info;
+        if (fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0)
+        {
+            void *mapped = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped != MAP_FAILED)
+            {
+                // The lexer walks the buffer front to back exactly once
+                madvise(mapped, info.st_size, MADV_SEQUENTIAL);
+                mappedData = static_cast<const char *>(mapped);
+                mappedSize = info.st_size;
+            }
+        }
+        close(fd);
+
+        if (mappedData == nullptr)
+        {
+            ifstream inputFile(fileName);
+            if (!inputFile.is_open())
+            {
+                throw runtime_error("Error: Could not open file " + fileName);
+            }
+            stringstream buffer;
+            buffer << inputFile.rdbuf();
+            ownedData = buffer.str();
+        }
+    }
+
+    SourceFile(const SourceFile &) = delete;
+    SourceFile &operator=(const SourceFile &) = delete;
+
+    ~SourceFile()
+    {
+        if (mappedData != nullptr)
+            munmap(const_cast<char *>(mappedData), mappedSize);
+    }
+
+    string_view view() const
+    {
+        if (mappedData != nullptr)
+            return string_view(mappedData, mappedSize);
+        return string_view(ownedData);
+    }
+
+    bool isMapped() const
+    {
+        return mappedData != nullptr;
+    }
+
+private:
+    const char *mappedData = nullptr;
+    size_t mappedSize = 0;
+    string ownedData;
+};
@@ -0,0 +1,1334 @@
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
+#include <cstdint>
+
+using namespace std;
+
+/*
+Optimizer behind -O1.
+The control flow graph is put into SSA form, with phis at the dominance
+frontiers of every name that is live across blocks. It is then optimized by
+sparse conditional constant propagation, copy propagation, global value
+numbering, loop-invariant code motion, induction-variable strength reduction
+and dead-code elimination, and turned back into plain TAC by replacing every phi with copies
+at the end of its predecessors. Versions of a variable `x` are named `x#1`,
+`x#2`, ...; temps are single-assignment already and only get a fresh temp when
+one is written twice.
+*/
+class SsaOptimizer
+{
+public:
+    SsaOptimizer(ControlFlowGraph &cfg, IntermediateCodeGenerator &icg) : cfg(cfg), icg(icg) {}
+
+    void run()
+    {
+        constructSsa();
+        propagateConstants();
+        propagateCopies();
+        numberValues();
+        optimizeLoops();
+        eliminateDeadCode();
+        destructSsa();
+    }
+
+    // Folds `left op right` for integer operands, false if the result is only known at run time
+    static bool foldBinary(TacOpcode op, int64_t left, int64_t right, int64_t &result)
+    {
+        // Arithmetic wraps around like the 64-bit registers the program runs in
+        uint64_t a = left, b = right;
+        switch (op)
+        {
+        case TAC_ADD:
+            result = (int64_t)(a + b);
+            return true;
+        case TAC_SUB:
+            result = (int64_t)(a - b);
+            return true;
+        case TAC_MUL:
+            result = (int64_t)(a * b);
+            return true;
+        case TAC_DIV:
+            // Both of these trap at run time, so they stay in the code
+            if (right == 0 || (left == INT64_MIN && right == -1))
+                return false;
+            result = left / right;
+            return true;
+        case TAC_LT:
+            result = left < right;
+            return true;
+        case TAC_GT:
+            result = left > right;
+            return true;
+        case TAC_EQ:
+            result = left == right;
+            return true;
+        case TAC_NEQ:
+            result = left != right;
+            return true;
+        case TAC_LE:
+            result = left <= right;
+            return true;
+        case TAC_GE:
+            result = left >= right;
+            return true;
+        default:
+            return false;
+        }
+    }
+
+private:
+    enum LatticeState : uint8_t
+    {
+        LATTICE_UNKNOWN,  // No executable definition seen yet
+        LATTICE_CONSTANT, // Always `value`
+        LATTICE_VARYING,  // Not a compile-time constant
+    };
+
+    struct LatticeValue
+    {
+        LatticeState state = LATTICE_UNKNOWN;
+        int64_t value = 0;     // Integer, or string constant id when isString
+        bool isString = false; // Pool ids are interned, so equal ids are equal strings
+    };
+
+    // Where an SSA value is defined or used: an instruction index, or -1 - index for a phi
+    struct Site
+    {
+        int block;
+        int index;
+    };
+
+    ControlFlowGraph &cfg;
+    IntermediateCodeGenerator &icg;
+    unordered_map<int64_t, int> versionCounts; // Variable id -> versions handed out so far
+    unordered_set<int64_t> definedTemps;
+
+    // ---------------------------------------------------------------- SSA construction
+
+    void constructSsa()
+    {
+        // Phis cannot go in the entry block, so it must not be a join point
+        if (!cfg.blocks[0].predecessors.empty())
+        {
+            cfg.blocks.insert(cfg.blocks.begin(), cfg.newBlock());
+            cfg.computeEdges();
+        }
+        cfg.computeDominators();
+        vector<vector<int>> frontiers = dominanceFrontiers();
+
+        // Only names read in some block before being written there can need a phi
+        unordered_map<int64_t, TacOperand> globalNames;
+        unordered_map<int64_t, vector<int>> definingBlocks;
+        for (size_t b = 0; b < cfg.blocks.size(); b++)
+        {
+            unordered_set<int64_t> written;
+            for (const TacInstruction &instr : cfg.blocks[b].instructions)
+            {
+                for (const TacOperand *operand : {&instr.left, &instr.right})
+                {
+                    if (isNamedOperand(*operand) && !written.count(operandKey(*operand)))
+                        globalNames[operandKey(*operand)] = *operand;
+                }
+                if (hasDestination(instr.op) && written.insert(operandKey(instr.dest)).second)
+                    definingBlocks[operandKey(instr.dest)].push_back(b);
+            }
+        }
+
+        // Sorted so that phis, and the names they get, do not depend on hash order
+        vector<pair<int64_t, TacOperand>> names(globalNames.begin(), globalNames.end());
+        sort(names.begin(), names.end(), [](const auto &a, const auto &b)
+             { return a.first < b.first; });
+
+        vector<size_t> placed(cfg.blocks.size(), 0), queued(cfg.blocks.size(), 0); // Stamped with name index + 1
+        for (size_t n = 0; n < names.size(); n++)
+        {
+            auto defs = definingBlocks.find(names[n].first);
+            if (defs == definingBlocks.end())
+                continue;
+            size_t stamp = n + 1;
+            vector<int> worklist = defs->second;
+            for (int block : worklist)
+                queued[block] = stamp;
+            while (!worklist.empty())
+            {
+                int block = worklist.back();
+                worklist.pop_back();
+                for (int frontier : frontiers[block])
+                {
+                    if (placed[frontier] == stamp)
+                        continue;
+                    placed[frontier] = stamp;
+                    PhiNode phi{names[n].second, names[n].second, {}};
+                    for (int predecessor : cfg.blocks[frontier].predecessors)
+                        phi.arguments.push_back(PhiArgument{cfg.blocks[predecessor].id, names[n].second});
+                    cfg.blocks[frontier].phis.push_back(phi);
+                    if (queued[frontier] != stamp)
+                    {
+                        queued[frontier] = stamp;
+                        worklist.push_back(frontier);
+                    }
+                }
+            }
+        }
+        renameValues();
+    }
+
+    vector<vector<int>> dominanceFrontiers() const
+    {
+        vector<vector<int>> frontiers(cfg.blocks.size());
+        for (size_t b = 0; b < cfg.blocks.size(); b++)
+        {
+            const vector<int> &predecessors = cfg.blocks[b].predecessors;
+            if (predecessors.size() < 2)
+                continue;
+            for (int runner : predecessors)
+            {
+                for (; runner != -1 && runner != cfg.immediateDominators[b]; runner = cfg.immediateDominators[runner])
+                {
+                    if (frontiers[runner].empty() || frontiers[runner].back() != (int)b)
+                        frontiers[runner].push_back(b);
+                }
+            }
+        }
+        return frontiers;
+    }
+
+    TacOperand newVersion(const TacOperand &name)
+    {
+        if (name.kind == OPERAND_TEMP)
+            return definedTemps.insert(name.value).second ? name : icg.newTemp();
+        int version = ++versionCounts[name.value];
+        return icg.variable(icg.variableNames[name.value] + "#" + to_string(version));
+    }
+
+    // Walks the dominator tree giving every definition a new name and pointing uses at the one that reaches them
+    void renameValues()
+    {
+        vector<vector<int>> children = cfg.dominatorTree();
+        unordered_map<int64_t, vector<TacOperand>> versions; // Name -> stack of versions in scope
+        auto current = [&](const TacOperand &operand)
+        {
+            if (!isNamedOperand(operand))
+                return operand;
+            auto it = versions.find(operandKey(operand));
+            // A read nothing defines keeps the original name, its value is whatever is in memory
+            return it == versions.end() || it->second.empty() ? operand : it->second.back();
+        };
+
+        struct Frame
+        {
+            int block;
+            size_t nextChild;
+            vector<int64_t> pushed; // Names whose stacks this block pushed onto
+        };
+        vector<Frame> stack;
+        auto enter = [&](int b)
+        {
+            stack.push_back(Frame{b, 0, {}});
+            vector<int64_t> &pushed = stack.back().pushed;
+            auto define = [&](TacOperand &dest)
+            {
+                int64_t key = operandKey(dest);
+                dest = newVersion(dest);
+                versions[key].push_back(dest);
+                pushed.push_back(key);
+            };
+
+            BasicBlock &block = cfg.blocks[b];
+            for (PhiNode &phi : block.phis)
+                define(phi.dest);
+            for (TacInstruction &instr : block.instructions)
+            {
+                instr.left = current(instr.left);
+                instr.right = current(instr.right);
+                if (hasDestination(instr.op))
+                    define(instr.dest);
+            }
+            for (int successor : block.successors)
+            {
+                for (PhiNode &phi : cfg.blocks[successor].phis)
+                {
+                    for (PhiArgument &argument : phi.arguments)
+                    {
+                        if (argument.block == block.id)
+                            argument.value = current(phi.original);
+                    }
+                }
+            }
+        };
+
+        enter(0);
+        while (!stack.empty())
+        {
+            Frame &frame = stack.back();
+            if (frame.nextChild < children[frame.block].size())
+            {
+                enter(children[frame.block][frame.nextChild++]);
+                continue;
+            }
+            for (int64_t key : frame.pushed)
+                versions[key].pop_back();
+            stack.pop_back();
+        }
+    }
+
+    // Recomputes edges after jumps changed, dropping unreachable blocks and phi arguments of vanished edges
+    void refreshEdges()
+    {
+        cfg.computeEdges();
+        cfg.removeUnreachableBlocks();
+        for (BasicBlock &block : cfg.blocks)
+        {
+            if (block.phis.empty())
+                continue;
+            unordered_set<int> predecessorIds;
+            for (int predecessor : block.predecessors)
+                predecessorIds.insert(cfg.blocks[predecessor].id);
+            for (PhiNode &phi : block.phis)
+            {
+                auto &arguments = phi.arguments;
+                arguments.erase(remove_if(arguments.begin(), arguments.end(), [&](const PhiArgument &argument)
+                                          { return !predecessorIds.count(argument.block); }),
+                                arguments.end());
+            }
+        }
+    }
+
+    // ---------------------------------------------------------------- Constant propagation
+
+    /*
+    Sparse conditional constant propagation (Wegman and Zadeck).
+    Blocks only become executable when an executable branch can reach them, so
+    constants flowing into a branch decide which way it goes and code behind a
+    branch that is never taken does not pollute the values of the phis it reaches.
+    */
+    void propagateConstants()
+    {
+        size_t blockCount = cfg.blocks.size();
+        unordered_map<int64_t, LatticeValue> lattice;
+        unordered_map<int64_t, vector<Site>> uses;
+        unordered_map<int, int> blockIndex; // Block id -> index
+        for (size_t b = 0; b < blockCount; b++)
+        {
+            const BasicBlock &block = cfg.blocks[b];
+            blockIndex[block.id] = b;
+            for (size_t i = 0; i < block.phis.size(); i++)
+            {
+                lattice[operandKey(block.phis[i].dest)] = LatticeValue{};
+                for (const PhiArgument &argument : block.phis[i].arguments)
+                {
+                    if (isNamedOperand(argument.value))
+                        uses[operandKey(argument.value)].push_back(Site{(int)b, -1 - (int)i});
+                }
+            }
+            for (size_t i = 0; i < block.instructions.size(); i++)
+            {
+                const TacInstruction &instr = block.instructions[i];
+                for (const TacOperand *operand : {&instr.left, &instr.right})
+                {
+                    if (isNamedOperand(*operand))
+                        uses[operandKey(*operand)].push_back(Site{(int)b, (int)i});
+                }
+                if (hasDestination(instr.op))
+                    lattice[operandKey(instr.dest)] = LatticeValue{};
+            }
+        }
+
+        vector<bool> executable(blockCount, false);
+        unordered_set<int64_t> executableEdges;
+        vector<pair<int, int>> flowWorklist = {{-1, 0}};
+        vector<int64_t> ssaWorklist;
+
+        auto valueOf = [&](const TacOperand &operand)
+        {
+            if (operand.kind == OPERAND_IMM || operand.kind == OPERAND_STR)
+                return LatticeValue{LATTICE_CONSTANT, operand.value, operand.kind == OPERAND_STR};
+            auto it = isNamedOperand(operand) ? lattice.find(operandKey(operand)) : lattice.end();
+            // Names nothing defines are never folded
+            return it == lattice.end() ? LatticeValue{LATTICE_VARYING, 0} : it->second;
+        };
+        auto update = [&](const TacOperand &dest, LatticeValue value)
+        {
+            LatticeValue &old = lattice[operandKey(dest)];
+            if (old.state != value.state || old.value != value.value || old.isString != value.isString)
+            {
+                old = value;
+                ssaWorklist.push_back(operandKey(dest));
+            }
+        };
+        auto addEdge = [&](int from, int to)
+        {
+            if (to < (int)blockCount)
+                flowWorklist.push_back({from, to});
+        };
+        auto evaluatePhi = [&](int b, int index)
+        {
+            const PhiNode &phi = cfg.blocks[b].phis[index];
+            LatticeValue result;
+            for (const PhiArgument &argument : phi.arguments)
+            {
+                if (!executableEdges.count((int64_t)blockIndex[argument.block] * blockCount + b))
+                    continue;
+                result = meet(result, valueOf(argument.value));
+            }
+            update(phi.dest, result);
+        };
+        auto evaluateInstruction = [&](int b, int index)
+        {
+            const TacInstruction &instr = cfg.blocks[b].instructions[index];
+            switch (instr.op)
+            {
+            case TAC_GOTO:
+                addEdge(b, cfg.blockOfLabel(instr.dest.value));
+                break;
+            case TAC_RETURN:
+            case TAC_ARG:
+            case TAC_STORE_ELEMENT:
+            case TAC_CLEAR:
+                break;
+            // Array memory is not tracked, so an element is as unknown as a call's result
+            case TAC_CALL:
+            case TAC_LOAD_ELEMENT:
+                update(instr.dest, LatticeValue{LATTICE_VARYING, 0});
+                break;
+            default:
+                if (isVectorOpcode(instr.op))
+                    break;
+                if (isConditionalBranch(instr.op))
+                {
+                    LatticeValue left = valueOf(instr.left), right = valueOf(instr.right);
+                    int64_t taken = 0;
+                    bool known = left.state == LATTICE_CONSTANT && right.state == LATTICE_CONSTANT &&
+                                 !left.isString && !right.isString && foldBinary(comparisonOfBranch(instr.op), left.value, right.value, taken);
+                    bool varying = left.state == LATTICE_VARYING || right.state == LATTICE_VARYING;
+                    if (varying || (known && taken))
+                        addEdge(b, cfg.blockOfLabel(instr.dest.value));
+                    if (varying || (known && !taken))
+                        addEdge(b, b + 1);
+                    break;
+                }
+                update(instr.dest, evaluate(instr, valueOf(instr.left), valueOf(instr.right)));
+            }
+        };
+
+        while (!flowWorklist.empty() || !ssaWorklist.empty())
+        {
+            if (!flowWorklist.empty())
+            {
+                auto [from, to] = flowWorklist.back();
+                flowWorklist.pop_back();
+                if (from != -1 && !executableEdges.insert((int64_t)from * blockCount + to).second)
+                    continue;
+                for (size_t i = 0; i < cfg.blocks[to].phis.size(); i++)
+                    evaluatePhi(to, i);
+                if (executable[to])
+                    continue;
+                executable[to] = true;
+                const vector<TacInstruction> &code = cfg.blocks[to].instructions;
+                for (size_t i = 0; i < code.size(); i++)
+                    evaluateInstruction(to, i);
+                if (code.empty() || !ControlFlowGraph::isTerminator(code.back().op))
+                    addEdge(to, to + 1);
+                continue;
+            }
+
+            int64_t key = ssaWorklist.back();
+            ssaWorklist.pop_back();
+            for (const Site &site : uses[key])
+            {
+                if (!executable[site.block])
+                    continue;
+                if (site.index < 0)
+                    evaluatePhi(site.block, -1 - site.index);
+                else
+                    evaluateInstruction(site.block, site.index);
+            }
+        }
+
+        // Rewrite constants into the code and resolve branches that always go the same way
+        auto constantOf = [&](TacOperand &operand)
+        {
+            LatticeValue value = valueOf(operand);
+            if (isNamedOperand(operand) && value.state == LATTICE_CONSTANT)
+                operand = constantOperand(value);
+        };
+        for (size_t b = 0; b < blockCount; b++)
+        {
+            BasicBlock &block = cfg.blocks[b];
+            if (!executable[b])
+                continue;
+            for (PhiNode &phi : block.phis)
+            {
+                for (PhiArgument &argument : phi.arguments)
+                    constantOf(argument.value);
+            }
+            for (TacInstruction &instr : block.instructions)
+            {
+                if (hasDestination(instr.op) && valueOf(instr.dest).state == LATTICE_CONSTANT)
+                {
+                    instr = TacInstruction{TAC_COPY, instr.dest, constantOperand(valueOf(instr.dest))};
+                    continue;
+                }
+                constantOf(instr.left);
+                constantOf(instr.right);
+            }
+            if (block.instructions.empty())
+                continue;
+            TacInstruction &last = block.instructions.back();
+            int64_t taken = 0;
+            if (isConditionalBranch(last.op) && last.left.kind == OPERAND_IMM && last.right.kind == OPERAND_IMM &&
+                foldBinary(comparisonOfBranch(last.op), last.left.value, last.right.value, taken))
+            {
+                if (taken)
+                    last = TacInstruction{TAC_GOTO, last.dest};
+                else
+                    block.instructions.pop_back();
+            }
+        }
+        refreshEdges();
+    }
+
+    static LatticeValue meet(LatticeValue a, LatticeValue b)
+    {
+        if (a.state == LATTICE_UNKNOWN)
+            return b;
+        if (b.state == LATTICE_UNKNOWN)
+            return a;
+        if (a.state == LATTICE_CONSTANT && b.state == LATTICE_CONSTANT && a.value == b.value && a.isString == b.isString)
+            return a;
+        return LatticeValue{LATTICE_VARYING, 0};
+    }
+
+    static TacOperand constantOperand(const LatticeValue &value)
+    {
+        return value.isString ? TacOperand{OPERAND_STR, value.value} : immediateOperand(value.value);
+    }
+
+    // Concatenations of two known strings become a new pool constant, bounded like the parser's folding
+    LatticeValue evaluate(const TacInstruction &instr, LatticeValue left, LatticeValue right)
+    {
+        if (instr.op == TAC_COPY)
+            return left;
+        if (left.state == LATTICE_VARYING || right.state == LATTICE_VARYING)
+            return LatticeValue{LATTICE_VARYING, 0};
+        if (left.state == LATTICE_UNKNOWN || right.state == LATTICE_UNKNOWN)
+            return LatticeValue{};
+        if (instr.op == TAC_CONCAT)
+        {
+            if (!left.isString || !right.isString)
+                return LatticeValue{LATTICE_VARYING, 0};
+            const string &head = icg.strings[left.value], &tail = icg.strings[right.value];
+            if (head.size() + tail.size() > maxFoldedStringLength)
+                return LatticeValue{LATTICE_VARYING, 0};
+            return LatticeValue{LATTICE_CONSTANT, icg.strings.intern(head + tail), true};
+        }
+        if (left.isString || right.isString)
+            return LatticeValue{LATTICE_VARYING, 0};
+        int64_t result;
+        if (!foldBinary(instr.op, left.value, right.value, result))
+            return LatticeValue{LATTICE_VARYING, 0};
+        return LatticeValue{LATTICE_CONSTANT, result};
+    }
+
+    // ---------------------------------------------------------------- Copy propagation
+
+    // Replaces every use of `x = y` by y, and of phis whose arguments all agree by that argument
+    void propagateCopies()
+    {
+        unordered_map<int64_t, TacOperand> replacements;
+        auto resolve = [&](const TacOperand &operand)
+        {
+            return resolveReplacement(operand, replacements);
+        };
+
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (const BasicBlock &block : cfg.blocks)
+            {
+                for (const PhiNode &phi : block.phis)
+                {
+                    if (replacements.count(operandKey(phi.dest)))
+                        continue;
+                    TacOperand same;
+                    bool unique = true;
+                    for (const PhiArgument &argument : phi.arguments)
+                    {
+                        TacOperand value = resolve(argument.value);
+                        if (value == phi.dest)
+                            continue;
+                        if (same.kind == OPERAND_NONE)
+                            same = value;
+                        else if (value != same)
+                            unique = false;
+                    }
+                    if (unique && same.kind != OPERAND_NONE)
+                    {
+                        replacements[operandKey(phi.dest)] = same;
+                        changed = true;
+                    }
+                }
+                for (const TacInstruction &instr : block.instructions)
+                {
+                    if (instr.op != TAC_COPY || replacements.count(operandKey(instr.dest)))
+                        continue;
+                    TacOperand value = resolve(instr.left);
+                    if (value != instr.dest)
+                    {
+                        replacements[operandKey(instr.dest)] = value;
+                        changed = true;
+                    }
+                }
+            }
+        }
+        replaceValues(replacements);
+    }
+
+    static TacOperand resolveReplacement(TacOperand operand, const unordered_map<int64_t, TacOperand> &replacements)
+    {
+        while (isNamedOperand(operand))
+        {
+            auto it = replacements.find(operandKey(operand));
+            if (it == replacements.end())
+                break;
+            operand = it->second;
+        }
+        return operand;
+    }
+
+    // Drops the definitions of replaced values and points all their uses at the replacement
+    void replaceValues(const unordered_map<int64_t, TacOperand> &replacements)
+    {
+        if (replacements.empty())
+            return;
+        for (BasicBlock &block : cfg.blocks)
+        {
+            auto &phis = block.phis;
+            phis.erase(remove_if(phis.begin(), phis.end(), [&](const PhiNode &phi)
+                                 { return replacements.count(operandKey(phi.dest)) > 0; }),
+                       phis.end());
+            for (PhiNode &phi : phis)
+            {
+                for (PhiArgument &argument : phi.arguments)
+                    argument.value = resolveReplacement(argument.value, replacements);
+            }
+
+            auto &code = block.instructions;
+            code.erase(remove_if(code.begin(), code.end(), [&](const TacInstruction &instr)
+                                 { return hasDestination(instr.op) && replacements.count(operandKey(instr.dest)) > 0; }),
+                       code.end());
+            for (TacInstruction &instr : code)
+            {
+                instr.left = resolveReplacement(instr.left, replacements);
+                instr.right = resolveReplacement(instr.right, replacements);
+            }
+        }
+    }
+
+    // ---------------------------------------------------------------- Value numbering
+
+    struct Expression
+    {
+        TacOpcode op;
+        TacOperand left;
+        TacOperand right;
+
+        bool operator==(const Expression &other) const
+        {
+            return op == other.op && left == other.left && right == other.right;
+        }
+    };
+
+    struct ExpressionHash
+    {
+        size_t operator()(const Expression &expression) const
+        {
+            uint64_t hash = expression.op;
+            hash = hash * 0x9E3779B97F4A7C15ull + (uint64_t)operandKey(expression.left);
+            hash = hash * 0x9E3779B97F4A7C15ull + (uint64_t)operandKey(expression.right);
+            return hash ^ (hash >> 29);
+        }
+    };
+
+    static bool isCommutative(TacOpcode op)
+    {
+        return op == TAC_ADD || op == TAC_MUL || op == TAC_EQ || op == TAC_NEQ;
+    }
+
+    /*
+    Dominator-tree global value numbering.
+    Walking the dominator tree keeps a scoped table from expressions to the
+    value that first computed them; in SSA an earlier computation in a
+    dominating block is available unchanged, so a repeat is replaced by it.
+    Phis in the same block with identical arguments are merged as well.
+    */
+    void numberValues()
+    {
+        cfg.computeDominators();
+        vector<vector<int>> children = cfg.dominatorTree();
+        unordered_map<int64_t, TacOperand> replacements;
+        unordered_map<Expression, TacOperand, ExpressionHash> available;
+
+        struct Frame
+        {
+            int block;
+            size_t nextChild;
+            vector<Expression> added; // Entries to drop from `available` when leaving the subtree
+        };
+        vector<Frame> stack;
+        auto enter = [&](int b)
+        {
+            stack.push_back(Frame{b, 0, {}});
+            BasicBlock &block = cfg.blocks[b];
+            for (size_t i = 0; i < block.phis.size(); i++)
+            {
+                for (size_t j = 0; j < i; j++)
+                {
+                    if (!replacements.count(operandKey(block.phis[j].dest)) && samePhiArguments(block.phis[i], block.phis[j], replacements))
+                    {
+                        replacements[operandKey(block.phis[i].dest)] = block.phis[j].dest;
+                        break;
+                    }
+                }
+            }
+            for (TacInstruction &instr : block.instructions)
+            {
+                instr.left = resolveReplacement(instr.left, replacements);
+                instr.right = resolveReplacement(instr.right, replacements);
+                // Two calls with the same arguments are not the same value, the callee may have computed anything,
+                // and neither are two loads of an element, a store may come between them
+                if (!hasDestination(instr.op) || instr.op == TAC_COPY || instr.op == TAC_CALL || accessesMemory(instr.op))
+                    continue;
+                Expression expression{instr.op, instr.left, instr.right};
+                if (isCommutative(instr.op) && operandKey(expression.right) < operandKey(expression.left))
+                    swap(expression.left, expression.right);
+                auto [it, inserted] = available.emplace(expression, instr.dest);
+                if (inserted)
+                    stack.back().added.push_back(expression);
+                else
+                    replacements[operandKey(instr.dest)] = it->second;
+            }
+        };
+
+        enter(0);
+        while (!stack.empty())
+        {
+            Frame &frame = stack.back();
+            if (frame.nextChild < children[frame.block].size())
+            {
+                enter(children[frame.block][frame.nextChild++]);
+                continue;
+            }
+            for (const Expression &expression : frame.added)
+                available.erase(expression);
+            stack.pop_back();
+        }
+        replaceValues(replacements);
+    }
+
+    static bool samePhiArguments(const PhiNode &a, const PhiNode &b, const unordered_map<int64_t, TacOperand> &replacements)
+    {
+        if (a.arguments.size() != b.arguments.size())
+            return false;
+        for (const PhiArgument &argument : a.arguments)
+        {
+            auto other = find_if(b.arguments.begin(), b.arguments.end(), [&](const PhiArgument &candidate)
+                                 { return candidate.block == argument.block; });
+            if (other == b.arguments.end() ||
+                resolveReplacement(other->value, replacements) != resolveReplacement(argument.value, replacements))
+                return false;
+        }
+        return true;
+    }
+
+    // ---------------------------------------------------------------- Loop optimizations
+
+    struct Loop
+    {
+        int header;
+        vector<int> latches; // Blocks with a back edge to the header
+        vector<int> blocks;  // Body in reverse postorder, header first
+    };
+
+    // Loop optimization state. Definition sites are kept up to date as code moves
+    unordered_map<int64_t, Site> loopDefinitions; // Value -> where it is defined
+    vector<int> loopMarks;                        // Block -> stamp of the last loop it was found in
+    int loopStamp = 0;
+    unordered_map<int64_t, TacOperand> reducedValues; // Multiplies replaced by induction variables, applied once at the end
+
+    // Value -> where it is defined, for every phi and instruction
+    unordered_map<int64_t, Site> definitionSites() const
+    {
+        unordered_map<int64_t, Site> definitions;
+        for (size_t b = 0; b < cfg.blocks.size(); b++)
+            recordDefinitions(b, definitions);
+        return definitions;
+    }
+
+    // Records where each value defined in block b is, after code in it moved
+    void recordDefinitions(int b, unordered_map<int64_t, Site> &definitions) const
+    {
+        const BasicBlock &block = cfg.blocks[b];
+        for (size_t i = 0; i < block.phis.size(); i++)
+            definitions[operandKey(block.phis[i].dest)] = Site{b, -1 - (int)i};
+        for (size_t i = 0; i < block.instructions.size(); i++)
+        {
+            if (hasDestination(block.instructions[i].op))
+                definitions[operandKey(block.instructions[i].dest)] = Site{b, (int)i};
+        }
+    }
+
+    // Makes `loop` the one inLoop answers for
+    void markLoop(const Loop &loop)
+    {
+        loopStamp++;
+        for (int b : loop.blocks)
+            loopMarks[b] = loopStamp;
+    }
+
+    bool inLoop(int block) const
+    {
+        return loopMarks[block] == loopStamp;
+    }
+
+    /*
+    Loop-invariant code motion and strength reduction on natural loops.
+    A loop is found from each back edge (an edge into a block that dominates
+    its source). Inner loops are handled first, so code hoisted out of them
+    can move further out of the enclosing loop.
+    */
+    void optimizeLoops()
+    {
+        insertPreheaders();
+        cfg.computeDominators();
+        vector<Loop> loops = findLoops();
+        sort(loops.begin(), loops.end(), [](const Loop &a, const Loop &b)
+             { return a.blocks.size() < b.blocks.size(); });
+        loopDefinitions = definitionSites();
+        for (const Loop &loop : loops)
+        {
+            markLoop(loop);
+            int preheader = preheaderOf(loop);
+            if (preheader == -1)
+                continue;
+            hoistInvariants(loop, preheader);
+            reduceInductionVariables(loop, preheader);
+        }
+        replaceValues(reducedValues);
+        loopDefinitions.clear();
+        reducedValues.clear();
+    }
+
+    vector<Loop> findLoops()
+    {
+        vector<Loop> loops;
+        unordered_map<int, size_t> loopOfHeader;
+        for (int b : cfg.reversePostorder)
+        {
+            for (int successor : cfg.blocks[b].successors)
+            {
+                if (!cfg.dominates(successor, b))
+                    continue;
+                auto [it, inserted] = loopOfHeader.emplace(successor, loops.size());
+                if (inserted)
+                    loops.push_back(Loop{successor, {}, {}});
+                loops[it->second].latches.push_back(b);
+            }
+        }
+
+        // Bodies are collected under a stamp of their own, so no loop needs a set as large as the graph
+        loopMarks.assign(cfg.blocks.size(), 0);
+        vector<int> order(cfg.blocks.size()); // Block -> position in reversePostorder
+        for (size_t i = 0; i < cfg.reversePostorder.size(); i++)
+            order[cfg.reversePostorder[i]] = i;
+        for (Loop &loop : loops)
+        {
+            // The body is everything that reaches a latch without going through the header
+            loopStamp++;
+            loopMarks[loop.header] = loopStamp;
+            loop.blocks.push_back(loop.header);
+            vector<int> worklist;
+            for (int latch : loop.latches)
+            {
+                if (!inLoop(latch))
+                {
+                    loopMarks[latch] = loopStamp;
+                    loop.blocks.push_back(latch);
+                    worklist.push_back(latch);
+                }
+            }
+            while (!worklist.empty())
+            {
+                int block = worklist.back();
+                worklist.pop_back();
+                for (int predecessor : cfg.blocks[block].predecessors)
+                {
+                    if (!inLoop(predecessor))
+                    {
+                        loopMarks[predecessor] = loopStamp;
+                        loop.blocks.push_back(predecessor);
+                        worklist.push_back(predecessor);
+                    }
+                }
+            }
+            sort(loop.blocks.begin(), loop.blocks.end(), [&](int a, int b)
+                 { return order[a] < order[b]; });
+        }
+        return loops;
+    }
+
+    // The single block entering the loop from outside, if it has no other successor
+    int preheaderOf(const Loop &loop) const
+    {
+        int outside = -1;
+        for (int predecessor : cfg.blocks[loop.header].predecessors)
+        {
+            if (inLoop(predecessor))
+                continue;
+            if (outside != -1)
+                return -1;
+            outside = predecessor;
+        }
+        return outside != -1 && cfg.blocks[outside].successors.size() == 1 ? outside : -1;
+    }
+
+    /*
+    Gives a loop header entered by a branch its own preheader block, placed
+    right before the header. Headers where that would change what falls
+    through into them are left alone, and so are headers entered from several
+    places, whose preheader would need phis of its own.
+    */
+    void insertPreheaders()
+    {
+        cfg.computeDominators();
+        size_t blockCount = cfg.blocks.size();
+        vector<int> entering(blockCount, -1); // Header -> branch entering it that needs a preheader
+        bool needed = false;
+        for (size_t h = 1; h < blockCount; h++)
+        {
+            const vector<int> &predecessors = cfg.blocks[h].predecessors;
+            int outside = -1, outsideCount = 0;
+            bool isHeader = false;
+            for (int predecessor : predecessors)
+            {
+                if (cfg.dominates(h, predecessor))
+                    isHeader = true;
+                else
+                {
+                    outside = predecessor;
+                    outsideCount++;
+                }
+            }
+            if (!isHeader || outsideCount != 1 || cfg.blocks[outside].successors.size() < 2)
+                continue;
+            const vector<TacInstruction> &before = cfg.blocks[h - 1].instructions;
+            bool fallsIn = before.empty() || (before.back().op != TAC_GOTO && before.back().op != TAC_RETURN);
+            if (outside == (int)h - 1 || !fallsIn)
+            {
+                entering[h] = outside;
+                needed = true;
+            }
+        }
+        if (!needed)
+            return;
+
+        vector<BasicBlock> laidOut;
+        for (size_t h = 0; h < blockCount; h++)
+        {
+            if (entering[h] != -1)
+            {
+                BasicBlock preheader = cfg.newBlock();
+                BasicBlock &branch = cfg.blocks[entering[h]];
+                if (entering[h] != (int)h - 1)
+                {
+                    preheader.label = cfg.newLabel();
+                    branch.instructions.back().dest.value = preheader.label;
+                }
+                for (PhiNode &phi : cfg.blocks[h].phis)
+                {
+                    for (PhiArgument &argument : phi.arguments)
+                    {
+                        if (argument.block == branch.id)
+                            argument.block = preheader.id;
+                    }
+                }
+                laidOut.push_back(move(preheader));
+            }
+            laidOut.push_back(move(cfg.blocks[h]));
+        }
+        cfg.blocks.swap(laidOut);
+        cfg.computeEdges();
+    }
+
+    /*
+    Moves computations whose operands do not change inside the loop to the end
+    of the preheader. One pass in reverse postorder is enough: in SSA form a
+    value is defined before every use it dominates, so by the time an
+    instruction is reached, the ones computing its operands have already moved.
+    */
+    void hoistInvariants(const Loop &loop, int preheader)
+    {
+        auto isInvariant = [&](const TacOperand &operand)
+        {
+            if (!isNamedOperand(operand))
+                return true;
+            auto definition = loopDefinitions.find(operandKey(operand));
+            return definition == loopDefinitions.end() || !inLoop(definition->second.block);
+        };
+
+        vector<TacInstruction> hoisted;
+        for (int b : loop.blocks)
+        {
+            vector<TacInstruction> &code = cfg.blocks[b].instructions;
+            vector<TacInstruction> remaining;
+            for (const TacInstruction &instr : code)
+            {
+                // A division may trap, so it only moves when its divisor is known to be safe
+                // A load may trap too, and the loop may store to its element, so it stays
+                if (!hasDestination(instr.op) || instr.op == TAC_CALL || accessesMemory(instr.op) || mayTrap(instr) || !isInvariant(instr.left) ||
+                    !isInvariant(instr.right))
+                {
+                    remaining.push_back(instr);
+                    continue;
+                }
+                loopDefinitions[operandKey(instr.dest)] = Site{preheader, 0};
+                hoisted.push_back(instr);
+            }
+            if (remaining.size() != code.size())
+            {
+                code.swap(remaining);
+                recordDefinitions(b, loopDefinitions);
+            }
+        }
+        if (hoisted.empty())
+            return;
+        vector<TacInstruction> &code = cfg.blocks[preheader].instructions;
+        auto position = !code.empty() && isJumpOpcode(code.back().op) ? code.end() - 1 : code.end();
+        code.insert(position, hoisted.begin(), hoisted.end());
+        recordDefinitions(preheader, loopDefinitions);
+    }
+
+    /*
+    Strength reduction of `j = i * k` where i is a basic induction variable
+    (a header phi stepped by a constant once per iteration) and k is a
+    constant. j gets an induction variable of its own, started at
+    start * k in the preheader and stepped by step * k next to i, and the
+    multiply becomes a use of it.
+    */
+    void reduceInductionVariables(const Loop &loop, int preheader)
+    {
+        if (loop.latches.size() != 1)
+            return;
+        BasicBlock &header = cfg.blocks[loop.header];
+        int preheaderId = cfg.blocks[preheader].id;
+        int latchId = cfg.blocks[loop.latches[0]].id;
+        const unordered_map<int64_t, Site> &definitions = loopDefinitions;
+
+        struct Induction
+        {
+            TacOperand start;
+            int64_t step;
+            Site update; // Instruction computing the next value
+        };
+        unordered_map<int64_t, Induction> inductions;
+        for (const PhiNode &phi : header.phis)
+        {
+            if (phi.arguments.size() != 2)
+                continue;
+            TacOperand start, next;
+            for (const PhiArgument &argument : phi.arguments)
+            {
+                if (argument.block == preheaderId)
+                    start = argument.value;
+                else if (argument.block == latchId)
+                    next = argument.value;
+            }
+            auto definition = isNamedOperand(next) ? definitions.find(operandKey(next)) : definitions.end();
+            if (start.kind == OPERAND_NONE || definition == definitions.end() || definition->second.index < 0 ||
+                !inLoop(definition->second.block))
+                continue;
+            const TacInstruction &update = cfg.blocks[definition->second.block].instructions[definition->second.index];
+            if (update.op == TAC_ADD && update.left == phi.dest && update.right.kind == OPERAND_IMM)
+                inductions[operandKey(phi.dest)] = Induction{start, update.right.value, definition->second};
+            else if (update.op == TAC_ADD && update.right == phi.dest && update.left.kind == OPERAND_IMM)
+                inductions[operandKey(phi.dest)] = Induction{start, update.left.value, definition->second};
+            else if (update.op == TAC_SUB && update.left == phi.dest && update.right.kind == OPERAND_IMM)
+                inductions[operandKey(phi.dest)] = Induction{start, (int64_t)(0 - (uint64_t)update.right.value), definition->second};
+        }
+        if (inductions.empty())
+            return;
+
+        vector<pair<Site, TacInstruction>> steps; // Instructions to add right after an update
+        for (int b : loop.blocks)
+        {
+            for (const TacInstruction &instr : cfg.blocks[b].instructions)
+            {
+                if (instr.op != TAC_MUL)
+                    continue;
+                TacOperand variable = instr.left, factor = instr.right;
+                if (factor.kind != OPERAND_IMM)
+                    swap(variable, factor);
+                auto induction = isNamedOperand(variable) ? inductions.find(operandKey(variable)) : inductions.end();
+                if (factor.kind != OPERAND_IMM || induction == inductions.end() || reducedValues.count(operandKey(instr.dest)))
+                    continue;
+
+                int64_t scale = factor.value;
+                const Induction &base = induction->second;
+                TacOperand start;
+                int64_t folded;
+                if (base.start.kind == OPERAND_IMM && foldBinary(TAC_MUL, base.start.value, scale, folded))
+                    start = immediateOperand(folded);
+                else
+                {
+                    start = icg.newTemp();
+                    appendInstruction(cfg.blocks[preheader], TacInstruction{TAC_MUL, start, base.start, factor});
+                }
+                TacOperand current = icg.newTemp(), next = icg.newTemp();
+                foldBinary(TAC_MUL, base.step, scale, folded);
+                header.phis.push_back(PhiNode{current, current, {{preheaderId, start}, {latchId, next}}});
+                steps.push_back({base.update, TacInstruction{TAC_ADD, next, current, immediateOperand(folded)}});
+                reducedValues[operandKey(instr.dest)] = current;
+            }
+        }
+
+        // Later positions first, so earlier insertions do not shift them
+        sort(steps.begin(), steps.end(), [](const auto &a, const auto &b)
+             { return a.first.block != b.first.block ? a.first.block < b.first.block : a.first.index > b.first.index; });
+        for (const auto &[site, instr] : steps)
+        {
+            vector<TacInstruction> &code = cfg.blocks[site.block].instructions;
+            code.insert(code.begin() + site.index + 1, instr);
+        }
+        // The multiplies themselves go in one sweep once every loop is done
+        for (const auto &[site, instr] : steps)
+            recordDefinitions(site.block, loopDefinitions);
+        recordDefinitions(loop.header, loopDefinitions);
+        recordDefinitions(preheader, loopDefinitions);
+    }
+
+    // Adds `instr` to the end of `block`, ahead of its closing jump
+    static void appendInstruction(BasicBlock &block, const TacInstruction &instr)
+    {
+        vector<TacInstruction> &code = block.instructions;
+        auto position = code.end();
+        if (!code.empty() && isJumpOpcode(code.back().op))
+            position--;
+        code.insert(position, instr);
+    }
+
+    // ---------------------------------------------------------------- Dead-code elimination
+
+    // A division by zero, or of INT64_MIN by -1, stops the program, so it is kept unless its divisor is known to be safe
+    // An element load out of bounds does too, so it is kept unless its index is a constant in range
+    bool mayTrap(const TacInstruction &instr) const
+    {
+        if (instr.op == TAC_LOAD_ELEMENT)
+            return instr.right.kind != OPERAND_IMM || instr.right.value < 0 || instr.right.value >= icg.arrayLengths[instr.left.value];
+        return instr.op == TAC_DIV && (instr.right.kind != OPERAND_IMM || instr.right.value == 0 || instr.right.value == -1);
+    }
+
+    // Keeps only values that a branch, return, call or possible trap depends on, nothing else has side effects
+    void eliminateDeadCode()
+    {
+        unordered_map<int64_t, Site> definitions = definitionSites();
+        unordered_set<int64_t> live;
+        vector<int64_t> worklist;
+        auto markLive = [&](const TacOperand &operand)
+        {
+            if (isNamedOperand(operand) && live.insert(operandKey(operand)).second)
+                worklist.push_back(operandKey(operand));
+        };
+        for (const BasicBlock &block : cfg.blocks)
+        {
+            for (const TacInstruction &instr : block.instructions)
+            {
+                if (hasSideEffects(instr.op) || mayTrap(instr))
+                {
+                    markLive(instr.left);
+                    markLive(instr.right);
+                }
+            }
+        }
+        while (!worklist.empty())
+        {
+            auto definition = definitions.find(worklist.back());
+            worklist.pop_back();
+            if (definition == definitions.end())
+                continue;
+            const Site &site = definition->second;
+            if (site.index < 0)
+            {
+                for (const PhiArgument &argument : cfg.blocks[site.block].phis[-1 - site.index].arguments)
+                    markLive(argument.value);
+            }
+            else
+            {
+                markLive(cfg.blocks[site.block].instructions[site.index].left);
+                markLive(cfg.blocks[site.block].instructions[site.index].right);
+            }
+        }
+
+        for (BasicBlock &block : cfg.blocks)
+        {
+            auto &phis = block.phis;
+            phis.erase(remove_if(phis.begin(), phis.end(), [&](const PhiNode &phi)
+                                 { return !live.count(operandKey(phi.dest)); }),
+                       phis.end());
+            auto &code = block.instructions;
+            code.erase(remove_if(code.begin(), code.end(), [&](const TacInstruction &instr)
+                                 { return !hasSideEffects(instr.op) && !mayTrap(instr) && !live.count(operandKey(instr.dest)); }),
+                       code.end());
+        }
+    }
+
+    // ---------------------------------------------------------------- Leaving SSA
+
+    void destructSsa()
+    {
+        splitCriticalEdges();
+        for (BasicBlock &block : cfg.blocks)
+        {
+            if (block.phis.empty())
+                continue;
+            for (int predecessor : block.predecessors)
+            {
+                vector<pair<TacOperand, TacOperand>> copies; // Destination, source
+                for (const PhiNode &phi : block.phis)
+                {
+                    for (const PhiArgument &argument : phi.arguments)
+                    {
+                        if (argument.block == cfg.blocks[predecessor].id && argument.value != phi.dest)
+                            copies.push_back({phi.dest, argument.value});
+                    }
+                }
+                insertCopies(cfg.blocks[predecessor], copies);
+            }
+            block.phis.clear();
+        }
+        cfg.computeEdges();
+    }
+
+    /*
+    Gives every edge from a branch into a block with phis a block of its own,
+    so the copies for that edge do not run on the branch's other path.
+    */
+    void splitCriticalEdges()
+    {
+        size_t blockCount = cfg.blocks.size();
+        vector<BasicBlock> splits;
+        vector<int> fallthroughSplits(blockCount, -1); // Block -> split placed right after it
+        vector<int> jumpSplits;                        // Splits placed after all other blocks
+        for (size_t b = 0; b < blockCount; b++)
+        {
+            if (cfg.blocks[b].successors.size() < 2)
+                continue;
+            int jumpTarget = cfg.blockOfLabel(cfg.blocks[b].instructions.back().dest.value);
+            for (int target : cfg.blocks[b].successors)
+            {
+                if (cfg.blocks[target].phis.empty())
+                    continue;
+                BasicBlock split = cfg.newBlock();
+                split.instructions.push_back(TacInstruction{TAC_GOTO, TacOperand{OPERAND_LABEL, cfg.labelOf(target)}});
+                for (PhiNode &phi : cfg.blocks[target].phis)
+                {
+                    for (PhiArgument &argument : phi.arguments)
+                    {
+                        if (argument.block == cfg.blocks[b].id)
+                            argument.block = split.id;
+                    }
+                }
+                if (target == jumpTarget)
+                {
+                    split.label = cfg.newLabel();
+                    cfg.blocks[b].instructions.back().dest.value = split.label;
+                    jumpSplits.push_back(splits.size());
+                }
+                else
+                {
+                    fallthroughSplits[b] = splits.size();
+                }
+                splits.push_back(move(split));
+            }
+        }
+        if (splits.empty())
+            return;
+
+        vector<BasicBlock> laidOut;
+        for (size_t b = 0; b < blockCount; b++)
+        {
+            laidOut.push_back(move(cfg.blocks[b]));
+            if (fallthroughSplits[b] != -1)
+                laidOut.push_back(move(splits[fallthroughSplits[b]]));
+        }
+        if (!jumpSplits.empty())
+        {
+            // The program may run off the end of its last block, which must not land in a split
+            const vector<TacInstruction> &last = laidOut.back().instructions;
+            if (last.empty() || (last.back().op != TAC_GOTO && last.back().op != TAC_RETURN))
+            {
+                BasicBlock exit = cfg.newBlock();
+                exit.label = cfg.newLabel();
+                BasicBlock jump = cfg.newBlock();
+                jump.instructions.push_back(TacInstruction{TAC_GOTO, TacOperand{OPERAND_LABEL, exit.label}});
+                laidOut.push_back(move(jump));
+                for (int split : jumpSplits)
+                    laidOut.push_back(move(splits[split]));
+                laidOut.push_back(move(exit));
+            }
+            else
+            {
+                for (int split : jumpSplits)
+                    laidOut.push_back(move(splits[split]));
+            }
+        }
+        cfg.blocks.swap(laidOut);
+        cfg.computeEdges();
+    }
+
+    // Places a parallel copy at the end of `block`, ahead of its closing jump
+    void insertCopies(BasicBlock &block, vector<pair<TacOperand, TacOperand>> copies)
+    {
+        // Emit a copy once nothing still pending reads its destination; a cycle is broken by saving one destination in a temp
+        vector<TacInstruction> code;
+        while (!copies.empty())
+        {
+            size_t ready = 0;
+            for (; ready < copies.size(); ready++)
+            {
+                bool read = false;
+                for (const auto &other : copies)
+                    read = read || other.second == copies[ready].first;
+                if (!read)
+                    break;
+            }
+            if (ready == copies.size())
+            {
+                TacOperand temp = icg.newTemp();
+                code.push_back(TacInstruction{TAC_COPY, temp, copies[0].first});
+                for (auto &other : copies)
+                {
+                    if (other.second == copies[0].first)
+                        other.second = temp;
+                }
+                ready = 0;
+            }
+            code.push_back(TacInstruction{TAC_COPY, copies[ready].first, copies[ready].second});
+            copies.erase(copies.begin() + ready);
+        }
+        if (code.empty())
+            return;
+
+        vector<TacInstruction> &instructions = block.instructions;
+        // With critical edges split a branch here has both ways leading to the same block
+        if (!instructions.empty() && isConditionalBranch(instructions.back().op))
+            instructions.pop_back();
+        auto position = instructions.end();
+        if (!instructions.empty() && instructions.back().op == TAC_GOTO)
+            position--;
+        instructions.insert(position, code.begin(), code.end());
+    }
+};
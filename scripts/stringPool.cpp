@@ -0,0 +1,92 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+
+using namespace std;
+
+/*
+The program's string constants, each stored once. Operands refer to a
+constant by its id, so equal constants are also equal operands, which is what
+lets the optimizer compare and fold them. The generated code sees the pool as
+one read-only blob of NUL-terminated strings addressed by offset, in which a
+constant that ends another one ("Jawad" in "My name is Jawad") shares its bytes.
+*/
+class StringPool
+{
+public:
+    // Id of `text`, adding it on first use
+    uint32_t intern(string_view text)
+    {
+        auto [it, inserted] = ids.try_emplace(string(text), (uint32_t)texts.size());
+        if (inserted)
+            texts.push_back(it->first);
+        return it->second;
+    }
+
+    const string &operator[](size_t id) const
+    {
+        return texts[id];
+    }
+
+    size_t size() const
+    {
+        return texts.size();
+    }
+
+    bool empty() const
+    {
+        return texts.empty();
+    }
+
+    const vector<string> &values() const
+    {
+        return texts;
+    }
+
+    /*
+    Lays the constants marked in `used` out as a single blob and returns it,
+    `offsets[id]` being where constant `id` starts. Sorting the constants by
+    their reversed text puts each one just before the constants it is a suffix
+    of, so one pass from the back finds every constant that can live inside
+    the tail of another.
+    */
+    string layout(const vector<bool> &used, vector<size_t> &offsets) const
+    {
+        vector<uint32_t> order;
+        for (uint32_t id = 0; id < texts.size(); id++)
+        {
+            if (used[id])
+                order.push_back(id);
+        }
+        sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+             { return lexicographical_compare(texts[a].rbegin(), texts[a].rend(), texts[b].rbegin(), texts[b].rend()); });
+
+        string blob;
+        offsets.assign(texts.size(), 0);
+        for (size_t i = order.size(); i-- > 0;)
+        {
+            const string &text = texts[order[i]];
+            if (i + 1 < order.size() && endsWith(texts[order[i + 1]], text))
+            {
+                const string &container = texts[order[i + 1]];
+                offsets[order[i]] = offsets[order[i + 1]] + container.size() - text.size();
+                continue;
+            }
+            offsets[order[i]] = blob.size();
+            blob += text;
+            blob += '\0';
+        }
+        return blob;
+    }
+
+private:
+    vector<string> texts;                // id -> text
+    unordered_map<string, uint32_t> ids; // text -> id
+
+    static bool endsWith(const string &text, const string &suffix)
+    {
+        return text.size() >= suffix.size() && text.compare(text.size() - suffix.size(), suffix.size(), suffix) == 0;
+    }
+};
@@ -1,57 +1,241 @@
-#include <map>
 #include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
 
 using namespace std;
 
+struct Symbol
+{
+    uint32_t nameId;    // Interned id of the identifier
+    string_view name;   // Source name, points into the token stream's interner
+    string icgName;     // Name used in the generated code, unique per declaration
+    Token value;        // Declared type and last known value
+    size_t scopeDepth;
+    uint32_t shadowed;       // Binding of the same name hidden by this one, NO_SYMBOL if none
+    int64_t arrayLength = 0; // Number of elements of an array, 0 for a scalar
+
+    bool isArray() const
+    {
+        return arrayLength > 0;
+    }
+};
+
+/*
+Symbol table indexed by interned identifier ids.
+Every declaration is appended to `symbols` and never removed, so references
+into it stay meaningful for the whole compilation. Visibility is tracked by an
+open-addressing table that maps an id to its innermost visible binding; each
+binding remembers the one it shadows, so leaving a scope just restores those.
+A function body gets a scope of its own in which the bindings declared before
+it are not visible, so functions only see their parameters and locals.
+*/
 class SymbolTable
 {
 public:
-    void declareVariable(const string &name, const Token &symbolInstance)
+    static constexpr uint32_t NO_SYMBOL = UINT32_MAX;
+
+    SymbolTable()
     {
-        if (symbolTable.find(name) != symbolTable.end())
+        slots.assign(64, Slot{EMPTY_KEY, NO_SYMBOL, 0});
+        enterScope(); // Global scope
+    }
+
+    void enterScope()
+    {
+        scopeStarts.push_back(activeBindings.size());
+    }
+
+    void exitScope()
+    {
+        size_t start = scopeStarts.back();
+        scopeStarts.pop_back();
+        while (activeBindings.size() > start)
         {
-            throw runtime_error("Semantic error: Variable '" + name + "' is already declared.");
+            const Symbol &symbol = symbols[activeBindings.back()];
+            findSlot(symbol.nameId)->binding = symbol.shadowed;
+            activeBindings.pop_back();
         }
-        symbolTable[name] = symbolInstance;
     }
 
-    void updateVariable(const string &name, const Token &symbolInstance)
+    // Opens the scope of a function's parameters and hides every binding declared so far
+    void enterFunction()
     {
-        if (symbolTable.find(name) == symbolTable.end())
+        enterScope();
+        firstVisible = symbols.size();
+    }
+
+    void exitFunction()
+    {
+        exitScope();
+        firstVisible = 0;
+    }
+
+    size_t scopeDepth() const
+    {
+        return scopeStarts.size() - 1;
+    }
+
+    // Returns the index of the new binding
+    uint32_t declareVariable(uint32_t nameId, string_view name, const Token &symbolInstance)
+    {
+        Slot *slot = findOrInsertSlot(nameId);
+        if (slot->binding != NO_SYMBOL && symbols[slot->binding].scopeDepth == scopeDepth())
         {
-            throw runtime_error("Semantic error: Variable '" + name + "' not declared.");
+            throw CompileError("Semantic error: Variable '" + string(name) + "' is already declared.");
         }
-        symbolTable[name] = symbolInstance;
+
+        // Later declarations of a name get a suffix so blocks never share storage in the generated code
+        string icgName(name);
+        if (slot->declarations > 0)
+            icgName += "." + to_string(slot->declarations);
+        slot->declarations++;
+
+        symbols.push_back(Symbol{nameId, name, icgName, symbolInstance, scopeDepth(), slot->binding});
+        slot->binding = symbols.size() - 1;
+        activeBindings.push_back(slot->binding);
+        return slot->binding;
+    }
+
+    // An array of `length` elements of `type`, which has no value of its own to track
+    uint32_t declareArray(uint32_t nameId, string_view name, TokenType type, int64_t length)
+    {
+        uint32_t index = declareVariable(nameId, name, Token{type});
+        symbols[index].arrayLength = length;
+        return index;
+    }
+
+    void updateVariable(uint32_t nameId, string_view name, const Token &symbolInstance)
+    {
+        getVariable(nameId, name).value = symbolInstance;
     }
 
-    Token getVariableToken(const string &name)
+    // Index of the visible binding of a name
+    uint32_t resolve(uint32_t nameId, string_view name) const
     {
-        if (symbolTable.find(name) == symbolTable.end())
+        uint32_t binding = lookup(nameId);
+        if (binding == NO_SYMBOL)
         {
-            throw runtime_error("Semantic error: Variable '" + name + "' is not declared.");
+            throw CompileError("Semantic error: Variable '" + string(name) + "' is not declared.");
         }
-        return symbolTable[name];
+        return binding;
+    }
+
+    // The returned reference is valid until the next declaration
+    Symbol &getVariable(uint32_t nameId, string_view name)
+    {
+        return symbols[resolve(nameId, name)];
     }
 
-    bool isDeclared(const string &name) const
+    const Symbol &symbolAt(uint32_t index) const
     {
-        return symbolTable.find(name) != symbolTable.end();
+        return symbols[index];
     }
 
-    void displaySymbolTable()
+    size_t size() const
     {
-        cout << "\n    << -----------------Symbol Table----------------- >>" << endl;
-        map<string, Token>::iterator it;
-        for (it = symbolTable.begin(); it != symbolTable.end(); it++)
+        return symbols.size();
+    }
+
+    bool isDeclared(uint32_t nameId) const
+    {
+        return lookup(nameId) != NO_SYMBOL;
+    }
+
+    void displaySymbolTable(ostream &out = cout) const
+    {
+        out << "\n    << -----------------Symbol Table----------------- >>" << endl;
+        for (const Symbol &symbol : symbols)
         {
-            cout << " \t "
-                 << "Type: " << getTokenName(it->second.type)
-                 << " \t " << "Symbol: " << it->first
-                 << " \t " << "Value: " << it->second.value << endl;
+            out << " \t "
+                 << "Type: " << getTokenName(symbol.value.type) << (symbol.isArray() ? "[" + to_string(symbol.arrayLength) + "]" : "")
+                 << " \t " << "Symbol: " << symbol.icgName
+                 << " \t " << "Scope: " << symbol.scopeDepth
+                 << " \t " << "Value: " << symbol.value.value.toString() << endl;
         }
-        cout << "    << ---------------------------------------------- >>" << endl;
+        out << "    << ---------------------------------------------- >>" << endl;
     }
 
 private:
-    map<string, Token> symbolTable;
+    static constexpr uint32_t EMPTY_KEY = UINT32_MAX;
+
+    struct Slot
+    {
+        uint32_t nameId;
+        uint32_t binding;      // Innermost visible binding, NO_SYMBOL when out of scope
+        uint32_t declarations; // How many times the name has been declared so far
+    };
+
+    vector<Symbol> symbols;         // Every binding, in declaration order
+    vector<Slot> slots;             // Open-addressing table keyed by name id, size is a power of two
+    size_t usedSlots = 0;           // Slots are never freed, a name stays in the table once seen
+    vector<uint32_t> activeBindings; // Bindings currently in scope, innermost last
+    vector<size_t> scopeStarts;      // activeBindings.size() when each open scope was entered
+    uint32_t firstVisible = 0;       // Bindings before this one are hidden inside a function
+
+    static size_t hashOf(uint32_t nameId)
+    {
+        // Ids are dense, a multiplicative hash spreads them over the table
+        return (nameId * 2654435769u) >> 7;
+    }
+
+    uint32_t lookup(uint32_t nameId) const
+    {
+        const Slot *slot = findSlot(nameId);
+        if (slot == nullptr || slot->binding == NO_SYMBOL || slot->binding < firstVisible)
+            return NO_SYMBOL;
+        return slot->binding;
+    }
+
+    const Slot *findSlot(uint32_t nameId) const
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t index = hashOf(nameId) & mask;; index = (index + 1) & mask)
+        {
+            if (slots[index].nameId == nameId)
+                return &slots[index];
+            if (slots[index].nameId == EMPTY_KEY)
+                return nullptr;
+        }
+    }
+
+    Slot *findSlot(uint32_t nameId)
+    {
+        return const_cast<Slot *>(static_cast<const SymbolTable *>(this)->findSlot(nameId));
+    }
+
+    Slot *findOrInsertSlot(uint32_t nameId)
+    {
+        if (Slot *slot = findSlot(nameId))
+            return slot;
+
+        // Keep the load factor under 1/2
+        if ((usedSlots + 1) * 2 > slots.size())
+            grow();
+
+        size_t mask = slots.size() - 1;
+        size_t index = hashOf(nameId) & mask;
+        while (slots[index].nameId != EMPTY_KEY)
+            index = (index + 1) & mask;
+        slots[index] = Slot{nameId, NO_SYMBOL, 0};
+        usedSlots++;
+        return &slots[index];
+    }
+
+    void grow()
+    {
+        vector<Slot> oldSlots(slots.size() * 2, Slot{EMPTY_KEY, NO_SYMBOL, 0});
+        oldSlots.swap(slots);
+        size_t mask = slots.size() - 1;
+        for (const Slot &slot : oldSlots)
+        {
+            if (slot.nameId == EMPTY_KEY)
+                continue;
+            size_t index = hashOf(slot.nameId) & mask;
+            while (slots[index].nameId != EMPTY_KEY)
+                index = (index + 1) & mask;
+            slots[index] = slot;
+        }
+    }
 };
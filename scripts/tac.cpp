@@ -0,0 +1,183 @@
+#include <cstdint>
+
+using namespace std;
+
+/*
+Three-address code is kept as typed quads: `dest = left op right`.
+Operands are a kind plus an integer, whose meaning depends on the kind:
+temp number, variable id, immediate value, string constant index, label number,
+function index, array id or vector register number. Names and string contents
+live in the IntermediateCodeGenerator that owns the code. A call is its
+arguments, each passed by a TAC_ARG in order, followed by the TAC_CALL itself.
+A vector register holds as many consecutive elements of an array as the code's
+vectorWidth. Vector registers are never live outside the loop that uses them,
+and the optimizer leaves them alone: vector instructions count as having no
+destination, so they are neither moved nor removed.
+*/
+enum TacOpcode : uint8_t
+{
+    TAC_COPY,          // dest = left
+    TAC_ADD,           // dest = left + right
+    TAC_SUB,           // dest = left - right
+    TAC_MUL,           // dest = left * right
+    TAC_DIV,           // dest = left / right
+    TAC_CONCAT,        // dest = left + right on strings
+    TAC_LT,            // dest = left < right
+    TAC_GT,            // dest = left > right
+    TAC_EQ,            // dest = left == right
+    TAC_NEQ,           // dest = left != right
+    TAC_LE,            // dest = left <= right
+    TAC_GE,            // dest = left >= right
+    TAC_IF_LT,         // if left < right goto dest
+    TAC_IF_GT,         // if left > right goto dest
+    TAC_IF_EQ,         // if left == right goto dest
+    TAC_IF_NEQ,        // if left != right goto dest
+    TAC_IF_LE,         // if left <= right goto dest
+    TAC_IF_GE,         // if left >= right goto dest
+    TAC_GOTO,          // goto dest
+    TAC_LABEL,         // dest:
+    TAC_RETURN,        // return left
+    TAC_ARG,           // pass left to the next call
+    TAC_CALL,          // dest = call left, right is the number of arguments
+    TAC_LOAD_ELEMENT,  // dest = left[right]
+    TAC_STORE_ELEMENT, // dest[left] = right
+    TAC_CLEAR,         // every element of dest = 0
+    TAC_VECTOR_LOAD,   // dest = left[right], left[right + 1], ... one element per lane
+    TAC_VECTOR_STORE,  // dest[left], dest[left + 1], ... = the lanes of right
+    TAC_VECTOR_SPLAT,  // dest = left in every lane
+    TAC_VECTOR_ADD,    // dest = left + right, lane by lane
+    TAC_VECTOR_SUB,    // dest = left - right, lane by lane
+};
+
+enum OperandKind : uint8_t
+{
+    OPERAND_NONE,
+    OPERAND_TEMP,
+    OPERAND_VAR,
+    OPERAND_IMM,
+    OPERAND_STR,
+    OPERAND_LABEL,
+    OPERAND_FUNCTION,
+    OPERAND_ARRAY,
+    OPERAND_VECTOR,
+};
+
+struct TacOperand
+{
+    OperandKind kind = OPERAND_NONE;
+    int64_t value = 0;
+
+    bool operator==(const TacOperand &other) const
+    {
+        return kind == other.kind && value == other.value;
+    }
+
+    bool operator!=(const TacOperand &other) const
+    {
+        return !(*this == other);
+    }
+};
+
+struct TacInstruction
+{
+    TacOpcode op;
+    TacOperand dest;
+    TacOperand left;
+    TacOperand right;
+};
+
+inline TacOperand immediateOperand(int64_t value)
+{
+    return TacOperand{OPERAND_IMM, value};
+}
+
+// Whether the instruction writes a value to `dest` (as opposed to jumps, labels, returns, arguments, stores and vector instructions)
+inline bool hasDestination(TacOpcode op)
+{
+    return op < TAC_IF_LT || op == TAC_CALL || op == TAC_LOAD_ELEMENT;
+}
+
+// Whether the instruction must stay even when nothing reads its result
+inline bool hasSideEffects(TacOpcode op)
+{
+    return !hasDestination(op) || op == TAC_CALL;
+}
+
+// Whether the instruction reads or writes array memory, which the optimizer does not track
+inline bool accessesMemory(TacOpcode op)
+{
+    return op >= TAC_LOAD_ELEMENT && op <= TAC_VECTOR_STORE;
+}
+
+inline bool isVectorOpcode(TacOpcode op)
+{
+    return op >= TAC_VECTOR_LOAD && op <= TAC_VECTOR_SUB;
+}
+
+// Temps and variables, the operands that name storage
+inline bool isNamedOperand(const TacOperand &operand)
+{
+    return operand.kind == OPERAND_TEMP || operand.kind == OPERAND_VAR;
+}
+
+/*
+Integer identifying a temp or variable operand, for use as a hash key. Other
+operands get a key too, computed without overflow, but large immediates may
+share it with another operand.
+*/
+inline int64_t operandKey(const TacOperand &operand)
+{
+    return (int64_t)((uint64_t)operand.value * 8 + operand.kind);
+}
+
+inline bool isArithmeticOpcode(TacOpcode op)
+{
+    return op == TAC_ADD || op == TAC_SUB || op == TAC_MUL || op == TAC_DIV;
+}
+
+inline bool isComparisonOpcode(TacOpcode op)
+{
+    return op >= TAC_LT && op <= TAC_GE;
+}
+
+// Compare-and-branch: if left relop right goto dest
+inline bool isConditionalBranch(TacOpcode op)
+{
+    return op >= TAC_IF_LT && op <= TAC_IF_GE;
+}
+
+inline bool isJumpOpcode(TacOpcode op)
+{
+    return op == TAC_GOTO || isConditionalBranch(op);
+}
+
+// Branch taken when the comparison `op` holds, and back
+inline TacOpcode branchOpcode(TacOpcode comparison)
+{
+    return (TacOpcode)(comparison - TAC_LT + TAC_IF_LT);
+}
+
+inline TacOpcode comparisonOfBranch(TacOpcode branch)
+{
+    return (TacOpcode)(branch - TAC_IF_LT + TAC_LT);
+}
+
+// Comparison that holds exactly when `op` does not
+inline TacOpcode negateComparison(TacOpcode op)
+{
+    switch (op)
+    {
+    case TAC_LT:
+        return TAC_GE;
+    case TAC_GT:
+        return TAC_LE;
+    case TAC_EQ:
+        return TAC_NEQ;
+    case TAC_NEQ:
+        return TAC_EQ;
+    case TAC_LE:
+        return TAC_GT;
+    default:
+        return TAC_LT;
+    }
+}
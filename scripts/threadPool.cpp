@@ -0,0 +1,133 @@
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <atomic>
+
+using namespace std;
+
+/*
+Work-stealing thread pool.
+Every worker owns a deque of tasks. Tasks submitted from outside are dealt to
+the deques round-robin; a worker takes from the back of its own deque and,
+when that is empty, steals from the front of the others', so a worker that
+drew cheap tasks keeps busy with the expensive ones left elsewhere. Each deque
+has its own lock, the shared lock is only taken to sleep and wake up.
+*/
+class ThreadPool
+{
+public:
+    explicit ThreadPool(size_t threadCount)
+    {
+        threadCount = max<size_t>(threadCount, 1);
+        for (size_t i = 0; i < threadCount; i++)
+            queues.push_back(make_unique<WorkQueue>());
+        for (size_t i = 0; i < threadCount; i++)
+            workers.emplace_back([this, i]
+                                 { work(i); });
+    }
+
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    ~ThreadPool()
+    {
+        {
+            lock_guard<mutex> lock(stateLock);
+            stopping = true;
+        }
+        workAvailable.notify_all();
+        for (thread &worker : workers)
+            worker.join();
+    }
+
+    void submit(function<void()> task)
+    {
+        {
+            lock_guard<mutex> lock(stateLock);
+            pending++;
+            queued++;
+        }
+        WorkQueue &queue = *queues[nextQueue++ % queues.size()];
+        {
+            lock_guard<mutex> lock(queue.lock);
+            queue.tasks.push_back(move(task));
+        }
+        workAvailable.notify_one();
+    }
+
+    // Blocks until every submitted task has finished
+    void wait()
+    {
+        unique_lock<mutex> lock(stateLock);
+        allDone.wait(lock, [this]
+                     { return pending == 0; });
+    }
+
+private:
+    struct WorkQueue
+    {
+        mutex lock;
+        deque<function<void()>> tasks;
+    };
+
+    vector<unique_ptr<WorkQueue>> queues;
+    vector<thread> workers;
+    size_t nextQueue = 0; // Only touched by the submitting thread
+
+    mutex stateLock;
+    condition_variable workAvailable;
+    condition_variable allDone;
+    size_t pending = 0;      // Submitted and not finished yet
+    atomic<size_t> queued{0}; // Sitting in a deque, counted before the push so a sleeper never misses one
+    bool stopping = false;
+
+    bool takeTask(size_t self, function<void()> &task)
+    {
+        for (size_t i = 0; i < queues.size(); i++)
+        {
+            WorkQueue &queue = *queues[(self + i) % queues.size()];
+            lock_guard<mutex> lock(queue.lock);
+            if (queue.tasks.empty())
+                continue;
+            // Own work from the back, stolen work from the front
+            if (i == 0)
+            {
+                task = move(queue.tasks.back());
+                queue.tasks.pop_back();
+            }
+            else
+            {
+                task = move(queue.tasks.front());
+                queue.tasks.pop_front();
+            }
+            queued--;
+            return true;
+        }
+        return false;
+    }
+
+    void work(size_t self)
+    {
+        while (true)
+        {
+            function<void()> task;
+            if (takeTask(self, task))
+            {
+                task();
+                lock_guard<mutex> lock(stateLock);
+                if (--pending == 0)
+                    allDone.notify_all();
+                continue;
+            }
+            unique_lock<mutex> lock(stateLock);
+            if (stopping && queued == 0)
+                return;
+            workAvailable.wait(lock, [this]
+                               { return stopping || queued > 0; });
+        }
+    }
+};
@@ -0,0 +1,252 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <utility>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <new>
+#include <ctime>
+#include <malloc.h>
+
+using namespace std;
+
+/*
+Heap accounting for the time report. Every operator new and delete in the
+process goes through the replacements below, which count what the calling
+thread allocates once countAllocations is set. Sizes come from
+malloc_usable_size(), so no header is added to the blocks, and a block freed
+on another thread only lowers that thread's live count. Without a report to
+fill, the replacements go straight to malloc and free.
+*/
+struct AllocationCounters
+{
+    int64_t live = 0;    // Bytes currently allocated by this thread
+    int64_t peak = 0;    // Most bytes live at once since the counter was last reset
+    uint64_t total = 0;  // Bytes ever allocated
+    uint64_t count = 0;  // Allocations ever made
+};
+
+inline thread_local AllocationCounters allocationCounters;
+
+// Set by --time-report before anything is compiled, and never changed after
+inline bool countAllocations = false;
+
+// Kept out of line, so the compiler never pairs an inlined operator new with free()
+__attribute__((noinline)) void *countedAllocate(size_t size) noexcept
+{
+    void *block = malloc(size == 0 ? 1 : size);
+    if (block != nullptr && countAllocations)
+    {
+        AllocationCounters &counters = allocationCounters;
+        size_t usable = malloc_usable_size(block);
+        counters.live += usable;
+        counters.total += usable;
+        counters.count++;
+        if (counters.live > counters.peak)
+            counters.peak = counters.live;
+    }
+    return block;
+}
+
+__attribute__((noinline)) void countedFree(void *block) noexcept
+{
+    if (block == nullptr)
+        return;
+    if (countAllocations)
+        allocationCounters.live -= malloc_usable_size(block);
+    free(block);
+}
+
+void *operator new(size_t size)
+{
+    void *block = countedAllocate(size);
+    if (block == nullptr)
+        throw bad_alloc();
+    return block;
+}
+
+void *operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void *operator new(size_t size, const nothrow_t &) noexcept
+{
+    return countedAllocate(size);
+}
+
+void *operator new[](size_t size, const nothrow_t &) noexcept
+{
+    return countedAllocate(size);
+}
+
+void operator delete(void *block) noexcept
+{
+    countedFree(block);
+}
+
+void operator delete[](void *block) noexcept
+{
+    countedFree(block);
+}
+
+void operator delete(void *block, size_t) noexcept
+{
+    countedFree(block);
+}
+
+void operator delete[](void *block, size_t) noexcept
+{
+    countedFree(block);
+}
+
+void operator delete(void *block, const nothrow_t &) noexcept
+{
+    countedFree(block);
+}
+
+void operator delete[](void *block, const nothrow_t &) noexcept
+{
+    countedFree(block);
+}
+
+/*
+Per-phase measurements of one compilation, printed by --time-report (a
+table on stderr) and --time-report-json (one JSON object). Phases are
+recorded on the compiling thread between begin() and end(): wall time, the
+thread's CPU time, the allocations made, and the peak heap above what was
+live when the phase began. count() attaches sizes such as the number of
+tokens to the phase that just ended.
+*/
+class TimeReport
+{
+public:
+    struct Phase
+    {
+        string name;
+        double wallMilliseconds = 0;
+        double cpuMilliseconds = 0;
+        uint64_t allocations = 0;
+        uint64_t allocatedBytes = 0;
+        int64_t peakBytes = 0;
+        int64_t liveAtStart = 0; // Relative to the first phase, to find the overall peak
+        vector<pair<string, uint64_t>> counts;
+    };
+
+    vector<Phase> phases;
+
+    void begin(const string &name)
+    {
+        AllocationCounters &counters = allocationCounters;
+        if (phases.empty())
+            baseLive = counters.live;
+        Phase phase;
+        phase.name = name;
+        phase.liveAtStart = counters.live - baseLive;
+        phases.push_back(phase);
+        startLive = counters.live;
+        startTotal = counters.total;
+        startCount = counters.count;
+        counters.peak = counters.live;
+        startWall = chrono::steady_clock::now();
+        startCpu = threadCpuMilliseconds();
+    }
+
+    void end()
+    {
+        double cpu = threadCpuMilliseconds();
+        auto wall = chrono::steady_clock::now();
+        AllocationCounters &counters = allocationCounters;
+        Phase &phase = phases.back();
+        phase.wallMilliseconds = chrono::duration<double, milli>(wall - startWall).count();
+        phase.cpuMilliseconds = cpu - startCpu;
+        phase.allocations = counters.count - startCount;
+        phase.allocatedBytes = counters.total - startTotal;
+        phase.peakBytes = counters.peak - startLive;
+    }
+
+    void count(const string &what, uint64_t value)
+    {
+        phases.back().counts.emplace_back(what, value);
+    }
+
+    Phase total() const
+    {
+        Phase sum;
+        sum.name = "total";
+        for (const Phase &phase : phases)
+        {
+            sum.wallMilliseconds += phase.wallMilliseconds;
+            sum.cpuMilliseconds += phase.cpuMilliseconds;
+            sum.allocations += phase.allocations;
+            sum.allocatedBytes += phase.allocatedBytes;
+            sum.peakBytes = max(sum.peakBytes, phase.liveAtStart + phase.peakBytes);
+        }
+        return sum;
+    }
+
+    void print(ostream &out) const
+    {
+        out << left << setw(20) << "Phase" << right << setw(11) << "Wall ms" << setw(11) << "CPU ms"
+            << setw(10) << "Allocs" << setw(14) << "Allocated" << setw(14) << "Peak heap" << "  Counts" << endl;
+        for (const Phase &phase : phases)
+            printRow(out, phase);
+        printRow(out, total());
+    }
+
+    void printJson(ostream &out, const string &inputFile, int optimizationLevel) const
+    {
+        out << "{\"compiler\": \"jwd\", \"build\": \"" << __DATE__ " " __TIME__ << "\", \"input\": \"";
+        for (char c : inputFile)
+        {
+            if (c == '"' || c == '\\')
+                out << '\\';
+            out << c;
+        }
+        out << "\", \"optimizationLevel\": " << optimizationLevel << ",\n \"phases\": [";
+        for (size_t i = 0; i < phases.size(); i++)
+        {
+            out << (i == 0 ? "\n  " : ",\n  ");
+            printJsonPhase(out, phases[i]);
+        }
+        out << "],\n \"total\": ";
+        printJsonPhase(out, total());
+        out << "}" << endl;
+    }
+
+private:
+    chrono::steady_clock::time_point startWall;
+    double startCpu = 0;
+    int64_t baseLive = 0, startLive = 0;
+    uint64_t startTotal = 0, startCount = 0;
+
+    static double threadCpuMilliseconds()
+    {
+        timespec now;
+        clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+        return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+    }
+
+    static void printRow(ostream &out, const Phase &phase)
+    {
+        out << left << setw(20) << phase.name << right << fixed << setprecision(3)
+            << setw(11) << phase.wallMilliseconds << setw(11) << phase.cpuMilliseconds
+            << setw(10) << phase.allocations << setw(14) << phase.allocatedBytes << setw(14) << phase.peakBytes;
+        for (const auto &[what, value] : phase.counts)
+            out << "  " << what << "=" << value;
+        out << defaultfloat << endl;
+    }
+
+    static void printJsonPhase(ostream &out, const Phase &phase)
+    {
+        out << fixed << setprecision(3) << "{\"name\": \"" << phase.name << "\", \"wallMs\": " << phase.wallMilliseconds
+            << ", \"cpuMs\": " << phase.cpuMilliseconds << ", \"allocations\": " << phase.allocations
+            << ", \"allocatedBytes\": " << phase.allocatedBytes << ", \"peakBytes\": " << phase.peakBytes
+            << ", \"counts\": {";
+        for (size_t i = 0; i < phase.counts.size(); i++)
+            out << (i == 0 ? "" : ", ") << "\"" << phase.counts[i].first << "\": " << phase.counts[i].second;
+        out << "}}" << defaultfloat;
+    }
+};
@@ -0,0 +1,178 @@
+#include <string>
+#include <string_view>
+#include <vector>
+#include <deque>
+#include <cstdint>
+#include <algorithm>
+
+using namespace std;
+
+/*
+Maps strings to dense integer ids, each distinct string is stored once.
+Lookups go through a small open-addressing table of ids, so interning a
+string costs one hash and usually a single comparison.
+*/
+class StringInterner
+{
+public:
+    StringInterner()
+    {
+        slots.assign(64, EMPTY_SLOT);
+    }
+
+    // Intern text that is guaranteed to outlive the interner (e.g. the mapped source file)
+    uint32_t internView(string_view text)
+    {
+        return insert(text, false);
+    }
+
+    // Intern text with an unknown lifetime, a copy is kept if the string is new
+    uint32_t intern(string_view text)
+    {
+        return insert(text, true);
+    }
+
+    // Returns the id of `text` or NOT_FOUND without interning it
+    uint32_t find(string_view text) const
+    {
+        size_t mask = slots.size() - 1;
+        for (size_t slot = hashOf(text) & mask;; slot = (slot + 1) & mask)
+        {
+            if (slots[slot] == EMPTY_SLOT)
+                return NOT_FOUND;
+            if (strings[slots[slot]] == text)
+                return slots[slot];
+        }
+    }
+
+    string_view lookup(uint32_t id) const
+    {
+        return strings[id];
+    }
+
+    size_t size() const
+    {
+        return strings.size();
+    }
+
+    static constexpr uint32_t NOT_FOUND = UINT32_MAX;
+
+private:
+    static constexpr uint32_t EMPTY_SLOT = UINT32_MAX;
+
+    vector<string_view> strings; // id -> text
+    vector<uint32_t> slots;      // open-addressing table of ids, size is a power of two
+    deque<string> ownedStrings;  // Backing storage for copied strings, deque keeps them from moving
+
+    static size_t hashOf(string_view text)
+    {
+        // FNV-1a, tokens are short so this beats anything fancier
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : text)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    uint32_t insert(string_view text, bool copy)
+    {
+        size_t mask = slots.size() - 1;
+        size_t slot = hashOf(text) & mask;
+        while (slots[slot] != EMPTY_SLOT)
+        {
+            if (strings[slots[slot]] == text)
+                return slots[slot];
+            slot = (slot + 1) & mask;
+        }
+
+        if (copy)
+        {
+            ownedStrings.emplace_back(text);
+            text = ownedStrings.back();
+        }
+        uint32_t id = strings.size();
+        strings.push_back(text);
+        slots[slot] = id;
+
+        // Keep the load factor under 1/2
+        if (strings.size() * 2 > slots.size())
+            grow();
+        return id;
+    }
+
+    void grow()
+    {
+        vector<uint32_t> newSlots(slots.size() * 2, EMPTY_SLOT);
+        size_t mask = newSlots.size() - 1;
+        for (uint32_t id = 0; id < strings.size(); id++)
+        {
+            size_t slot = hashOf(strings[id]) & mask;
+            while (newSlots[slot] != EMPTY_SLOT)
+                slot = (slot + 1) & mask;
+            newSlots[slot] = id;
+        }
+        slots.swap(newSlots);
+    }
+};
+
+/*
+Struct-of-arrays token stream produced by the lexer.
+A token is its index: one type byte, a 32-bit source offset and a 32-bit id
+of its interned text (9 bytes in total). Line numbers are not stored per
+token, they are recovered from the offset through the line table.
+*/
+class TokenStream
+{
+public:
+    vector<uint8_t> types;
+    vector<uint32_t> offsets;
+    vector<uint32_t> valueIds;
+    vector<uint32_t> lineStarts; // Source offset at which every line begins
+    StringInterner values;
+
+    TokenStream()
+    {
+        lineStarts.push_back(0);
+    }
+
+    void push(TokenType type, uint32_t offset, uint32_t valueId)
+    {
+        types.push_back(type);
+        offsets.push_back(offset);
+        valueIds.push_back(valueId);
+    }
+
+    void reserve(size_t count)
+    {
+        types.reserve(count);
+        offsets.reserve(count);
+        valueIds.reserve(count);
+    }
+
+    TokenType type(size_t index) const
+    {
+        return static_cast<TokenType>(types[index]);
+    }
+
+    string_view text(size_t index) const
+    {
+        return values.lookup(valueIds[index]);
+    }
+
+    uint32_t valueId(size_t index) const
+    {
+        return valueIds[index];
+    }
+
+    size_t line(size_t index) const
+    {
+        return upper_bound(lineStarts.begin(), lineStarts.end(), offsets[index]) - lineStarts.begin() - 1;
+    }
+
+    size_t size() const
+    {
+        return types.size();
+    }
+};
@@ -0,0 +1,48 @@
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include <spawn.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+/*
+Drives the system assembler and linker on the generated assembly. The tools
+are spawned directly, without a shell, so file names need no quoting, and
+posix_spawn keeps this safe while other threads are compiling. A tool that
+cannot be run or fails throws a runtime_error.
+*/
+class Toolchain
+{
+public:
+    // Assembles `assemblyFile` into the object file `objectFile`
+    static void assemble(const string &assemblyFile, const string &objectFile)
+    {
+        run({"as", "--64", assemblyFile, "-o", objectFile});
+    }
+
+    // Links a static executable, the program's entry point is _start
+    static void link(const string &objectFile, const string &executableFile)
+    {
+        run({"ld", objectFile, "-o", executableFile});
+    }
+
+private:
+    // Runs a tool found on PATH and waits for it to exit with status 0
+    static void run(const vector<string> &arguments)
+    {
+        vector<char *> argv;
+        for (const string &argument : arguments)
+            argv.push_back(const_cast<char *>(argument.c_str()));
+        argv.push_back(nullptr);
+
+        pid_t pid;
+        if (posix_spawnp(&pid, argv[0], nullptr, nullptr, argv.data(), environ) != 0)
+            throw runtime_error(arguments[0] + " was not found");
+        int status = 0;
+        if (waitpid(pid, &status, 0) < 0)
+            throw runtime_error("Could not run " + arguments[0]);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            throw runtime_error(arguments[0] + " failed");
+    }
+};
@@ -1,8 +1,16 @@
 #include <string>
 #include <map>
+#include <stdexcept>
 
 using namespace std;
 
+// An error in the program being compiled, reported instead of exiting so one compilation cannot end the others
+class CompileError : public runtime_error
+{
+public:
+    using runtime_error::runtime_error;
+};
+
 enum TokenType
 {
     T_INT,       // 0
@@ -36,20 +44,15 @@ enum TokenType
     T_FLOAT,     // 27
     T_STRING,    // 28
     T_CHAR,      // 29
+    T_COMMA,     // 30 ===> For ,
+    T_LBRACKET,  // 31 ===> For [
+    T_RBRACKET,  // 32 ===> For ]
     T_UNDEFINED, // undefined
 };
 
 bool isComparisonOperator(TokenType op)
 {
-    map<TokenType, string> ops;
-    ops[T_LT] = "Less Than";
-    ops[T_GT] = "Greater Than";
-    ops[T_EQ] = "Equals To";
-    ops[T_NEQ] = "Not Equals To";
-    ops[T_LE] = "Less Than Equals To";
-    ops[T_GE] = "Greater Than Equals To";
-
-    return ops.find(op) != ops.end();
+    return op == T_LT || op == T_GT || op == T_EQ || op == T_NEQ || op == T_LE || op == T_GE;
 }
 
 string getTokenName(TokenType type)
@@ -118,18 +121,14 @@ string getTokenName(TokenType type)
         return "string";
     case T_CHAR:
         return "char";
+    case T_COMMA:
+        return "comma";
+    case T_LBRACKET:
+        return "[";
+    case T_RBRACKET:
+        return "]";
     default:
         return "undefined";
     }
     return "";
 }
-
-struct Token
-{
-    TokenType type;
-    string value;
-    size_t lineNumber;
-
-    // These attributes are only used to return values between functions
-    string icgVariable;
-};
\ No newline at end of file
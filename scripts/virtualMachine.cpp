@@ -0,0 +1,331 @@
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+
+using namespace std;
+
+/*
+Interpreter behind --run.
+Linear TAC is lowered to a register bytecode: every temp, variable and
+constant gets a register, so each instruction names three register numbers
+and nothing else. Labels turn into instruction indexes and disappear.
+Dispatch is direct-threaded with GCC's labels as values: each instruction
+carries the address of its handler, and every handler ends by jumping straight
+to the next one. Strings are indexes into a table of the values created so far.
+The units of a program (the top-level code and each function) are laid out one
+after the other, each with a register file of its own. A call runs the callee
+on a fresh copy of its register file, with the arguments in its parameters,
+and fresh memory for its arrays. Vector registers are lanes of their own next
+to the register file, vectorWidth of them each.
+*/
+class VirtualMachine
+{
+public:
+    // Lowers the TAC of the units, unit 0 being the top-level code and unit i + 1 function i, to bytecode
+    void load(const vector<IntermediateCodeGenerator> &code)
+    {
+        program.clear();
+        threaded.clear();
+        units.clear();
+        strings.clear();
+        for (const IntermediateCodeGenerator &unit : code)
+        {
+            units.emplace_back();
+            registerOf.clear();
+            immediateOf.clear();
+            stringOf.clear();
+            stringBase = strings.size();
+            strings.insert(strings.end(), unit.strings.values().begin(), unit.strings.values().end());
+            Unit &function = units.back();
+            function.entry = program.size();
+            function.lanes = unit.vectorWidth;
+            for (int64_t length : unit.arrayLengths)
+            {
+                function.arrayOffsets.push_back(function.memoryWords);
+                function.arrayLengths.push_back(length);
+                function.memoryWords += length;
+            }
+
+            unordered_map<int64_t, int32_t> labelTargets; // Label -> index of the instruction it precedes
+            for (const TacInstruction &instr : unit.instructions)
+            {
+                if (instr.op == TAC_LABEL)
+                    labelTargets[instr.dest.value] = program.size();
+                else if (instr.op == TAC_CALL)
+                    program.push_back(Instruction{instr.op, registerFor(function, instr.dest), (int32_t)instr.left.value + 1, (int32_t)instr.right.value});
+                else
+                    program.push_back(Instruction{instr.op, registerFor(function, instr.dest), registerFor(function, instr.left), registerFor(function, instr.right)});
+                function.usesVectors = function.usesVectors || isVectorOpcode(instr.op);
+            }
+            // Running off the end returns 0
+            program.push_back(Instruction{TAC_RETURN, 0, registerFor(function, immediateOperand(0)), 0});
+            for (const TacOperand &parameter : unit.parameters)
+                function.parameters.push_back(registerFor(function, parameter));
+
+            size_t index = function.entry;
+            for (const TacInstruction &instr : unit.instructions)
+            {
+                if (instr.op == TAC_LABEL)
+                    continue;
+                if (isJumpOpcode(instr.op))
+                    program[index].dest = labelTargets.at(instr.dest.value);
+                index++;
+            }
+        }
+    }
+
+    // Runs the loaded program, returning the exit status of the process it stands for
+    int run()
+    {
+        arguments.clear();
+        try
+        {
+            // Only the low byte reaches the parent, as with the exit syscall
+            return (int)(execute(0) & 0xFF);
+        }
+        catch (const DivisionTrap &)
+        {
+            // Where the native program is killed by SIGFPE
+            cerr << "Runtime error: integer division overflow" << endl;
+            return 128 + 8;
+        }
+        catch (const BoundsTrap &)
+        {
+            // Where the native program reaches its UD2 and is killed by SIGILL
+            cerr << "Runtime error: array index out of range" << endl;
+            return 128 + 4;
+        }
+    }
+
+private:
+    struct Instruction
+    {
+        TacOpcode op;
+        int32_t dest; // Register written, or instruction index for jumps
+        int32_t left; // Unit called by a call
+        int32_t right;
+    };
+
+    struct ThreadedInstruction
+    {
+        const void *handler;
+        int32_t dest;
+        int32_t left;
+        int32_t right;
+    };
+
+    struct Unit
+    {
+        size_t entry = 0;             // Index of the unit's first instruction
+        vector<int64_t> registers;    // Initial register file, constants preloaded
+        vector<int32_t> parameters;   // Register of each parameter
+        vector<int64_t> arrayOffsets; // Array id -> its element 0 in the unit's memory
+        vector<int64_t> arrayLengths; // Array id -> number of elements
+        int64_t memoryWords = 0;      // Elements of every array
+        int lanes = 0;                // Elements per vector register
+        bool usesVectors = false;
+    };
+
+    // Thrown out of every active call when a division traps
+    struct DivisionTrap
+    {
+    };
+
+    // Thrown out of every active call when an array index is out of range
+    struct BoundsTrap
+    {
+    };
+
+    vector<Instruction> program;
+    vector<ThreadedInstruction> threaded;       // program with handler addresses, built on the first run
+    vector<Unit> units;                         // Unit 0 is the top-level code
+    unordered_map<int64_t, int32_t> registerOf; // Temp or variable key -> register, of the unit being loaded
+    unordered_map<int64_t, int32_t> immediateOf; // Immediate value -> register, of the unit being loaded
+    unordered_map<int64_t, int32_t> stringOf;    // String constant -> register, of the unit being loaded
+    size_t stringBase = 0;                      // Index of the unit being loaded's first constant in strings
+    vector<int64_t> arguments;                  // Passed by TAC_ARG and not yet taken by their call
+
+    vector<string> strings; // Constants first, then every concatenation result
+
+    // Runs unit `unit` until it returns, taking its arguments off the end of `arguments`
+    int64_t execute(size_t unit)
+    {
+        // Indexed by TacOpcode
+        static const void *handlers[] = {&&copy, &&add, &&subtract, &&multiply, &&divide, &&concat,
+                                         &&lessThan, &&greaterThan, &&equal, &&notEqual, &&lessEqual, &&greaterEqual,
+                                         &&jumpLess, &&jumpGreater, &&jumpEqual, &&jumpNotEqual, &&jumpLessEqual, &&jumpGreaterEqual,
+                                         &&jump, nullptr, &&exit, &&argument, &&call, &&loadElement, &&storeElement, &&clear,
+                                         &&vectorLoad, &&vectorStore, &&vectorSplat, &&vectorAdd, &&vectorSubtract};
+        if (threaded.empty())
+        {
+            threaded.reserve(program.size());
+            for (const Instruction &instr : program)
+                threaded.push_back(ThreadedInstruction{handlers[instr.op], instr.dest, instr.left, instr.right});
+        }
+
+        const Unit &function = units[unit];
+        vector<int64_t> values = function.registers;
+        size_t first = arguments.size() - function.parameters.size();
+        for (size_t i = 0; i < function.parameters.size(); i++)
+            values[function.parameters[i]] = arguments[first + i];
+        arguments.resize(first);
+
+        // Every array is cleared by its declaration before it is used
+        vector<int64_t> memory(function.memoryWords);
+        vector<int64_t> lanes(function.usesVectors ? LoopVectorizer::vectorRegisters * function.lanes : 0);
+        int64_t *m = memory.data();
+        int64_t *v = lanes.data();
+        const int64_t *offsets = function.arrayOffsets.data();
+        const int64_t *lengths = function.arrayLengths.data();
+        const int width = function.lanes;
+
+        int64_t *r = values.data();
+        const ThreadedInstruction *code = threaded.data();
+        const ThreadedInstruction *ip = code + function.entry;
+
+#define DISPATCH() goto *ip->handler
+#define NEXT()        \
+    do                \
+    {                 \
+        ip++;         \
+        DISPATCH();   \
+    } while (false)
+#define BRANCH(condition)                                          \
+    do                                                             \
+    {                                                              \
+        ip = (condition) ? code + ip->dest : ip + 1;               \
+        DISPATCH();                                                \
+    } while (false)
+
+        DISPATCH();
+    copy:
+        r[ip->dest] = r[ip->left];
+        NEXT();
+    add:
+        // Arithmetic wraps around like the native code
+        r[ip->dest] = (int64_t)((uint64_t)r[ip->left] + (uint64_t)r[ip->right]);
+        NEXT();
+    subtract:
+        r[ip->dest] = (int64_t)((uint64_t)r[ip->left] - (uint64_t)r[ip->right]);
+        NEXT();
+    multiply:
+        r[ip->dest] = (int64_t)((uint64_t)r[ip->left] * (uint64_t)r[ip->right]);
+        NEXT();
+    divide:
+        if (r[ip->right] == 0 || (r[ip->left] == INT64_MIN && r[ip->right] == -1))
+            throw DivisionTrap{};
+        r[ip->dest] = r[ip->left] / r[ip->right];
+        NEXT();
+    concat:
+        strings.push_back(strings[r[ip->left]] + strings[r[ip->right]]);
+        r[ip->dest] = strings.size() - 1;
+        NEXT();
+    lessThan:
+        r[ip->dest] = r[ip->left] < r[ip->right];
+        NEXT();
+    greaterThan:
+        r[ip->dest] = r[ip->left] > r[ip->right];
+        NEXT();
+    equal:
+        r[ip->dest] = r[ip->left] == r[ip->right];
+        NEXT();
+    notEqual:
+        r[ip->dest] = r[ip->left] != r[ip->right];
+        NEXT();
+    lessEqual:
+        r[ip->dest] = r[ip->left] <= r[ip->right];
+        NEXT();
+    greaterEqual:
+        r[ip->dest] = r[ip->left] >= r[ip->right];
+        NEXT();
+    jumpLess:
+        BRANCH(r[ip->left] < r[ip->right]);
+    jumpGreater:
+        BRANCH(r[ip->left] > r[ip->right]);
+    jumpEqual:
+        BRANCH(r[ip->left] == r[ip->right]);
+    jumpNotEqual:
+        BRANCH(r[ip->left] != r[ip->right]);
+    jumpLessEqual:
+        BRANCH(r[ip->left] <= r[ip->right]);
+    jumpGreaterEqual:
+        BRANCH(r[ip->left] >= r[ip->right]);
+    jump:
+        ip = code + ip->dest;
+        DISPATCH();
+    exit:
+        return r[ip->left];
+    argument:
+        arguments.push_back(r[ip->left]);
+        NEXT();
+    call:
+        r[ip->dest] = execute(ip->left);
+        NEXT();
+    loadElement:
+        // One unsigned compare also catches negative indexes
+        if ((uint64_t)r[ip->right] >= (uint64_t)lengths[ip->left])
+            throw BoundsTrap{};
+        r[ip->dest] = m[offsets[ip->left] + r[ip->right]];
+        NEXT();
+    storeElement:
+        if ((uint64_t)r[ip->left] >= (uint64_t)lengths[ip->dest])
+            throw BoundsTrap{};
+        m[offsets[ip->dest] + r[ip->left]] = r[ip->right];
+        NEXT();
+    clear:
+        fill(m + offsets[ip->dest], m + offsets[ip->dest] + lengths[ip->dest], 0);
+        NEXT();
+    vectorLoad:
+        // The vectorized loop's condition keeps every lane in range
+        copy(m + offsets[ip->left] + r[ip->right], m + offsets[ip->left] + r[ip->right] + width, v + ip->dest * width);
+        NEXT();
+    vectorStore:
+        copy(v + ip->right * width, v + ip->right * width + width, m + offsets[ip->dest] + r[ip->left]);
+        NEXT();
+    vectorSplat:
+        fill(v + ip->dest * width, v + ip->dest * width + width, r[ip->left]);
+        NEXT();
+    vectorAdd:
+        for (int lane = 0; lane < width; lane++)
+            v[ip->dest * width + lane] = (int64_t)((uint64_t)v[ip->left * width + lane] + (uint64_t)v[ip->right * width + lane]);
+        NEXT();
+    vectorSubtract:
+        for (int lane = 0; lane < width; lane++)
+            v[ip->dest * width + lane] = (int64_t)((uint64_t)v[ip->left * width + lane] - (uint64_t)v[ip->right * width + lane]);
+        NEXT();
+
+#undef BRANCH
+#undef NEXT
+#undef DISPATCH
+    }
+
+    /*
+    Register of the unit `function` holding a temp, variable or constant; an
+    array or vector register is numbered as in the TAC, and unused operands read register 0
+    */
+    int32_t registerFor(Unit &function, const TacOperand &operand)
+    {
+        if (operand.kind == OPERAND_ARRAY || operand.kind == OPERAND_VECTOR)
+            return (int32_t)operand.value;
+        if (operand.kind != OPERAND_TEMP && operand.kind != OPERAND_VAR && operand.kind != OPERAND_IMM &&
+            operand.kind != OPERAND_STR)
+            return 0;
+        // Constants are keyed by their value alone, which operandKey would overflow for large immediates
+        unordered_map<int64_t, int32_t> &registers = operand.kind == OPERAND_IMM   ? immediateOf
+                                                     : operand.kind == OPERAND_STR ? stringOf
+                                                                                   : registerOf;
+        auto [it, inserted] = registers.emplace(operand.kind == OPERAND_IMM || operand.kind == OPERAND_STR ? operand.value : operandKey(operand),
+                                                function.registers.size());
+        if (inserted)
+        {
+            // A string register holds the index of the string in the table
+            if (operand.kind == OPERAND_STR)
+                function.registers.push_back(stringBase + operand.value);
+            else
+                function.registers.push_back(operand.kind == OPERAND_IMM ? operand.value : 0);
+        }
+        return it->second;
+    }
+};
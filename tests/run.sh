@@ -0,0 +1,39 @@
+#!/bin/sh
+# Builds the compiler and checks that every program in tests/ exits with the status on its first line
+# (// expect: <status>), natively, under --run and under --jit, at -O0 and at -O1.
+# A program expecting `error` must be rejected by the compiler at both levels instead.
+set -e
+cd "$(dirname "$0")"
+tests="$(pwd)"
+g++ -std=c++17 -O2 -pthread ../main.cpp -o main
+
+# The compiler writes output/ in the working directory
+work="$(mktemp -d)"
+trap 'rm -rf "$work"' EXIT
+mkdir "$work/output"
+cd "$work"
+
+failed=0
+for program in "$tests"/*.jwd; do
+    expected="$(sed -n '1s|^// expect: *||p' "$program")"
+    for level in -O0 -O1; do
+        if [ "$expected" = error ]; then
+            if "$tests/main" $level "$program" >/dev/null 2>&1; then
+                echo "FAIL $(basename "$program") $level: compiled, expected an error"
+                failed=1
+            fi
+            continue
+        fi
+        "$tests/main" $level -o program "$program" >/dev/null 2>&1 || true
+        ./program >/dev/null 2>&1 && native=0 || native=$?
+        "$tests/main" $level --run "$program" >/dev/null 2>&1 && run=0 || run=$?
+        "$tests/main" $level --jit "$program" >/dev/null 2>&1 && jit=0 || jit=$?
+        rm -f program
+        if [ "$native $run $jit" != "$expected $expected $expected" ]; then
+            echo "FAIL $(basename "$program") $level: native $native, --run $run, --jit $jit, expected $expected"
+            failed=1
+        fi
+    done
+done
+[ $failed = 0 ] && echo "All tests passed"
+exit $failed